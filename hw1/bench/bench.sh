@@ -0,0 +1,116 @@
+#!/bin/sh
+#
+# Benchmark of philo on synthetic matrices (make bench).
+#
+# The program timed is bin/philo-bench, which make bench builds from the
+# same sources as bin/philo but with -O2 (bin/philo itself is built without
+# optimisation); BENCH_PHILO times another.
+#
+# For each size, an additive, a noisy and a tied matrix are generated by
+# genmatrix (cached in BENCH_DIR), and philo is run on each with -v in
+# every output mode: the edges, -n, -m and -c.  The tied matrix is noisy,
+# with each taxon written BENCH_COPIES times, as identical sequences give:
+# its Q values tie at almost every join.  The JSON line of each run, with the
+# matrix and the mode added, goes to bench/results/<label>.jsonl, and a
+# table of the wall times of the phases to the terminal.  Two result files
+# can be put side by side with bench/compare.sh.
+#
+# The edges of every run are checked: for the additive matrix, against the
+# tree it was generated from, which neighbor joining must recover, and up
+# to BENCH_CHECK_MAX taxa, against those of njref, a plain textbook
+# implementation.  njref adds the row sums up afresh at every join, so on
+# the tied matrix this also checks that ties are broken as with exact
+# sums.  A mismatch makes the benchmark fail.  Relaxed joining
+# (-x in BENCH_OPTS) may build another tree by design, so it is not checked.
+#
+# Settings, from the environment:
+#   BENCH_SIZES       numbers of taxa (default "100 1000 5000 20000")
+#   BENCH_OPTS        extra options for philo, e.g. "-j 8" or "-x"
+#   BENCH_LABEL       name of the result file (default: the commit)
+#   BENCH_DIR         where the matrices and outputs go (default /tmp/philo-bench)
+#   BENCH_CHECK_MAX   largest size checked against njref (default 1000)
+#   BENCH_MATRIX_MAX  largest size run with -m, whose output grows as 24 n^2 bytes (default 5000)
+#   BENCH_NOISE       standard deviation of the noise, in log space (default 0.1)
+#   BENCH_COPIES      copies of each taxon in the tied matrix (default 5)
+#   BENCH_SEED        seed of the matrices (default 1)
+#   BENCH_PHILO       the program to time (default bin/philo-bench)
+
+SIZES=${BENCH_SIZES:-"100 1000 5000 20000"}
+OPTS=${BENCH_OPTS:-}
+LABEL=${BENCH_LABEL:-$(git rev-parse --short HEAD 2>/dev/null || echo local)}
+DIR=${BENCH_DIR:-/tmp/philo-bench}
+CHECK_MAX=${BENCH_CHECK_MAX:-1000}
+MATRIX_MAX=${BENCH_MATRIX_MAX:-5000}
+NOISE=${BENCH_NOISE:-0.1}
+COPIES=${BENCH_COPIES:-5}
+SEED=${BENCH_SEED:-1}
+
+PHILO=${BENCH_PHILO:-bin/philo-bench}
+RESULTS=bench/results/$LABEL.jsonl
+
+case " $OPTS " in
+    *" -x "*) check=no ;;
+    *) check=yes ;;
+esac
+
+mkdir -p "$DIR" bench/results || exit 1
+: > "$RESULTS" || exit 1
+failed=0
+
+# the wall time of a phase, from a JSON line of philo -v
+wall() {
+    sed -n "s/.*\"$1\":{\"wall\":\([0-9.]*\).*/\1/p"
+}
+
+printf '%-7s %-9s %-5s %10s %10s %10s %10s\n' taxa matrix mode read search update output
+for n in $SIZES; do
+    for matrix in additive noisy tied; do
+        csv=$DIR/$matrix-$n-$SEED.csv
+        tree=$DIR/additive-$n-$SEED.tree
+        if [ ! -s "$csv" ]; then
+            if [ $matrix = additive ]; then
+                bin/genmatrix -s "$SEED" -t "$tree" "$n" > "$csv.tmp"
+            elif [ $matrix = noisy ]; then
+                bin/genmatrix -s "$SEED" -e "$NOISE" "$n" > "$csv.tmp"
+            else
+                bin/genmatrix -s "$SEED" -e "$NOISE" -c "$COPIES" "$n" > "$csv.tmp"
+            fi || { rm -f "$csv.tmp"; exit 1; }
+            mv "$csv.tmp" "$csv"
+        fi
+
+        for mode in edges -n -m -c; do
+            [ $mode = -m ] && [ "$n" -gt "$MATRIX_MAX" ] && continue
+            flag=$mode
+            [ $mode = edges ] && flag=
+
+            # shellcheck disable=SC2086
+            if ! $PHILO $flag $OPTS -v < "$csv" > "$DIR/out" 2> "$DIR/err"; then
+                echo "philo $flag $OPTS failed on $csv:" >&2
+                cat "$DIR/err" >&2
+                failed=1
+                continue
+            fi
+            stats=$(grep '^{' "$DIR/err" | tail -n 1)
+            echo "$stats" | sed "s/^{/{\"label\":\"$LABEL\",\"matrix\":\"$matrix\",\"mode\":\"$mode\",\"options\":\"$OPTS\",/" >> "$RESULTS"
+            printf '%-7s %-9s %-5s %10s %10s %10s %10s\n' "$n" $matrix $mode \
+                "$(echo "$stats" | wall read)" "$(echo "$stats" | wall search)" \
+                "$(echo "$stats" | wall update)" "$(echo "$stats" | wall output)"
+
+            [ $mode = edges ] && [ $check = yes ] || continue
+            if [ $matrix = additive ] && ! bin/treecmp "$DIR/out" "$tree" > "$DIR/cmp"; then
+                echo "  the tree of $csv is not the one it was generated from ($(cat "$DIR/cmp") splits differ)" >&2
+                failed=1
+            fi
+            if [ "$n" -le "$CHECK_MAX" ]; then
+                bin/njref < "$csv" > "$DIR/ref" || exit 1
+                if ! bin/treecmp "$DIR/out" "$DIR/ref" > "$DIR/cmp"; then
+                    echo "  the tree of $csv differs from njref's ($(cat "$DIR/cmp") splits differ)" >&2
+                    failed=1
+                fi
+            fi
+        done
+    done
+done
+
+echo "results in $RESULTS"
+[ $failed = 0 ] || { echo "some checks failed" >&2; exit 1; }
@@ -0,0 +1,53 @@
+#!/bin/sh
+#
+# Put two result files of make bench side by side:
+#
+#     bench/compare.sh bench/results/<old>.jsonl bench/results/<new>.jsonl
+#
+# For every run in both files (the same taxa, matrix and mode), prints the
+# total wall time of each and the ratio new / old.  Ratios above 1 are
+# slowdowns.
+
+if [ $# -ne 2 ]; then
+    echo "usage: $0 <old results> <new results>" >&2
+    exit 2
+fi
+
+awk '
+function field(line, name,    rest) {
+    if (!match(line, "\"" name "\":(\"[^\"]*\"|[0-9.]+)"))
+        return ""
+    rest = substr(line, RSTART + length(name) + 3, RLENGTH - length(name) - 3)
+    gsub(/"/, "", rest)
+    return rest
+}
+function total(line,    sum, phase, rest) {
+    sum = 0
+    split("read search update output", phase, " ")
+    for (p = 1; p <= 4; p++) {
+        if (match(line, "\"" phase[p] "\":\\{\"wall\":[0-9.]+")) {
+            rest = substr(line, RSTART, RLENGTH)
+            sub(/.*:/, "", rest)
+            sum += rest
+        }
+    }
+    return sum
+}
+{
+    key = field($0, "taxa") " " field($0, "matrix") " " field($0, "mode")
+    if (FILENAME == ARGV[1]) {
+        old[key] = total($0)
+    }
+    else if (key in old) {
+        keys[++count] = key
+        new[key] = total($0)
+    }
+}
+END {
+    printf "%-7s %-9s %-5s %10s %10s %7s\n", "taxa", "matrix", "mode", "old", "new", "ratio"
+    for (k = 1; k <= count; k++) {
+        split(keys[k], part, " ")
+        ratio = old[keys[k]] > 0 ? sprintf("%.2f", new[keys[k]] / old[keys[k]]) : "-"
+        printf "%-7s %-9s %-5s %10.3f %10.3f %7s\n", part[1], part[2], part[3], old[keys[k]], new[keys[k]], ratio
+    }
+}' "$1" "$2"
@@ -0,0 +1,249 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * genmatrix: synthetic distance matrices for benchmarking philo.
+ *
+ *     genmatrix [-s <seed>] [-e <noise>] [-c <copies>] [-t <tree file>] <taxa>
+ *
+ * A random unrooted binary tree is grown by attaching the taxa one at a
+ * time, each to a random edge of the tree so far, which is split by a new
+ * internal node.  Every edge gets a length drawn uniformly from [0.05, 1),
+ * in whole units of 0.0001, so that the length of a path comes out the same
+ * whichever end it is summed from.  The distance between two taxa is the
+ * length of the path between them, so the matrix is additive, and neighbor
+ * joining recovers the tree exactly.
+ * With -e, every distance above the diagonal is multiplied by exp(noise * z)
+ * for a standard normal z, and mirrored below it, which makes it noisy.
+ * With -c, the tree has taxa / copies leaves instead, and each is written
+ * copies times, as taxa at distance 0 from one another with the same
+ * distances to all others: a matrix full of ties in Q, as inputs with
+ * identical sequences give.
+ *
+ * The matrix is written to the standard output in the CSV form philo reads,
+ * with the taxa named T0, T1, ... (T0.0, T0.1, ... with -c) and the
+ * distances to 4 decimals.  Each
+ * row is computed from the tree as it is written, and the noise of each
+ * pair is a hash of the seed and the pair, so only O(taxa) memory is used.
+ * With -t, the edges of the tree are written to the given file in the form
+ * of philo's edge output: the taxa are nodes 0 to taxa - 1 and the internal
+ * nodes follow.
+ */
+
+/* Edge lengths, in units of 1 / UNITS. */
+#define UNITS 10000
+#define MIN_LENGTH 500
+#define MAX_LENGTH 10000
+
+typedef struct edge {
+    int a;
+    int b;
+    long length;
+} EDGE;
+
+static uint64_t splitmix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/* Uniform in [0, 1), from 53 bits of x. */
+static double unit(uint64_t x) {
+    return (x >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t state;
+
+static double next_unit(void) {
+    state = splitmix64(state);
+    return unit(state);
+}
+
+static long next_length(void) {
+    return MIN_LENGTH + (long)((MAX_LENGTH - MIN_LENGTH) * next_unit());
+}
+
+/* Standard normal for the pair (i, j), i < j, by Box-Muller. */
+static double pair_normal(uint64_t seed, int i, int j) {
+    uint64_t h = splitmix64(seed ^ splitmix64(((uint64_t)i << 32) | (uint32_t)j));
+    double u1 = unit(h);
+    double u2 = unit(splitmix64(h));
+    return sqrt(-2.0 * log(1.0 - u1)) * cos(2.0 * M_PI * u2);
+}
+
+/* Write a distance given in units, with 4 decimals. */
+static void put_distance(uint64_t units, FILE *out) {
+    char text[32];
+    char *p = text + sizeof(text);
+    for (int d = 0; d < 4; d++) {
+        *--p = '0' + units % 10;
+        units /= 10;
+    }
+    *--p = '.';
+    do {
+        *--p = '0' + units % 10;
+        units /= 10;
+    } while (units > 0);
+    fwrite(p, 1, text + sizeof(text) - p, out);
+}
+
+static int usage(char *program) {
+    fprintf(stderr, "usage: %s [-s <seed>] [-e <noise>] [-c <copies>] [-t <tree file>] <taxa>\n", program);
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv) {
+    uint64_t seed = 1;
+    double noise = 0.0;
+    char *tree_file = NULL;
+    int copies = 1;
+    int taxa = 0;
+
+    for (int i = 1; i < argc; i++) {
+        char *arg = *(argv + i);
+        if (strcmp(arg, "-s") == 0 && i + 1 < argc)
+            seed = strtoull(*(argv + ++i), NULL, 10);
+        else if (strcmp(arg, "-e") == 0 && i + 1 < argc)
+            noise = atof(*(argv + ++i));
+        else if (strcmp(arg, "-c") == 0 && i + 1 < argc)
+            copies = atoi(*(argv + ++i));
+        else if (strcmp(arg, "-t") == 0 && i + 1 < argc)
+            tree_file = *(argv + ++i);
+        else if (taxa == 0 && *arg != '-')
+            taxa = atoi(arg);
+        else
+            return usage(*argv);
+    }
+    if (copies < 1 || taxa / copies < 3 || noise < 0.0)
+        return usage(*argv);
+    taxa /= copies;
+
+    // the tree: taxa 0, 1 and 2 around node taxa, then taxon k splits a random
+    // edge with the new internal node taxa + k - 2
+    int num_nodes = 2 * taxa - 2;
+    int num_edges = 2 * taxa - 3;
+    EDGE *edges = malloc(num_edges * sizeof(EDGE));
+    int *degree = calloc(num_nodes, sizeof(int));
+    int *adjacent = malloc(3 * num_nodes * sizeof(int));
+    long *lengths = malloc(3 * num_nodes * sizeof(long));
+    long *dist = malloc(num_nodes * sizeof(long));
+    int *stack = malloc(num_nodes * sizeof(int));
+    int *from = malloc(num_nodes * sizeof(int));
+    if (edges == NULL || degree == NULL || adjacent == NULL || lengths == NULL || dist == NULL
+        || stack == NULL || from == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    state = seed;
+    int count = 0;
+    for (int k = 0; k < 3; k++) {
+        (edges + count)->a = k;
+        (edges + count)->b = taxa;
+        (edges + count)->length = next_length();
+        count++;
+    }
+    for (int k = 3; k < taxa; k++) {
+        int inner = taxa + k - 2;
+        EDGE *split = edges + (int)(next_unit() * count);
+        int far = split->b;
+        split->b = inner;
+        split->length = next_length();
+        (edges + count)->a = inner;
+        (edges + count)->b = far;
+        (edges + count)->length = next_length();
+        count++;
+        (edges + count)->a = k;
+        (edges + count)->b = inner;
+        (edges + count)->length = next_length();
+        count++;
+    }
+
+    for (int e = 0; e < num_edges; e++) {
+        int a = (edges + e)->a;
+        int b = (edges + e)->b;
+        *(adjacent + 3 * a + *(degree + a)) = b;
+        *(lengths + 3 * a + *(degree + a)) = (edges + e)->length;
+        (*(degree + a))++;
+        *(adjacent + 3 * b + *(degree + b)) = a;
+        *(lengths + 3 * b + *(degree + b)) = (edges + e)->length;
+        (*(degree + b))++;
+    }
+
+    if (tree_file != NULL) {
+        FILE *tree = fopen(tree_file, "w");
+        if (tree == NULL) {
+            perror(tree_file);
+            return EXIT_FAILURE;
+        }
+        for (int e = 0; e < num_edges; e++)
+            fprintf(tree, "%d,%d,%.2f\n", (edges + e)->a, (edges + e)->b, (double)(edges + e)->length / UNITS);
+        fclose(tree);
+    }
+
+    FILE *out = stdout;
+    static char buffer[1 << 20];
+    setvbuf(out, buffer, _IOFBF, sizeof(buffer));
+    for (int i = 0; i < taxa; i++) {
+        for (int c = 0; c < copies; c++) {
+            if (copies > 1)
+                fprintf(out, ",T%d.%d", i, c);
+            else
+                fprintf(out, ",T%d", i);
+        }
+    }
+    fputc('\n', out);
+
+    for (int i = 0; i < taxa; i++) {
+        // distances from taxon i to every node, by a depth-first walk of the tree
+        int top = 0;
+        *(stack + top++) = i;
+        *(from + i) = -1;
+        *(dist + i) = 0;
+        while (top > 0) {
+            int node = *(stack + --top);
+            for (int a = 0; a < *(degree + node); a++) {
+                int next = *(adjacent + 3 * node + a);
+                if (next == *(from + node))
+                    continue;
+                *(from + next) = node;
+                *(dist + next) = *(dist + node) + *(lengths + 3 * node + a);
+                *(stack + top++) = next;
+            }
+        }
+
+        for (int c = 0; c < copies; c++) {
+            if (copies > 1)
+                fprintf(out, "T%d.%d", i, c);
+            else
+                fprintf(out, "T%d", i);
+            for (int j = 0; j < taxa; j++) {
+                uint64_t d = *(dist + j);
+                if (noise > 0.0 && j != i)
+                    d = (uint64_t)(d * exp(noise * (i < j ? pair_normal(seed, i, j) : pair_normal(seed, j, i))) + 0.5);
+                for (int k = 0; k < copies; k++) {
+                    fputc(',', out);
+                    put_distance(d, out);
+                }
+            }
+            fputc('\n', out);
+        }
+    }
+    if (fflush(out) || ferror(out)) {
+        fprintf(stderr, "cannot write the matrix\n");
+        return EXIT_FAILURE;
+    }
+
+    free(edges);
+    free(degree);
+    free(adjacent);
+    free(lengths);
+    free(dist);
+    free(stack);
+    free(from);
+    return EXIT_SUCCESS;
+}
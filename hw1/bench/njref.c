@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * njref: reference neighbor joining, for checking philo (make bench).
+ *
+ *     njref < matrix.csv > edges
+ *
+ * The textbook method on a full square matrix, with none of philo's
+ * machinery: at each step the row sums are recomputed from scratch, every
+ * Q value is computed, the first pair with the smallest one is joined, and
+ * the row of the new node replaces that of the first node of the pair
+ * while the row of the last active node moves into that of the second.
+ * It takes O(n^3) time and 8 * n^2 bytes, so it is only meant for inputs
+ * of a few thousand taxa.  The input is CSV as philo reads it (without
+ * comment lines), and the edges are written as philo writes them by
+ * default: the taxa are nodes 0 to n - 1, and the nodes made by the joins
+ * are numbered from n on, in order.
+ */
+
+/* Read a line of any length into *line, without its newline.  Returns its length, or -1 at the end. */
+static long read_line(FILE *in, char **line, size_t *size) {
+    long length = 0;
+    int c;
+    while ((c = getc(in)) != EOF && c != '\n') {
+        if ((size_t)length + 1 >= *size) {
+            *size = *size ? 2 * *size : 4096;
+            *line = realloc(*line, *size);
+            if (*line == NULL)
+                return -1;
+        }
+        *(*line + length++) = c;
+    }
+    if (c == EOF && length == 0)
+        return -1;
+    if (*line == NULL && (*line = malloc(*size = 1)) == NULL)
+        return -1;
+    *(*line + length) = '\0';
+    return length;
+}
+
+int main(void) {
+    char *line = NULL;
+    size_t size = 0;
+    if (read_line(stdin, &line, &size) < 0) {
+        fprintf(stderr, "empty input\n");
+        return EXIT_FAILURE;
+    }
+    int n = 0;
+    for (char *p = line; *p != '\0'; p++)
+        n += *p == ',';
+    if (n < 2) {
+        fprintf(stderr, "too few taxa\n");
+        return EXIT_FAILURE;
+    }
+
+    double *d = malloc((size_t)n * n * sizeof(double));
+    double *r = malloc(n * sizeof(double));
+    int *node = malloc(n * sizeof(int));
+    if (d == NULL || r == NULL || node == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < n; i++) {
+        if (read_line(stdin, &line, &size) < 0) {
+            fprintf(stderr, "premature end of input\n");
+            return EXIT_FAILURE;
+        }
+        char *p = strchr(line, ',');
+        for (int j = 0; j < n; j++) {
+            if (p == NULL) {
+                fprintf(stderr, "too few fields on row %d\n", i);
+                return EXIT_FAILURE;
+            }
+            *(d + (size_t)i * n + j) = strtod(p + 1, &p);
+        }
+        *(node + i) = i;
+    }
+
+    int m = n;
+    int next_node = n;
+    while (m > 2) {
+        for (int i = 0; i < m; i++) {
+            *(r + i) = 0.0;
+            for (int k = 0; k < m; k++)
+                *(r + i) += *(d + (size_t)i * n + k);
+        }
+
+        int bi = 0;
+        int bj = 1;
+        double best = 0.0;
+        for (int i = 0; i < m; i++) {
+            for (int j = i + 1; j < m; j++) {
+                double q = (m - 2) * *(d + (size_t)i * n + j) - *(r + i) - *(r + j);
+                if ((i == 0 && j == 1) || q < best) {
+                    best = q;
+                    bi = i;
+                    bj = j;
+                }
+            }
+        }
+
+        double dij = *(d + (size_t)bi * n + bj);
+        double to_i = dij / 2 + (*(r + bi) - *(r + bj)) / (2.0 * (m - 2));
+        double to_j = dij - to_i;
+        int u = next_node++;
+        printf("%d,%d,%.2f\n", *(node + bi), u, to_i);
+        printf("%d,%d,%.2f\n", *(node + bj), u, to_j);
+
+        for (int k = 0; k < m; k++) {
+            double to_u = (*(d + (size_t)bi * n + k) + *(d + (size_t)bj * n + k) - dij) / 2;
+            *(d + (size_t)bi * n + k) = to_u;
+            *(d + (size_t)k * n + bi) = to_u;
+        }
+        *(d + (size_t)bi * n + bi) = 0.0;
+        *(node + bi) = u;
+
+        int last = m - 1;
+        if (bj != last) {
+            for (int k = 0; k < m; k++) {
+                *(d + (size_t)bj * n + k) = *(d + (size_t)last * n + k);
+                *(d + (size_t)k * n + bj) = *(d + (size_t)k * n + last);
+            }
+            *(d + (size_t)bj * n + bj) = 0.0;
+            *(node + bj) = *(node + last);
+        }
+        m--;
+    }
+    printf("%d,%d,%.2f\n", *node, *(node + 1), *(d + 1));
+
+    free(d);
+    free(r);
+    free(node);
+    free(line);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,201 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * treecmp: compare the topologies of two trees (make bench).
+ *
+ *     treecmp <edges> <edges>
+ *
+ * Each tree is given as edges in the form of philo's default output, one
+ * "a,b,length" line per edge, with the taxa numbered from 0 and the
+ * internal nodes after them (lines starting with '#' are skipped).  Every
+ * edge splits the taxa in two; the trees have the same topology if they
+ * make the same splits.  The number of splits that are in only one of the
+ * trees (the Robinson-Foulds distance) is printed, and the exit status is
+ * 0 if it is 0 and 1 otherwise.  Edge lengths are not compared.
+ */
+
+typedef struct tree {
+    int num_nodes;
+    int num_taxa;
+    int *degree;
+    int *adjacent;              /* 3 per node */
+    uint64_t *splits;           /* words per split, one split per edge */
+    int num_splits;
+} TREE;
+
+static int words;               /* per split */
+
+static int read_tree(const char *path, TREE *tree) {
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    int capacity = 1024;
+    int count = 0;
+    int *ends = malloc(2 * capacity * sizeof(int));
+    char line[256];
+    tree->num_nodes = 0;
+    while (ends != NULL && fgets(line, sizeof(line), in) != NULL) {
+        int a;
+        int b;
+        if (*line == '#' || sscanf(line, "%d,%d", &a, &b) != 2)
+            continue;
+        if (a < 0 || b < 0) {
+            fprintf(stderr, "%s: bad edge %s", path, line);
+            fclose(in);
+            return -1;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            ends = realloc(ends, 2 * capacity * sizeof(int));
+            if (ends == NULL)
+                break;
+        }
+        *(ends + 2 * count) = a;
+        *(ends + 2 * count + 1) = b;
+        count++;
+        if (a >= tree->num_nodes)
+            tree->num_nodes = a + 1;
+        if (b >= tree->num_nodes)
+            tree->num_nodes = b + 1;
+    }
+    fclose(in);
+    if (ends == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+
+    tree->degree = calloc(tree->num_nodes, sizeof(int));
+    tree->adjacent = malloc(3 * tree->num_nodes * sizeof(int));
+    if (tree->degree == NULL || tree->adjacent == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+    for (int e = 0; e < count; e++) {
+        int a = *(ends + 2 * e);
+        int b = *(ends + 2 * e + 1);
+        if (*(tree->degree + a) == 3 || *(tree->degree + b) == 3) {
+            fprintf(stderr, "%s: a node has more than three edges\n", path);
+            return -1;
+        }
+        *(tree->adjacent + 3 * a + (*(tree->degree + a))++) = b;
+        *(tree->adjacent + 3 * b + (*(tree->degree + b))++) = a;
+    }
+    free(ends);
+
+    tree->num_taxa = 0;
+    for (int k = 0; k < tree->num_nodes; k++)
+        tree->num_taxa += *(tree->degree + k) == 1;
+    for (int k = 0; k < tree->num_taxa; k++) {
+        if (*(tree->degree + k) != 1) {
+            fprintf(stderr, "%s: the taxa are not the first nodes\n", path);
+            return -1;
+        }
+    }
+    tree->num_splits = count;
+    return 0;
+}
+
+/*
+ * Find the split of every edge, as the set of taxa on the side away from
+ * taxon 0: the tree is walked from taxon 0, and the set below each node is
+ * the union of those below its children, gathered in reverse walk order.
+ */
+static int find_splits(TREE *tree) {
+    int n = tree->num_nodes;
+    uint64_t *below = calloc((size_t)n * words, sizeof(uint64_t));
+    int *order = malloc(n * sizeof(int));
+    int *parent = malloc(n * sizeof(int));
+    tree->splits = malloc((size_t)tree->num_splits * words * sizeof(uint64_t));
+    if (below == NULL || order == NULL || parent == NULL || tree->splits == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+
+    int length = 0;
+    *(order + length++) = 0;
+    *parent = -1;
+    for (int k = 0; k < length; k++) {
+        int node = *(order + k);
+        for (int a = 0; a < *(tree->degree + node); a++) {
+            int next = *(tree->adjacent + 3 * node + a);
+            if (next == *(parent + node))
+                continue;
+            *(parent + next) = node;
+            *(order + length++) = next;
+        }
+    }
+    if (length != n) {
+        fprintf(stderr, "the tree is not connected\n");
+        return -1;
+    }
+
+    int count = 0;
+    for (int k = n - 1; k > 0; k--) {
+        int node = *(order + k);
+        uint64_t *set = below + (size_t)node * words;
+        if (node < tree->num_taxa)
+            *(set + node / 64) |= (uint64_t)1 << (node % 64);
+        uint64_t *up = below + (size_t)*(parent + node) * words;
+        for (int w = 0; w < words; w++)
+            *(up + w) |= *(set + w);
+        memcpy(tree->splits + (size_t)count * words, set, words * sizeof(uint64_t));
+        count++;
+    }
+    tree->num_splits = count;
+
+    free(below);
+    free(order);
+    free(parent);
+    return 0;
+}
+
+static int compare_splits(const void *a, const void *b) {
+    return memcmp(a, b, words * sizeof(uint64_t));
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <edges> <edges>\n", *argv);
+        return 2;
+    }
+
+    TREE first;
+    TREE second;
+    if (read_tree(*(argv + 1), &first) || read_tree(*(argv + 2), &second))
+        return 2;
+    if (first.num_taxa != second.num_taxa) {
+        printf("the trees have %d and %d taxa\n", first.num_taxa, second.num_taxa);
+        return 1;
+    }
+
+    words = (first.num_taxa + 63) / 64;
+    if (find_splits(&first) || find_splits(&second))
+        return 2;
+    qsort(first.splits, first.num_splits, words * sizeof(uint64_t), compare_splits);
+    qsort(second.splits, second.num_splits, words * sizeof(uint64_t), compare_splits);
+
+    int common = 0;
+    int i = 0;
+    int j = 0;
+    while (i < first.num_splits && j < second.num_splits) {
+        int c = compare_splits(first.splits + (size_t)i * words, second.splits + (size_t)j * words);
+        if (c == 0) {
+            common++;
+            i++;
+            j++;
+        }
+        else if (c < 0)
+            i++;
+        else
+            j++;
+    }
+    int distance = first.num_splits + second.num_splits - 2 * common;
+    printf("%d\n", distance);
+    return distance == 0 ? 0 : 1;
+}
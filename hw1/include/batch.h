@@ -0,0 +1,25 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+
+/*
+ * Batch mode: build the trees for many matrices in one process.
+ *
+ * The matrices are either the files named in a manifest, one path per
+ * line (-b), or a sequence of CSV matrices one after the other in the
+ * input stream (-s), where each matrix ends after as many rows as its
+ * first line has names.  Up to num_threads matrices are processed at once,
+ * by worker threads that each have a context of their own (see philo.h),
+ * and with one thread for each search.  Each result is collected in memory, and the
+ * results are written to out in input order, each preceded by a line
+ * "# <name>", where the name is the path from the manifest or "matrix <k>"
+ * for the k-th matrix of the stream.  Errors are reported on stderr, each
+ * line prefixed with the name of the matrix, in input order too; a matrix
+ * that fails does not stop the others.
+ *
+ * Returns 0 if every matrix was processed, -1 otherwise.
+ */
+int run_batch(const char *manifest, FILE *in, FILE *out);
+
+#endif
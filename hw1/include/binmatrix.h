@@ -0,0 +1,69 @@
+#ifndef BINMATRIX_H
+#define BINMATRIX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Binary form of the distance data, which read_distance_data() accepts in
+ * place of CSV and -c writes.  A file consists of
+ *   - a 64-byte header (BIN_HEADER below), in the byte order of the
+ *     machine that wrote it;
+ *   - the name table: the taxon names, each followed by a null character;
+ *   - padding up to a multiple of 64 bytes from the start of the header;
+ *   - the matrix, as the packed lower triangle with the diagonal used for
+ *     the distances matrix in memory (see tri_entry() in context.h), with
+ *     entries that are floats or doubles as given by the precision field.
+ * Since the matrix is laid out exactly as in memory, a file of the
+ * precision in use can be mapped and its matrix used where it lies.
+ */
+
+/* First bytes of a binary file.  No CSV input can start with 0x89. */
+#define BIN_MAGIC "\211PHILO\n\032"
+#define BIN_MAGIC_LENGTH 8
+#define BIN_VERSION 1
+#define BIN_BYTE_ORDER 0x01020304u
+#define BIN_ALIGN 64
+
+typedef struct bin_header {
+    char magic[BIN_MAGIC_LENGTH];
+    uint32_t version;
+    uint32_t byte_order;        /* BIN_BYTE_ORDER, as written by the producer */
+    uint32_t count;             /* number of taxa */
+    uint32_t precision;         /* bytes per matrix entry: 4 (float) or 8 (double) */
+    uint64_t names_offset;      /* offsets are from the start of the header */
+    uint64_t names_length;
+    uint64_t matrix_offset;     /* a multiple of BIN_ALIGN */
+    uint64_t matrix_length;
+    char reserved[8];
+} BIN_HEADER;
+
+/* Where the parts of a binary image are, once it has been checked. */
+typedef struct bin_matrix {
+    int count;
+    int precision;
+    const char *names;          /* count null-terminated names, one after the other */
+    const void *matrix;
+} BIN_MATRIX;
+
+/* Whether the given bytes (at least BIN_MAGIC_LENGTH of them) start a binary file. */
+int bin_is_matrix(const char *data, size_t size);
+
+/*
+ * Check the header and name table of a binary image of the given size and
+ * fill in *matrix.  Names must have between 1 and max_name characters.
+ * The matrix entries themselves are not looked at.  Returns NULL, or a
+ * message saying what is wrong with the image.
+ */
+const char *bin_parse(const char *data, size_t size, int max_name, BIN_MATRIX *matrix);
+
+/*
+ * Write a binary file with count taxa, whose names are the first count
+ * strings of names, and the given packed matrix of
+ * floats (precision 4) or doubles (precision 8).  Returns the number of
+ * bytes written, or -1 if the output could not be written.
+ */
+long bin_write(FILE *out, int count, char *const *names, const void *matrix, int precision);
+
+#endif
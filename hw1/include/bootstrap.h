@@ -0,0 +1,41 @@
+#ifndef BOOTSTRAP_H
+#define BOOTSTRAP_H
+
+#include <stdio.h>
+
+#include "philo.h"
+
+/*
+ * Bootstrap support for the edges of a tree (--bootstrap).
+ *
+ * The tree of the input matrix is built as for -n.  Then the given number
+ * of replicate matrices are generated in memory, each from the input by
+ * multiplying every distance by a log-normal factor (the input holds only
+ * distances, so there are no characters to resample), and a tree is built
+ * for each.  Each edge of a tree splits the taxa in two; the support of an
+ * edge of the tree of the input is the percentage of replicate trees that
+ * have the same split.  Edges to leaves split off a single taxon, which
+ * every tree does, so theirs is always 100.
+ *
+ * The replicates are shared out among num_threads worker threads, which
+ * each build their trees in a context of their own (see philo.h), reused
+ * from one replicate to the next, with one thread for each search.
+ * Replicate k is generated from a fixed seed and k alone, so the result
+ * does not depend on the number of threads.  The tree of the input is
+ * then written to out in Newick format, with the support of the edge that
+ * follows each internal node in place of its name.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int run_bootstrap(int replicates, FILE *in, FILE *out);
+
+/*
+ * Number of splits of the taxa that are made by an edge of only one of the
+ * trees of two contexts, over the same taxa (the Robinson-Foulds distance),
+ * leaving out the trivial splits of the edges to leaves.  Each tree must
+ * have its nodes numbered as build_taxonomy() numbers them, the children
+ * of a node before it.  Returns -1 if out of memory.
+ */
+int split_distance(PHILO_CONTEXT *first, PHILO_CONTEXT *second);
+
+#endif
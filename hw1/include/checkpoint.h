@@ -0,0 +1,75 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+
+/*
+ * Checkpoints of a build (--checkpoint, --resume).
+ *
+ * With a checkpoint_file set (see context.h), build_taxonomy() writes the
+ * state of the build to it after a join, once checkpoint_interval seconds
+ * have passed since the build started or the last checkpoint was written
+ * (with -x, only at the end of a pass, so that the pairs still to be
+ * joined need not be kept).  That state is all the build goes on from, so
+ * a build resumed from it makes the same joins with the same numbers, as
+ * the searches do not depend on anything else (see qsearch.h; the sorted
+ * rows of -r are made again from the matrix).  A file consists of
+ *   - a 64-byte header (CKPT_HEADER below), in the byte order of the
+ *     machine that wrote it;
+ *   - the taxon names, each followed by a null character;
+ *   - active_node_map and row_sums, for the active positions (the scale
+ *     of row_sums is in the header);
+ *   - the two children of each internal node made so far, as ints, in the
+ *     order of the nodes, and the edge lengths of all the nodes so far;
+ *   - the active part of the distances matrix, packed, in the precision of
+ *     the build;
+ *   - with -m, the node distances between the nodes so far, packed.
+ * The header holds the options the state depends on, which a resumed build
+ * must have as well.
+ */
+
+/* First bytes of a checkpoint file. */
+#define CKPT_MAGIC "\211PHICKP\n"
+#define CKPT_MAGIC_LENGTH 8
+#define CKPT_VERSION 1
+
+typedef struct ckpt_header {
+    char magic[CKPT_MAGIC_LENGTH];
+    uint32_t version;
+    uint32_t byte_order;        /* BIN_BYTE_ORDER (see binmatrix.h), as written */
+    uint32_t options;           /* the MATRIX, RELAXED and FLOAT32 options of the build */
+    uint32_t taxa;
+    uint32_t all_nodes;         /* num_all_nodes */
+    uint32_t active_nodes;      /* num_active_nodes */
+    int32_t outlier;            /* the default outlier */
+    int32_t passes;
+    uint64_t names_length;
+    double row_sums_scale;      /* 0 in files written before it was kept */
+    char reserved[8];
+} CKPT_HEADER;
+
+/* Options of a build that its checkpoint depends on. */
+#define CKPT_OPTIONS (MATRIX_OPTION | RELAXED_OPTION | FLOAT32_OPTION)
+
+/* Monotonic time in seconds, to time the checkpoints with. */
+double checkpoint_clock(void);
+
+/*
+ * Write the state of the build of the current context to checkpoint_file.
+ * It is written to a file of that name with ".tmp" appended, which is
+ * flushed to disk and then renamed, so the checkpoint file is always a
+ * complete one.  Returns 0 if successful, -1 otherwise, with a message on
+ * the message stream of the context.
+ */
+int write_checkpoint(void);
+
+/*
+ * Restore the state of a build from checkpoint_file into the current
+ * context, which philo_reset() has cleared, in place of reading the input.
+ * build_taxonomy() then carries on with it.  Returns 0 if successful, 1 if
+ * there is no checkpoint file, and -1, with a message on the message
+ * stream, otherwise.
+ */
+int read_checkpoint(void);
+
+#endif
@@ -0,0 +1,318 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "global.h"
+#include "philo.h"
+#include "options.h"
+#include "stats.h"
+
+/*
+ * Internals of the library: the state of a run (see philo.h).
+ *
+ * Everything a run of the program works on, reading a matrix, building its
+ * tree and emitting it, is kept in the context current_context points to.
+ * The code of the library reaches it through a local pointer, ctx, taken
+ * from current_context at the start of each function, as in
+ * ctx->num_taxa; the variables of global.h other than the options are not
+ * used.  current_context is thread-local: each thread works on its own
+ * context, which is how several trees are built at once (see philo.h and
+ * batch.h).  It starts out pointing at a default context on every thread,
+ * whose options validargs() sets, so that the functions of global.h do
+ * what the command line asks; helper threads started for a run (to search
+ * or to read) point it at the context of that run.
+ */
+struct philo_context {
+    /*
+     * Options of the runs (see philo_set_options()): the options bits, the
+     * name of the leaf to use as the outlier for Newick output, or NULL, and
+     * the number of threads for reading the input, searching the Q matrix
+     * and formatting the matrix of -m, at least 1.
+     */
+    int num_threads;
+    long global_options;
+    char *outlier_name;
+
+    /*
+     * Path at which to keep the distance matrix in a file instead of on the
+     * heap, otherwise NULL.  See grow_distance_matrix().
+     */
+    char *matrix_file;
+
+    /*
+     * Path of the checkpoint file of the build, otherwise NULL, and the
+     * number of seconds between checkpoints.  See checkpoint.h.
+     */
+    char *checkpoint_file;
+    int checkpoint_interval;
+
+    /* Number of taxa in the input. */
+    int num_taxa;
+
+    /*
+     * Number of node slots currently allocated in the tables below.
+     * There is no compile-time limit on the number of taxa: the tables are
+     * allocated on the heap and grown as the input is read.  The algorithm
+     * runs for num_taxa - 2 iterations and creates one internal node at each
+     * iteration, so once the number N of taxa is known the tables are sized
+     * to hold 2 * N - 2 nodes (leaf + internal).
+     */
+    int node_capacity;
+
+    /* Current number of nodes (leaf + internal). */
+    int num_all_nodes;
+
+    /*
+     * Names associated with nodes (node_capacity entries): the taxa names as
+     * read, and "#<number>" for the internal nodes, as C strings.  The strings
+     * are kept in an arena that is never moved, one after the other, so they
+     * take only their own length (see add_name() in philo.c), and the taxa are
+     * found by name through a hash index, which also keeps their names distinct.
+     */
+    char **node_names;
+
+    /*
+     * Distances between the active nodes, indexed by their positions in
+     * active_node_map: *tri_entry(distances, p, q) is the distance between
+     * nodes active_node_map[p] and active_node_map[q].  This is a packed
+     * num_taxa x num_taxa matrix.  It starts out as the input matrix.  When two
+     * nodes are joined, the row (and column) of the first is overwritten with
+     * the distances to the new node, and the row at the last active position
+     * moves to that of the second, so the active part stays at the start.
+     */
+    double *distances;
+
+    /*
+     * With --float32 the same matrix is kept in single precision here instead,
+     * and distances is NULL.  Computations are still done in double precision:
+     * get_distance() widens an entry and set_distance() rounds a value to the
+     * precision of the matrix, returning the value actually stored.
+     */
+    float *float_distances;
+
+    /*
+     * Row sums of the distances matrix, taken over the active nodes only and
+     * indexed by position like its rows.  Computed once when build_taxonomy
+     * starts and then updated in O(n) as each pair of nodes is joined.
+     */
+    double *row_sums;
+
+    /*
+     * Largest magnitude a row sum has had since the sums were last added up
+     * afresh, which bounds how far the patched ones can be off (see
+     * tie_tolerance() in qsearch.c).
+     */
+    double row_sums_scale;
+
+    /*
+     * Estimated distances between all nodes (leaf + internal), indexed by node,
+     * as a packed matrix.  Only kept when the matrix is to be output (-m);
+     * otherwise NULL.
+     */
+    double *node_distances;
+
+    /*
+     * Length of the edge from each node to the node pointed at by its
+     * neighbors[0] entry (node_capacity entries).
+     */
+    double *edge_lengths;
+
+    /* Current number of nodes that have not yet been joined. */
+    int num_active_nodes;
+
+    /*
+     * Table mapping indices of active nodes (in [0, num_active_nodes))
+     * to indices of all nodes (in [0, num_all_nodes)).
+     * When two nodes are joined, the new node takes the position of the first
+     * and the node at the last position moves to that of the second, in step
+     * with the rows of the distances matrix.  It has one entry more than
+     * node_capacity, to hold the -2 sentinel that ends the active list.
+     */
+    int *active_node_map;
+
+    /*
+     * Support of the edge from each node to the node pointed at by its
+     * neighbors[0] entry, in percent of the bootstrap replicates whose trees
+     * have the same split of the taxa, or NULL.  When it is set,
+     * emit_newick_format() labels internal nodes with it instead of their
+     * names (see bootstrap.h).
+     */
+    int *node_support;
+
+    /*
+     * Storage for the NODE structures of the tree (node_capacity entries; see
+     * global.h).  The "name" of a node points to its entry of node_names.
+     */
+    NODE *nodes;
+
+    FILE *messages;                     /* where errors are reported, stderr if NULL */
+
+    /*
+     * Number of rows (and columns) currently allocated in the distance matrix.
+     * The matrix only holds the active nodes, so it needs one row per taxon,
+     * not one per node.
+     */
+    int matrix_capacity;
+
+    /*
+     * Mapping of a binary input whose matrix is used in place (see
+     * read_binary_data()), of the matrix file or of huge pages (see
+     * grow_distance_matrix()), or NULL if the matrix is on the heap.
+     */
+    char *matrix_mapping;
+    size_t matrix_mapping_length;
+
+    /*
+     * How the distance matrix is kept (one of the ALLOC_ modes below), and
+     * the number of NUMA nodes its rows were placed on.
+     */
+    int matrix_alloc;
+    int matrix_nodes;
+
+    /*
+     * Leaf used as the outlier for Newick output when none is named: the first
+     * leaf of the first pair of leaves at the greatest distance.  Found by
+     * find_default_outlier() before build_taxonomy overwrites the input distances.
+     */
+    int default_outlier;
+
+    struct qsearch_state *search;       /* of the build, between qsearch_init() and qsearch_fini() */
+
+    /* Number of passes over the matrix that build_taxonomy() made to choose the pairs to join. */
+    int num_passes;
+
+    RUN_STATS stats;
+
+    /*
+     * The arena of the node names (see add_name() in philo.c): the block
+     * being filled, which links to those filled before it, and the number of
+     * bytes of it in use.
+     */
+    struct name_block *name_blocks;
+    size_t name_block_used;
+
+    /*
+     * Hash index of the taxa by name (see index_names() in philo.c): open
+     * addressing, with the number of a taxon, or -1, in each of
+     * name_index_mask + 1 slots.
+     */
+    int *name_index;
+    int name_index_mask;
+};
+
+extern __thread PHILO_CONTEXT *current_context;
+
+/*
+ * Distance matrices are symmetric, so only their lower triangle (with the
+ * diagonal) is stored, packed row after row: row i holds entries (i, 0)
+ * through (i, i), starting at offset i * (i + 1) / 2.  The layout does not
+ * depend on the size of the matrix, so a matrix can be grown in place.
+ * tri_index() gives the offset of entry (i, j) for either order of i and j,
+ * tri_entry() a pointer to that entry in a matrix of doubles, and tri_row()
+ * a pointer to the start of row i.
+ */
+static inline size_t tri_index(int i, int j) {
+    return i >= j ? (size_t)i * (i + 1) / 2 + j : (size_t)j * (j + 1) / 2 + i;
+}
+
+static inline double *tri_row(double *matrix, int i) {
+    return matrix + tri_index(i, 0);
+}
+
+static inline double *tri_entry(double *matrix, int i, int j) {
+    return matrix + tri_index(i, j);
+}
+
+/* Number of entries in a packed matrix with the given number of rows. */
+#define TRI_SIZE(n) ((size_t)(n) * ((n) + 1) / 2)
+
+/*
+ * How the distance matrix of the run is kept, which --stats reports: on the
+ * heap, in the mapping of a binary input used in place, in the matrix
+ * file, or, with --huge-pages, in a mapping of explicit huge pages, of
+ * transparent huge pages, or of plain pages if neither could be had (see
+ * grow_distance_matrix()).  With --huge-pages, the rows of the matrix are
+ * also placed on the NUMA nodes of the search threads that scan them at
+ * the start of the build, and matrix_nodes is the number of nodes they
+ * were placed on (see placement.h); otherwise it is 1.
+ */
+#define ALLOC_HEAP    0
+#define ALLOC_INPUT   1
+#define ALLOC_FILE    2
+#define ALLOC_HUGETLB 3
+#define ALLOC_THP     4
+#define ALLOC_PAGES   5
+#define ALLOC_NAMES { "heap", "input", "file", "hugetlb", "thp", "pages" }
+
+/* Entry (p, q) of the distance matrix of the current context, in either precision. */
+static inline double get_distance(int p, int q) {
+    PHILO_CONTEXT *ctx = current_context;
+    if (ctx->float_distances != NULL)
+        return *(ctx->float_distances + tri_index(p, q));
+    return *(ctx->distances + tri_index(p, q));
+}
+
+static inline double set_distance(int p, int q, double dist) {
+    PHILO_CONTEXT *ctx = current_context;
+    if (ctx->float_distances != NULL)
+        return *(ctx->float_distances + tri_index(p, q)) = (float)dist;
+    return *(ctx->distances + tri_index(p, q)) = dist;
+}
+
+/*
+ * Stream to which the errors of the run of the current context are
+ * reported: its messages stream, or stderr if none was set.  See philo.c.
+ */
+extern FILE *message_stream(void);
+
+/*
+ * Functions that (re)size the node tables and the distance matrix so that
+ * they can hold at least the specified number of nodes.  Existing contents
+ * are preserved and new entries are zero-filled.  See philo.c.
+ */
+extern int grow_node_tables(int capacity);
+extern int grow_distance_matrix(int capacity);
+
+/*
+ * Add up the row sums of all active positions afresh, and those of the
+ * two positions given, without storing them, in the same order.  See
+ * philo.c.
+ */
+extern void init_row_sums(void);
+extern void exact_row_sums(int pos_i, int pos_j, double *sum_i, double *sum_j);
+
+/*
+ * Make the first count nodes the leaves of a new tree, once their names and
+ * the distances between them have been stored.  See philo.c.
+ */
+extern void init_leaves(int count);
+
+/*
+ * Find the leaf that is the outlier of the Newick output when none is
+ * named, from the input distances, as build_taxonomy() does before it
+ * overwrites them.  For trees made some other way (see insert.h).
+ */
+extern void find_default_outlier(void);
+
+/*
+ * Give the internal nodes of the tree of the num_taxa taxa, which are
+ * numbered from num_taxa on, their names.  build_taxonomy() does this
+ * itself.  Returns -1 if out of memory.  See philo.c.
+ */
+extern int name_internal_nodes(void);
+
+/*
+ * Give the first count nodes, the taxa, the count names that follow one
+ * another in names, each ending with a null character, once the node
+ * tables have been sized.  Returns -1 if out of memory, otherwise the first
+ * taxon whose name is that of an earlier one, or count if there is none.
+ * See philo.c.
+ */
+extern int set_taxon_names(const char *names, int count);
+
+/* Write the matrix read, in binary form (-c).  See philo.c. */
+extern int emit_binary_matrix(FILE *out);
+
+#endif
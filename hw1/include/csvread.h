@@ -0,0 +1,92 @@
+#ifndef CSVREAD_H
+#define CSVREAD_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Line-oriented reading of the CSV input of read_distance_data().
+ *
+ * If the input stream is a regular file, the rest of it is mapped into
+ * memory and lines are returned in place.  Otherwise it is read in large
+ * blocks into a buffer that grows to hold the longest line.  Either way,
+ * line ends are found with memchr() instead of character by character.
+ * A line is returned without its newline (or a carriage return before it);
+ * it is not null-terminated.
+ */
+typedef struct csv_reader {
+    FILE *in;
+    char *data;                 /* mapped file or read buffer */
+    size_t size;                /* number of valid bytes in data */
+    size_t pos;                 /* start of the next line in data */
+    size_t capacity;            /* size of the read buffer, 0 if mapped */
+    size_t map_length;          /* length of the mapping, 0 if not mapped */
+    int at_eof;                 /* the stream has been read to the end */
+    long line;                  /* number of the line last returned, from 1 */
+} CSV_READER;
+
+/* Set up a reader for a stream, from its current position.  Returns 0 or -1. */
+int csv_open(CSV_READER *reader, FILE *in);
+
+/*
+ * Get the next line.  Returns 1 and sets *line and *length if there is one,
+ * 0 at the end of the input and -1 if the input could not be read.
+ */
+int csv_next_line(CSV_READER *reader, char **line, size_t *length);
+
+void csv_close(CSV_READER *reader);
+
+/*
+ * Make sure that at least the given number of bytes from the current
+ * position are in memory, reading more of a stream that is not mapped, and
+ * return how many are (fewer only at the end of the input).  Returns
+ * (size_t)-1 if the input could not be read.  Used to look at the start of
+ * the input, and to read a whole binary input (see binmatrix.h).
+ */
+size_t csv_fill(CSV_READER *reader, size_t wanted);
+
+/*
+ * Take over the mapping of a mapped input, made writable.  Changes stay
+ * private to the process.  Returns the start of the mapping and sets
+ * *length, or returns NULL if the input is not mapped.  Afterwards
+ * csv_close() leaves the mapping alone, and it is the caller's to unmap.
+ */
+char *csv_detach_mapping(CSV_READER *reader, size_t *length);
+
+/*
+ * Parse a field of the given length as a decimal number: an optional sign,
+ * digits with an optional decimal point, and an optional exponent.
+ * Numbers with at most 15 significant digits and a small enough exponent
+ * are converted exactly with one multiplication or division by a power of
+ * ten; anything else is handed to strtod().  Either way the result is the
+ * correctly rounded double.  Returns 0, or -1 if the field is not a finite
+ * number in that format.
+ */
+int csv_parse_double(const char *field, size_t length, double *value);
+
+/*
+ * Read the count rows of the distance matrix that follow the header line,
+ * splitting them among up to the given number of threads.  This is only
+ * possible when the input is mapped.  The mapped rows are cut into chunks
+ * at line boundaries; the threads first count the data lines in their
+ * chunks, to find the index of each chunk's first row, and then parse
+ * their rows.  Each row r stores its entries (r, c), c <= r, which are its
+ * own packed row, so the threads never write to the same place.  The
+ * diagonal is checked as the rows are parsed.  Symmetry is checked with
+ * two order-independent 64-bit fingerprints, one over the entries above
+ * the diagonal and one over those below it, keyed by the unordered pair
+ * of indices; they can only agree for an asymmetric matrix by an
+ * accidental collision of the hash.
+ *
+ * If always is nonzero, the rows are read this way whenever the input is
+ * mapped, even on one thread and however small it is, for the order in
+ * which the matrix is written.
+ *
+ * Returns 0 if the matrix was read, -1 if the input is not mapped or is
+ * too small to be worth splitting, and 1 if anything is wrong with the
+ * rows.  Nothing is printed: on anything but 0, the caller reads the rows
+ * again serially, which also reports the first error the same way.
+ */
+int csv_read_rows_parallel(CSV_READER *reader, int count, int threads, int always);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef INSERT_H
+#define INSERT_H
+
+#include <stdio.h>
+
+/*
+ * Incremental insertion of taxa into a tree built before (--insert).
+ *
+ * The tree is given as the edges philo wrote for it, in a file, and the
+ * matrix on in holds the distances between its taxa, in the same order,
+ * followed by the rows of the new taxa, which are placed in the tree one
+ * after the other.  To place a taxon, the leaf nearest to it is found,
+ * and the part of the tree within INSERT_RADIUS edges of that leaf is
+ * taken apart: the subtrees that hang off it become units, and neighbor
+ * joining is run again on the units and the new taxon alone.  The distance
+ * between two units is the length of the path between them in the tree,
+ * and that from the taxon to a unit is the mean of its distances to the
+ * leaves of the unit, less their depths in it.  The tree of the join
+ * replaces that part of the tree.  A taxon is placed in O(n) time, rather
+ * than the O(n^3) of building the tree again.  The length of the last edge
+ * of the file, which build_taxonomy() works out in a way of its own, is
+ * estimated again from the matrix first.
+ *
+ * The tree is written to out as the edges or in Newick form (-n), with the
+ * taxa numbered as in the matrix and the internal nodes after them, the
+ * children of a node before it, so the output can be given to --insert in
+ * turn.  With --rebuild-check, the tree is also built again from scratch
+ * (with -r or -x if given), and the number of splits of the taxa in which
+ * the two trees differ is reported on stderr.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int run_insert(const char *tree_file, FILE *in, FILE *out);
+
+#endif
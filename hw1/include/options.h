@@ -0,0 +1,205 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "global.h"
+#include "philo.h"
+
+/*
+ * Command-line options of the program beyond those of global.h.  validargs()
+ * sets the variables below along with global_options and outlier_name, and
+ * main() hands them to the library (see philo.h).  They are defined in
+ * validargs.c, so that the library, which is built without it, does not
+ * bring them into the programs that use it.
+ */
+
+/*
+ * The help message of the program, with all its options, printed by main()
+ * in place of the USAGE of global.h, which only has those of the handout.
+ */
+#define PROGRAM_USAGE(program_name, retcode) do { \
+fprintf(stderr, "USAGE: %s %s\n", program_name, \
+"[-h] [-m|-n|-c] [-o <name>] [--binary] [-r|-x] [-j <threads>] [--float32]\n" \
+"       [-b <list>|-s] [--bootstrap <n>] [--matrix-file <file>] [-v|--stats]\n" \
+"       [--insert <edges> [--rebuild-check]]\n" \
+"       [--checkpoint <file> [--checkpoint-interval <seconds>] [--resume]] [--huge-pages]\n" \
+"   -h         Help: displays this help menu.\n" \
+"   -m         Output matrix of estimated distances, instead of edge data.\n" \
+"   -n         Output tree in Newick format, instead of edge data.\n" \
+"   -c         Convert the input to binary form, instead of building a tree.  The\n" \
+"              output can be read back in place of the CSV, without parsing.\n" \
+"   -o <name>  Use <name> as the name of the outlier node to use for Newick output\n" \
+"              (only permitted if -n has already appeared).\n" \
+"   --binary   Output the matrix of -m in binary form, like -c, instead of CSV\n" \
+"              (only permitted with -m).\n" \
+"   -r         Rapid search: bound the search for the pair to join using sorted rows\n" \
+"              (RapidNJ).  The tree is identical to the one found without -r.\n" \
+"   -x         Relaxed joining: join every pair of nodes that are each other's best\n" \
+"              partner at each pass over the matrix.  Much faster on large inputs,\n" \
+"              but the tree can differ from the one found without -x.  The number\n" \
+"              of passes is reported on stderr.\n" \
+"   -j <n>     Read the input, search for the pair to join and format the matrix of\n" \
+"              -m using <n> threads.\n" \
+"              The tree does not depend on the number of threads.\n" \
+"   --float32  Keep the distance matrix in single precision, halving its memory.\n" \
+"              Row sums are still accumulated in double precision.  Input distances\n" \
+"              are rounded to about 7 significant digits, so edge lengths can differ\n" \
+"              from the default in that digit (rarely visible at two decimals), and\n" \
+"              pairs whose Q values are that close may be joined in another order.\n" \
+"   -b <list>  Batch mode: build a tree for each of the files named in <list>, one\n" \
+"              per line.\n" \
+"   -s         Batch mode on a stream: build a tree for each of the matrices that\n" \
+"              follow one another on the standard input.\n" \
+"   --bootstrap <n>  Label the internal nodes of the Newick tree with the support of\n" \
+"              their edges over <n> replicate matrices (only permitted with -n).\n" \
+"   --matrix-file <file>  Keep the distance matrix in <file>, which must not exist,\n" \
+"              instead of memory, for matrices larger than memory (not with -m, -r,\n" \
+"              batch mode or --bootstrap).\n" \
+"   -v, --stats  Report the time spent in each phase of the run and some counters\n" \
+"              on stderr, as one line of JSON (not with batch mode or --bootstrap).\n" \
+"   --insert <edges>  Insert taxa into the tree whose edges, as output by this program,\n" \
+"              are in the file <edges>, instead of building the tree from scratch\n" \
+"              (not with -m, -c, batch mode or --bootstrap).\n" \
+"   --rebuild-check  Also build the tree from scratch, and report on stderr how many\n" \
+"              of its splits differ from those of the tree with the inserted taxa\n" \
+"              (only permitted with --insert).\n" \
+"   --checkpoint <file>  Write the state of the build to <file> from time to time, so\n" \
+"              that it can be resumed (not with -c, batch mode, --bootstrap or --insert).\n" \
+"   --checkpoint-interval <seconds>  Time between checkpoints, 600 by default; with 0,\n" \
+"              one is written after every join (only permitted with --checkpoint).\n" \
+"   --resume   Continue the build from the checkpoint file, if there is one, instead\n" \
+"              of reading the input (only permitted with --checkpoint).\n" \
+"   --huge-pages  Keep the distance matrix in huge pages, explicit ones if enough are\n" \
+"              reserved and transparent ones otherwise.  With -j, on a machine with\n" \
+"              several NUMA nodes, the rows each search thread scans at the start of\n" \
+"              the build are put on its node, and the thread is kept there (not with\n" \
+"              --matrix-file).\n" \
+"\n" \
+"If -h is specified, then it must be the first option on the command line, and any\n"\
+"other options are ignored.\n" \
+"\n" \
+"If -h is not specified, then the program reads distance data from the standard input,\n" \
+"and synthesizes an unrooted tree using the neighbor joining method.  The default\n" \
+"behavior of the program is to output the edges in the synthesized tree to the standard output.\n" \
+"\n" \
+"If -m is specified, then the final matrix of estimated node distances is output to\n" \
+"to the standard output, instead of the edge data.\n" \
+"\n" \
+"If -n is specified, then a representation of the synthesized tree in Newick format is output\n" \
+"to the standard output, instead of the edge data.  The -o option, which is only permitted\n" \
+"after -n, is used to specify the name of an 'outlier' node to be used in constructing a rooted\n" \
+"tree for Newick output.\n" \
+"\n" \
+"If -c is specified, then the distance data is written to the standard output in a binary\n" \
+"form, in single precision with --float32 and in double precision otherwise.  Input in that\n" \
+"form is recognized by its first bytes; a file is mapped into memory and its matrix is used\n" \
+"in place.\n" \
+"\n" \
+"In batch mode (-b or -s, not with -c), the output for each matrix is that of a single run,\n" \
+"preceded by a line '# <name>', where the name is the path from the list or 'matrix <k>' for\n" \
+"the k-th matrix of the stream.  Outputs come in input order.  With -j <n>, n matrices are\n" \
+"processed at once, each on one thread.  Errors are reported on stderr prefixed with the name\n" \
+"of the matrix; the others are still processed, and the exit status is failure if any failed.\n" \
+"\n" \
+"With --bootstrap <n>, a tree is also built for each of <n> replicates of the input matrix,\n" \
+"in which every distance is multiplied by a log-normal factor with a standard deviation of\n" \
+"about 10%.  In the Newick output, the name of each internal node is replaced by the\n" \
+"percentage of replicate trees that have the split of the taxa made by the edge that follows\n" \
+"it.  The replicates come from a fixed seed, so the output does not change from one run to\n" \
+"the next, nor with the number of threads (-j), over which the replicates are shared out.\n" \
+"\n" \
+"With --matrix-file <file>, the distance matrix is kept in <file>, mapped into memory, and the\n" \
+"operating system keeps in memory only the parts of it that are in use.  The file is removed\n" \
+"as soon as it is mapped, so nothing is left behind; it takes up to 4 * N * N bytes (half that\n" \
+"with --float32) for N taxa, on the disk that holds it.  The matrix is always read and written\n" \
+"in the order of the file, so the disk traffic is sequential.  The input is best given as a\n" \
+"file rather than a pipe, and -x keeps the number of passes over the matrix small.\n" \
+"\n" \
+"With -v or --stats, a line like the following is written to stderr at the end of the run:\n" \
+"  {\"taxa\":N,\"threads\":J,\"phases\":{\"read\":{\"wall\":S,\"cpu\":S},\"search\":{...},\n" \
+"   \"update\":{...},\"output\":{...}},\"pairs_scored\":N,\"joins\":N,\"passes\":N,\n" \
+"   \"matrix_alloc\":M,\"numa_nodes\":N,\"peak_matrix_bytes\":N,\"bytes_written\":N}\n" \
+"The phases are reading the input, searching for the pairs to join, updating the matrix\n" \
+"after each join (with the edge output) and writing the output, with wall and CPU time in\n" \
+"seconds; CPU time counts all the threads.  pairs_scored counts the Q values computed, and\n" \
+"peak_matrix_bytes the largest size of the distance matrix, with the node distances of -m and\n" \
+"the sorted rows of -r.  matrix_alloc is where the distance matrix is kept: \"heap\", \"input\"\n" \
+"(the mapped binary input), \"file\" (--matrix-file), or with --huge-pages \"hugetlb\" (explicit\n" \
+"huge pages), \"thp\" (transparent ones) or \"pages\" (neither could be had); numa_nodes is the\n" \
+"number of NUMA nodes its rows were first put on for the search threads, 1 if they were not\n" \
+"placed.\n" \
+"\n" \
+"With --insert <edges>, the input matrix holds the distances between the taxa of the tree in\n" \
+"<edges>, in the order of its nodes, followed by the rows of the new taxa.  Each new taxon is\n" \
+"placed near the taxon it is closest to, by joining again only the part of the tree within a\n" \
+"few edges of it, which takes time in proportion to the number of taxa rather than to its cube.\n" \
+"The result is output as without --insert, the edges with the nodes numbered so that it can be\n" \
+"given to --insert again, and may differ somewhat from the tree built from scratch, which\n" \
+"--rebuild-check measures.  -r and -x apply to that rebuild.\n" \
+"\n" \
+"With --checkpoint <file>, the build writes the rows of the distance matrix still in use,\n" \
+"their row sums and the tree built so far to <file> every so often (at the end of a pass\n" \
+"with -x).  The file is replaced as a whole, and left in place at the end.  Run again with\n" \
+"--resume and the same -m, -x and --float32 options, the build goes on from the last\n" \
+"checkpoint and the output is that of a run that was never interrupted, all of it.\n" \
+"\n" \
+); \
+exit(retcode); \
+} while(0)
+
+/*
+ * Bits that are OR-ed in to global_options, besides those of global.h.
+ * Those that select what a run does are the PHILO_ options of the library
+ * (see philo.h); HELP_OPTION, NEWICK_OPTION and MATRIX_OPTION have the same
+ * values as theirs.
+ */
+#define RAPID_OPTION     (PHILO_RAPID)
+#define FLOAT32_OPTION   (PHILO_FLOAT32)
+#define CONVERT_OPTION   (PHILO_CONVERT)
+#define BATCH_OPTION     (0x00000040)
+#define STREAM_OPTION    (0x00000080)
+#define BOOTSTRAP_OPTION (0x00000100)
+#define BINARY_OPTION    (PHILO_BINARY)
+#define RELAXED_OPTION   (PHILO_RELAXED)
+#define STATS_OPTION     (PHILO_STATS)
+#define INSERT_OPTION    (0x00001000)
+#define REBUILD_CHECK_OPTION (0x00002000)
+#define RESUME_OPTION    (PHILO_RESUME)
+#define HUGE_PAGES_OPTION (PHILO_HUGE_PAGES)
+
+/*
+ * Number of threads for reading the input, searching the Q matrix and
+ * formatting the matrix of -m (-j), at least 1.
+ */
+#define MAX_THREADS 1024
+extern int thread_count;
+
+/*
+ * Path at which to keep the distance matrix in a file instead of on the
+ * heap (--matrix-file), otherwise NULL.
+ */
+extern char *matrix_path;
+
+/*
+ * Path of the checkpoint file of the build (--checkpoint), otherwise NULL,
+ * and the number of seconds between checkpoints (--checkpoint-interval,
+ * CHECKPOINT_INTERVAL by default).  See checkpoint.h.
+ */
+#define CHECKPOINT_INTERVAL 600
+#define MAX_CHECKPOINT_INTERVAL 1000000
+extern char *checkpoint_path;
+extern int checkpoint_seconds;
+
+/* Manifest of input files for batch mode (-b), otherwise NULL. */
+extern char *batch_manifest;
+
+/* Edges of the tree to insert the new taxa into (--insert), otherwise NULL. */
+extern char *insert_tree;
+
+/* Number of bootstrap replicates (--bootstrap), otherwise 0. */
+#define MAX_REPLICATES 1000000
+extern int bootstrap_replicates;
+
+#endif
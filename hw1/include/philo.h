@@ -0,0 +1,113 @@
+#ifndef PHILO_H
+#define PHILO_H
+
+#include <stdio.h>
+
+/*
+ * libphilo: phylogenetic trees by neighbor joining, as a library.
+ *
+ * All the state of a run (the options, the distance matrix, the tree being
+ * built) is kept in a PHILO_CONTEXT, so any number of contexts can be used
+ * at once, each by one thread at a time.  A context can be used for one run
+ * after another: philo_read() starts a new run, and the node tables and the
+ * distance matrix of the earlier runs are reused, growing only when a
+ * larger matrix comes along.
+ *
+ * A run is philo_read(), then philo_build(), then at most one of the
+ * philo_emit_ functions, or just philo_run(), which does what the options
+ * ask for.  Functions that return an int return 0 on success and -1 on
+ * error; errors in the input are reported with a one-line message on the
+ * context's message stream.
+ */
+typedef struct philo_context PHILO_CONTEXT;
+
+/* Options of a run, OR-ed together for philo_set_options(). */
+#define PHILO_NEWICK   (0x00000002)    /* philo_run() outputs the tree in Newick format */
+#define PHILO_MATRIX   (0x00000004)    /* philo_run() outputs the matrix of all node distances */
+#define PHILO_RAPID    (0x00000008)    /* search for pairs to join with sorted rows (RapidNJ) */
+#define PHILO_FLOAT32  (0x00000010)    /* keep the distance matrix in single precision */
+#define PHILO_CONVERT  (0x00000020)    /* philo_run() outputs the input in binary form */
+#define PHILO_BINARY   (0x00000200)    /* the matrix of all node distances is output in binary form */
+#define PHILO_RELAXED  (0x00000400)    /* join all mutually best pairs at each pass (relaxed neighbor joining) */
+#define PHILO_STATS    (0x00000800)    /* time the phases of the runs; philo_run() reports them (see stats.h) */
+#define PHILO_RESUME   (0x00004000)    /* philo_run() continues the build of the checkpoint, if there is one */
+#define PHILO_HUGE_PAGES (0x00008000)  /* keep the distance matrix in huge pages, placed for the search threads */
+
+/* Create a context, with no options and 1 thread, or NULL if out of memory. */
+PHILO_CONTEXT *philo_create(void);
+
+/* Free a context and everything it holds. */
+void philo_destroy(PHILO_CONTEXT *context);
+
+/*
+ * Set the options of the runs of a context, the name of the leaf to root
+ * the Newick output at (NULL for the default; the name is copied), and the
+ * number of threads to read, search and format the -m output with.
+ */
+void philo_set_options(PHILO_CONTEXT *context, long options, const char *outlier, int threads);
+
+/*
+ * Keep the distance matrix of the runs of a context in a file created at
+ * path, which must not exist, instead of on the heap (NULL to go back to
+ * the heap; the path is copied).  The file is mapped into memory and
+ * removed at once, so it is only paged in as the matrix is used, which
+ * lets a run handle a matrix larger than memory.  Not for PHILO_MATRIX or
+ * PHILO_RAPID, which keep other tables of that size in memory, or
+ * PHILO_HUGE_PAGES.
+ */
+int philo_set_matrix_file(PHILO_CONTEXT *context, const char *path);
+
+/*
+ * Have philo_build() write the state of the build of the runs of a context
+ * to a checkpoint file at path every interval seconds (NULL for none; the
+ * path is copied).  An interval of 0 writes one after every join.  See
+ * checkpoint.h.
+ */
+int philo_set_checkpoint(PHILO_CONTEXT *context, const char *path, int interval);
+
+/* Set the stream to which errors are reported (NULL for stderr). */
+void philo_set_messages(PHILO_CONTEXT *context, FILE *messages);
+
+/*
+ * Forget the current run, keeping the tables and the matrix for the next
+ * one.  philo_read() does this itself.
+ */
+void philo_reset(PHILO_CONTEXT *context);
+
+/* Read a distance matrix, in CSV or binary form (see binmatrix.h). */
+int philo_read(PHILO_CONTEXT *context, FILE *in);
+
+/*
+ * Read the state of a build from the checkpoint file of the context, in
+ * place of philo_read(), so that philo_build() carries on from there and
+ * builds the same tree as a run that was not interrupted, with the same
+ * output.  Returns 1 if there is no checkpoint file.  Not for PHILO_CONVERT.
+ */
+int philo_resume(PHILO_CONTEXT *context);
+
+/* Build the tree, writing its edges to out unless out is NULL or the Newick or matrix output is selected. */
+int philo_build(PHILO_CONTEXT *context, FILE *out);
+
+/*
+ * Number of passes over the distance matrix that the last philo_build()
+ * made to choose the pairs to join: one per join, except with PHILO_RELAXED.
+ * philo_run() reports it on the message stream with PHILO_RELAXED.
+ */
+int philo_passes(PHILO_CONTEXT *context);
+
+/*
+ * Write the timings and counters of the last run as one line of JSON (see
+ * stats.h).  philo_run() does this on the message stream with PHILO_STATS.
+ */
+void philo_stats(PHILO_CONTEXT *context, FILE *out);
+
+int philo_emit_newick(PHILO_CONTEXT *context, FILE *out);
+int philo_emit_matrix(PHILO_CONTEXT *context, FILE *out);
+
+/* Write the matrix read, in binary form.  Must come before philo_build(). */
+int philo_emit_binary(PHILO_CONTEXT *context, FILE *out);
+
+/* Read, build and output one tree as the options ask, as the philo program does. */
+int philo_run(PHILO_CONTEXT *context, FILE *in, FILE *out);
+
+#endif
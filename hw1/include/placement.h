@@ -0,0 +1,53 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stddef.h>
+
+/*
+ * Placement of the distance matrix on the NUMA nodes of the machine
+ * (--huge-pages with -j).
+ *
+ * The search splits the active rows into one band per thread (see
+ * qsearch_split()), and the bands are spread over the nodes in order.  A
+ * fresh matrix is first touched band by band, as the bands of the first
+ * search fall, each by a thread bound to the CPUs of the node of that band,
+ * so that the kernel puts its pages there, and each search thread is then
+ * bound to the node of its band for the whole build.
+ *
+ * That only holds at the start of the build.  Rows keep their positions as
+ * nodes are joined, but the search splits the rows still active afresh for
+ * each join, so the bands shrink towards the start of the matrix and off
+ * the pages placed for them: with two nodes, once a tenth of the rows are
+ * gone, about a quarter of those the second thread scans are on the other
+ * node, and once fewer rows are left than the first band had, all of them
+ * are.  The pages are not moved after the first touch, so the placement
+ * only pays off in the early joins, where the matrix is largest.
+ *
+ * The nodes are read from NODE_SYSFS, and only those with CPUs the process
+ * may run on are used.  Nothing is placed or bound on a machine with a
+ * single node, or when NODE_SYSFS cannot be read.
+ */
+
+/* Number of NUMA nodes with CPUs the process may run on, at least 1. */
+int placement_nodes(void);
+
+/* Node of band t of count, as an index into the nodes placement_nodes() counts. */
+int placement_node(int t, int count);
+
+/*
+ * Bind the calling thread to the CPUs of a node.  If saved is not NULL,
+ * *saved is set to the CPUs it could run on before, which
+ * placement_restore() puts back.  Returns 0 if successful, -1 otherwise.
+ */
+int placement_bind(int node, void **saved);
+void placement_restore(void *saved);
+
+/*
+ * Touch the pages of the first rows rows of a packed matrix whose entries
+ * have the given size, which no one has touched yet, on the nodes of the
+ * bands of threads search threads.  Returns the number of nodes the
+ * bands were placed on: 1 if they were not placed.
+ */
+int placement_first_touch(char *matrix, size_t precision, int rows, int threads);
+
+#endif
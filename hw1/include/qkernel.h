@@ -0,0 +1,38 @@
+#ifndef QKERNEL_H
+#define QKERNEL_H
+
+/*
+ * Kernel that evaluates a contiguous row of Q values,
+ *     q[k] = scale * dist[k] - sums[k] - row_sum,    0 <= k < len,
+ * and finds the smallest of them.  If that minimum is less than threshold,
+ * the position of its first occurrence is returned and the minimum is
+ * stored in *min_q.  Otherwise -1 is returned.
+ *
+ * There are SSE2 and AVX2 versions of the kernel, which work on several
+ * lanes at a time, and a scalar version.  All of them perform the same
+ * multiply and two subtractions in the same order and in double precision,
+ * without fused multiply-adds, so they give bit-identical results.
+ * The best version the processor supports is chosen the first time the
+ * kernel is used, by whichever thread gets there first.  Setting the environment variable PHILO_KERNEL to
+ * "scalar", "sse2" or "avx2" overrides the choice (a version the processor
+ * does not support is never used).
+ */
+typedef int (*Q_ROW_KERNEL)(const double *dist, const double *sums, int len,
+                            double scale, double row_sum, double threshold, double *min_q);
+
+extern Q_ROW_KERNEL q_row_kernel(void);
+
+/*
+ * The same kernel for a row of single-precision distances (--float32).
+ * The distances are widened to double as they are loaded, and the Q values
+ * are computed in double precision as above.
+ */
+typedef int (*Q_ROW_KERNEL_F32)(const float *dist, const double *sums, int len,
+                                double scale, double row_sum, double threshold, double *min_q);
+
+extern Q_ROW_KERNEL_F32 q_row_kernel_f32(void);
+
+/* Name of the kernel version in use, for diagnostics. */
+extern const char *q_row_kernel_name(void);
+
+#endif
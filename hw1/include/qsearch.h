@@ -0,0 +1,92 @@
+#ifndef QSEARCH_H
+#define QSEARCH_H
+
+/*
+ * Search of the Q matrix for the pair of active nodes to be joined at
+ * each iteration of the neighbor joining method.
+ *
+ * For the active nodes at positions i and j of active_node_map (with n the
+ * number of active nodes),
+ *     Q(i, j) = (n-2) * distances[i][j] - row_sums[i] - row_sums[j].
+ * The pair with the smallest Q value is joined.  Pairs are identified by
+ * their positions, and ties are broken in favor of the pair that comes
+ * first in row-major order of positions (smaller first position, then
+ * smaller second position).  If no Q value compares less than infinity
+ * (they are all NaN), the pair (0, 1) is returned.
+ *
+ * The row sums are patched after each join rather than added up afresh,
+ * so they can be off in their last bits, and two Q values that tie with
+ * sums added up afresh can then differ, or the other way around.  Each
+ * search therefore also keeps the pairs that come within a small tolerance
+ * of the one it found, relative to the largest row sum, and if there are
+ * others, scores them again with the row sums of their positions added up
+ * afresh (see exact_row_sums() in philo.c), so that such ties are broken as
+ * with exact sums.  Inputs with identical taxa tie at almost every join,
+ * but only among a few pairs, so this costs O(n) per position tied.  Only
+ * if there are more such pairs than a few per active node are all the row
+ * sums added up afresh (init_row_sums()) and the search run again.
+ */
+
+/*
+ * qsearch_init() must be called once the tables have been sized, before
+ * the first search of a run, and qsearch_fini() at the end of the run.
+ * The state of the search is kept in the current context (see context.h).
+ * Either search can be spread over a pool of threads, each scanning its own
+ * band of rows and keeping its own best pair.  The band results are reduced
+ * in row order, so the same pair is found for any number of threads.
+ * qsearch_init() takes the total number of threads, counting the calling
+ * one; with 1 (the default) everything runs on the calling thread.
+ */
+int qsearch_init(int threads);
+void qsearch_fini(void);
+
+/*
+ * Split the first n positions into count bands of rows holding about the
+ * same number of pairs, as the search does: band t is the rows from
+ * bounds[t] up to bounds[t + 1], and bounds has count + 1 entries.
+ */
+void qsearch_split(int n, int count, int *bounds);
+
+/*
+ * Find the pair of positions (*pos_i < *pos_j) with the minimum Q value by
+ * scoring every active pair.  Rows of Q values are evaluated by the SIMD
+ * kernel in qkernel.h.
+ */
+void exhaustive_min_q(int *pos_i, int *pos_j);
+
+/*
+ * Bounded search in the style of RapidNJ.  Every node keeps a row of its
+ * distances to the other nodes sorted in increasing order.  Since
+ * Q(i, j) >= (n-2) * distances[i][j] - row_sums[i] - max row sum,
+ * the scan of a row can stop as soon as that lower bound exceeds the best
+ * Q value found so far, by more than the tie tolerance.  The result is the
+ * same pair exhaustive_min_q() would return.
+ *
+ * rapid_init() must be called after the row sums have been initialized
+ * and qsearch_init() has been called, and rapid_join() after each join,
+ * once active_node_map, the distances matrix and the row sums have been
+ * compacted.  Sorted rows are kept by node rather than by position, since
+ * positions change as nodes are joined.  rapid_fini() releases the sorted
+ * rows, and must be called before qsearch_fini().
+ */
+int rapid_init(void);
+void rapid_min_q(int *pos_i, int *pos_j);
+int rapid_join(int ind_i, int ind_j, int new_node);
+void rapid_fini(void);
+
+/*
+ * Relaxed neighbor joining (-x).  Rather than a single pair, each pass over
+ * the matrix finds every pair of active nodes that are each other's best
+ * partner (the pair with the smallest Q value either of them is in), and
+ * they are all joined, one after the other, before the next pass.  The
+ * joins use the distances and row sums as updated by the joins before
+ * them, as usual, but the pairs themselves were chosen with the values at
+ * the start of the pass, so the tree can differ from that of strict
+ * neighbor joining.  Each pass is O(n^2) as before, but there are far
+ * fewer passes than joins: tens rather than thousands for a few thousand
+ * taxa.  The scan is spread over the thread pool like the full search, and
+ * the pairs found do not depend on the number of threads.
+ */
+int relaxed_pairs(int *nodes_out);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Timings and counters of a run (-v, --stats).
+ *
+ * A run has four phases: reading the input, searching for the pairs to
+ * join, updating the matrix (everything else build_taxonomy() does: the
+ * row sums, the joins and the edge output) and writing the output.  Each
+ * phase gets its wall time and the CPU time of the whole process, helper
+ * threads included, while it ran.  Times are only taken when the
+ * PHILO_STATS option is set; the counters are always kept, since they cost
+ * next to nothing.  They are kept in the context of the run (see context.h)
+ * and cleared by philo_reset().
+ */
+
+/* Time spent in one phase, in seconds. */
+typedef struct phase_time {
+    double wall;
+    double cpu;
+} PHASE_TIME;
+
+/* Start of an interval being timed. */
+typedef struct phase_clock {
+    struct timespec wall;
+    struct timespec cpu;
+} PHASE_CLOCK;
+
+typedef struct philo_stats {
+    PHASE_TIME read;
+    PHASE_TIME search;
+    PHASE_TIME update;
+    PHASE_TIME output;
+    long pairs_scored;          /* Q values computed by the searches */
+    long joins;
+    size_t matrix_bytes;        /* held now by the distance, node distance and sorted row tables */
+    size_t peak_matrix_bytes;
+    long bytes_written;         /* of output, to the stream given to the run */
+} RUN_STATS;
+
+/*
+ * Time an interval of the current run: stats_start() notes the clocks and
+ * stats_stop() adds the time since then to the phase.  Both do nothing
+ * unless the PHILO_STATS option is set.
+ */
+void stats_start(PHASE_CLOCK *clock);
+void stats_stop(PHASE_CLOCK *clock, PHASE_TIME *phase);
+
+/* Count tables of the given size as held by the current run, or no longer held. */
+void stats_hold(size_t bytes);
+void stats_release(size_t bytes);
+
+/*
+ * Write the timings and counters of the current run to out as one JSON
+ * object on a line of its own.
+ */
+void stats_report(FILE *out);
+
+#endif
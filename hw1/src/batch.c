@@ -0,0 +1,267 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "context.h"
+#include "debug.h"
+#include "philo.h"
+#include "csvread.h"
+#include "batch.h"
+
+/*
+ * Number of matrices read ahead and handed out to the workers at a time.
+ * Their results are kept until they can be written in order.
+ */
+#define WINDOW_JOBS 256
+
+typedef struct batch_job {
+    char *name;                 /* path from the manifest, or "matrix <k>" */
+    char *input;                /* the matrix, from the stream; NULL to open name */
+    size_t input_length;
+    char *output;
+    size_t output_length;
+    char *messages;
+    size_t messages_length;
+    int status;                 /* 0 if the run succeeded */
+    int done;
+} BATCH_JOB;
+
+typedef struct batch_window {
+    BATCH_JOB *jobs;
+    int count;
+    int next;                   /* next job to be handed out */
+    pthread_mutex_t lock;
+    pthread_cond_t finished;    /* signalled whenever a job is done */
+} BATCH_WINDOW;
+
+/* Run a job in the worker's context, collecting its output and messages in memory. */
+static void run_job(BATCH_JOB *job, PHILO_CONTEXT *context) {
+    FILE *out = open_memstream(&job->output, &job->output_length);
+    FILE *messages = open_memstream(&job->messages, &job->messages_length);
+
+    job->status = -1;
+    if (context != NULL && out != NULL && messages != NULL) {
+        philo_set_messages(context, messages);
+        FILE *in = job->input != NULL ? fmemopen(job->input, job->input_length, "r")
+            : fopen(job->name, "r");
+        if (in == NULL)
+            fprintf(messages, "cannot open the input: %s\n", strerror(errno));
+        else {
+            job->status = philo_run(context, in, out);
+            fclose(in);
+        }
+        philo_set_messages(context, NULL);
+    }
+    if (out != NULL)
+        fclose(out);
+    if (messages != NULL)
+        fclose(messages);
+}
+
+/*
+ * Each worker runs its jobs one after the other in a context of its own,
+ * with the options of the program and one thread, reusing the tables and
+ * the matrix from one job to the next.
+ */
+static void *batch_worker(void *arg) {
+    PHILO_CONTEXT *ctx = current_context;
+    BATCH_WINDOW *window = arg;
+    PHILO_CONTEXT *context = philo_create();
+    if (context != NULL)
+        philo_set_options(context, ctx->global_options, ctx->outlier_name, 1);
+
+    while (1) {
+        pthread_mutex_lock(&window->lock);
+        int j = window->next < window->count ? window->next++ : -1;
+        pthread_mutex_unlock(&window->lock);
+        if (j < 0)
+            break;
+
+        run_job(window->jobs + j, context);
+
+        pthread_mutex_lock(&window->lock);
+        (window->jobs + j)->done = 1;
+        pthread_cond_broadcast(&window->finished);
+        pthread_mutex_unlock(&window->lock);
+    }
+    philo_destroy(context);
+    return NULL;
+}
+
+/* Write the result of a job, and its messages, each line prefixed with the name of the job. */
+static void write_result(BATCH_JOB *job, FILE *out) {
+    fprintf(out, "# %s\n", job->name);
+    if (job->output != NULL)
+        fwrite(job->output, 1, job->output_length, out);
+
+    char *p = job->messages;
+    char *end = p + job->messages_length;
+    if (job->status && p == end)
+        fprintf(stderr, "%s: failed\n", job->name);
+    while (p < end) {
+        char *newline = memchr(p, '\n', end - p);
+        size_t len = (newline != NULL ? newline : end) - p;
+        fprintf(stderr, "%s: %.*s\n", job->name, (int)len, p);
+        p += len + 1;
+    }
+}
+
+static void clear_job(BATCH_JOB *job) {
+    free(job->name);
+    free(job->input);
+    free(job->output);
+    free(job->messages);
+    memset(job, 0, sizeof(BATCH_JOB));
+}
+
+/*
+ * Run the jobs of a window on up to the given number of worker threads,
+ * writing each result as soon as it and all those before it are done.
+ * If no thread can be started, the jobs are run by the calling thread.
+ * Returns the number of jobs that failed.
+ */
+static int run_window(BATCH_WINDOW *window, int threads, FILE *out) {
+    if (threads > window->count)
+        threads = window->count;
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    int started = 0;
+    while (workers != NULL && started < threads
+           && pthread_create(workers + started, NULL, batch_worker, window) == 0)
+        started++;
+    if (started == 0)
+        batch_worker(window);
+
+    int failed = 0;
+    for (int j = 0; j < window->count; j++) {
+        BATCH_JOB *job = window->jobs + j;
+        pthread_mutex_lock(&window->lock);
+        while (!job->done)
+            pthread_cond_wait(&window->finished, &window->lock);
+        pthread_mutex_unlock(&window->lock);
+
+        write_result(job, out);
+        if (job->status)
+            failed++;
+        clear_job(job);
+    }
+
+    for (int t = 0; t < started; t++)
+        pthread_join(*(workers + t), NULL);
+    free(workers);
+    return failed;
+}
+
+/* Get the next path from the manifest.  Returns 1, 0 at the end, or -1 on an error. */
+static int next_manifest_job(CSV_READER *reader, BATCH_JOB *job) {
+    char *line;
+    size_t length;
+    int ret;
+    while ((ret = csv_next_line(reader, &line, &length)) == 1) {
+        if (length > 0 && *line != '#')
+            break;
+    }
+    if (ret != 1)
+        return ret;
+    job->name = strndup(line, length);
+    return job->name != NULL ? 1 : -1;
+}
+
+/*
+ * Copy the next matrix of the stream into memory: its first line, which is
+ * found after any blank or comment lines, and the lines that follow up to
+ * as many data lines as the first one has names (fewer at the end of the
+ * stream, which the run then reports).  Comment lines are copied along, so
+ * line numbers in messages count from the first line of the matrix.
+ * Returns 1, 0 at the end, or -1 on an error.
+ */
+static int next_stream_job(CSV_READER *reader, BATCH_JOB *job, int number) {
+    char *line;
+    size_t length;
+    int ret;
+    while ((ret = csv_next_line(reader, &line, &length)) == 1) {
+        if (length > 0 && *line != '#')
+            break;
+    }
+    if (ret != 1)
+        return ret;
+
+    FILE *input = open_memstream(&job->input, &job->input_length);
+    job->name = malloc(32);
+    if (input == NULL || job->name == NULL) {
+        if (input != NULL)
+            fclose(input);
+        return -1;
+    }
+    snprintf(job->name, 32, "matrix %d", number);
+
+    int rows = 0;
+    for (char *p = line; (p = memchr(p, ',', line + length - p)) != NULL; p++)
+        rows++;
+    fwrite(line, 1, length, input);
+    fputc('\n', input);
+    while (rows > 0 && (ret = csv_next_line(reader, &line, &length)) == 1) {
+        fwrite(line, 1, length, input);
+        fputc('\n', input);
+        if (length == 0 || *line != '#')
+            rows--;
+    }
+    fclose(input);
+    return ret < 0 ? -1 : 1;
+}
+
+int run_batch(const char *manifest, FILE *in, FILE *out) {
+    PHILO_CONTEXT *ctx = current_context;
+    FILE *list = in;
+    if (manifest != NULL && (list = fopen(manifest, "r")) == NULL) {
+        fprintf(stderr, "cannot open %s: %s\n", manifest, strerror(errno));
+        return -1;
+    }
+
+    CSV_READER reader;
+    BATCH_WINDOW window;
+    int failed = 0;
+    window.jobs = calloc(WINDOW_JOBS, sizeof(BATCH_JOB));
+    if (window.jobs == NULL || csv_open(&reader, list)) {
+        fprintf(stderr, "out of memory\n");
+        free(window.jobs);
+        if (manifest != NULL)
+            fclose(list);
+        return -1;
+    }
+    pthread_mutex_init(&window.lock, NULL);
+    pthread_cond_init(&window.finished, NULL);
+
+    int number = 0;
+    int more = 1;
+    while (more) {
+        window.count = 0;
+        window.next = 0;
+        while (window.count < WINDOW_JOBS) {
+            BATCH_JOB *job = window.jobs + window.count;
+            int ret = manifest != NULL ? next_manifest_job(&reader, job)
+                : next_stream_job(&reader, job, number + 1);
+            if (ret != 1) {
+                if (ret < 0) {
+                    fprintf(stderr, "cannot read the %s\n", manifest != NULL ? "manifest" : "input");
+                    failed++;
+                }
+                clear_job(job);
+                more = 0;
+                break;
+            }
+            window.count++;
+            number++;
+        }
+        failed += run_window(&window, ctx->num_threads, out);
+    }
+    debug("batch of %d matrices, %d failed", number, failed);
+
+    pthread_cond_destroy(&window.finished);
+    pthread_mutex_destroy(&window.lock);
+    csv_close(&reader);
+    free(window.jobs);
+    if (manifest != NULL)
+        fclose(list);
+    return failed ? -1 : 0;
+}
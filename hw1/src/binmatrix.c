@@ -0,0 +1,86 @@
+#include <string.h>
+
+#include "debug.h"
+#include "binmatrix.h"
+
+/* Number of entries in a packed matrix with the given number of rows (as TRI_SIZE in context.h). */
+static uint64_t packed_size(uint64_t count) {
+    return count * (count + 1) / 2;
+}
+
+int bin_is_matrix(const char *data, size_t size) {
+    return size >= BIN_MAGIC_LENGTH && memcmp(data, BIN_MAGIC, BIN_MAGIC_LENGTH) == 0;
+}
+
+const char *bin_parse(const char *data, size_t size, int max_name, BIN_MATRIX *matrix) {
+    BIN_HEADER header;
+    if (size < sizeof(BIN_HEADER))
+        return "truncated header";
+    memcpy(&header, data, sizeof(BIN_HEADER));              // the data need not be aligned
+    if (!bin_is_matrix(header.magic, BIN_MAGIC_LENGTH))
+        return "not a binary distance file";
+    if (header.byte_order != BIN_BYTE_ORDER)
+        return "written with another byte order";
+    if (header.version != BIN_VERSION)
+        return "unsupported version";
+    if (header.precision != sizeof(float) && header.precision != sizeof(double))
+        return "precision must be 4 or 8 bytes";
+    if (header.count < 1 || header.count > (1u << 30))
+        return "bad number of taxa";
+
+    // offsets are checked against what remains, so that nothing can overflow
+    if (header.names_offset < sizeof(BIN_HEADER) || header.names_offset > size
+        || header.names_length > size - header.names_offset)
+        return "name table is outside the file";
+    if (header.matrix_offset % BIN_ALIGN != 0
+        || header.matrix_offset < header.names_offset + header.names_length
+        || header.matrix_offset > size)
+        return "matrix is misplaced";
+    if (header.matrix_length != packed_size(header.count) * header.precision)
+        return "matrix length does not match the number of taxa";
+    if (header.matrix_length > size - header.matrix_offset)
+        return "truncated matrix";
+
+    const char *p = data + header.names_offset;
+    const char *end = p + header.names_length;
+    for (uint32_t i = 0; i < header.count; i++) {
+        const char *nul = memchr(p, '\0', end - p);
+        if (nul == NULL)
+            return "truncated name table";
+        if (nul == p || nul - p > max_name)
+            return "bad taxon name length";
+        p = nul + 1;
+    }
+
+    matrix->count = header.count;
+    matrix->precision = header.precision;
+    matrix->names = data + header.names_offset;
+    matrix->matrix = data + header.matrix_offset;
+    return NULL;
+}
+
+long bin_write(FILE *out, int count, char *const *names, const void *matrix, int precision) {
+    BIN_HEADER header;
+    memset(&header, 0, sizeof(BIN_HEADER));
+    memcpy(header.magic, BIN_MAGIC, BIN_MAGIC_LENGTH);
+    header.version = BIN_VERSION;
+    header.byte_order = BIN_BYTE_ORDER;
+    header.count = count;
+    header.precision = precision;
+    header.names_offset = sizeof(BIN_HEADER);
+    for (int i = 0; i < count; i++)
+        header.names_length += strlen(*(names + i)) + 1;
+    header.matrix_offset = (header.names_offset + header.names_length + BIN_ALIGN - 1)
+        / BIN_ALIGN * BIN_ALIGN;
+    header.matrix_length = packed_size(count) * precision;
+
+    static const char padding[BIN_ALIGN];
+    fwrite(&header, sizeof(BIN_HEADER), 1, out);
+    for (int i = 0; i < count; i++)
+        fwrite(*(names + i), 1, strlen(*(names + i)) + 1, out);
+    fwrite(padding, 1, header.matrix_offset - header.names_offset - header.names_length, out);
+    fwrite(matrix, 1, header.matrix_length, out);
+    if (fflush(out) || ferror(out))
+        return -1;
+    return header.matrix_offset + header.matrix_length;
+}
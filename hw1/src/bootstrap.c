@@ -0,0 +1,399 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "context.h"
+#include "debug.h"
+#include "philo.h"
+#include "bootstrap.h"
+
+/* Seed of the replicates, and the standard deviation of the logarithm of their factors. */
+#define BOOTSTRAP_SEED  UINT64_C(0x5048494c4f424f4f)
+#define BOOTSTRAP_SIGMA 0.1
+
+/*
+ * The splits of the taxa made by the edges of a tree are sets of taxa,
+ * kept as bit sets of words 64-bit words each.  The set on either side of
+ * an edge describes its split; the one without taxon 0 is the one kept.
+ * The distinct non-trivial splits of the tree of the input are numbered,
+ * and found by their hash in a table of those numbers (-1 where empty).
+ */
+typedef struct split_table {
+    int taxa;
+    int words;
+    uint64_t *splits;           /* split k at splits + k * words */
+    int count;
+    int *slots;
+    int mask;                   /* number of slots - 1, a power of 2 - 1 */
+} SPLIT_TABLE;
+
+typedef struct bootstrap_run {
+    SPLIT_TABLE table;
+    const double *input;        /* the input matrix, packed, before the tree was built */
+    long options;               /* of the replicate contexts */
+    int replicates;
+    int next;                   /* next replicate to be built */
+    int failed;
+    pthread_mutex_t lock;
+} BOOTSTRAP_RUN;
+
+typedef struct bootstrap_worker {
+    BOOTSTRAP_RUN *run;
+    long *counts;               /* number of replicate trees with each split */
+} BOOTSTRAP_WORKER;
+
+/*
+ * Set of the taxa on the far side of the edge from each node of the tree of
+ * the current context to its neighbors[0]: the taxa below the node, as the
+ * tree was built.  Children are always created before their parent.
+ */
+static void node_clusters(uint64_t *clusters, int words) {
+    PHILO_CONTEXT *ctx = current_context;
+    memset(clusters, 0, (size_t)ctx->num_all_nodes * words * sizeof(uint64_t));
+    for (int x = 0; x < ctx->num_all_nodes; x++) {
+        uint64_t *set = clusters + (size_t)x * words;
+        if (x < ctx->num_taxa) {
+            *(set + x / 64) = UINT64_C(1) << (x % 64);
+            continue;
+        }
+        uint64_t *left = clusters + (size_t)(*((ctx->nodes + x)->neighbors + 1) - ctx->nodes) * words;
+        uint64_t *right = clusters + (size_t)(*((ctx->nodes + x)->neighbors + 2) - ctx->nodes) * words;
+        for (int w = 0; w < words; w++)
+            *(set + w) = *(left + w) | *(right + w);
+    }
+}
+
+/*
+ * Turn a set of taxa into the side of its split without taxon 0.
+ * Returns 1 if the split is non-trivial, with at least two taxa on each side.
+ */
+static int normalize_split(uint64_t *set, int taxa, int words) {
+    if (*set & 1) {
+        for (int w = 0; w < words; w++)
+            *(set + w) = ~*(set + w);
+        if (taxa % 64)
+            *(set + words - 1) &= (UINT64_C(1) << (taxa % 64)) - 1;
+    }
+    int size = 0;
+    for (int w = 0; w < words; w++)
+        size += __builtin_popcountll(*(set + w));
+    return size >= 2 && size <= taxa - 2;
+}
+
+static unsigned hash_split(const uint64_t *set, int words) {
+    uint64_t h = 0;
+    for (int w = 0; w < words; w++) {
+        h = (h ^ *(set + w)) * UINT64_C(0x9e3779b97f4a7c15);
+        h ^= h >> 29;
+    }
+    return (unsigned)(h >> 32);
+}
+
+/* Find a split in the table.  Returns its number, or -1 if it is not there. */
+static int find_split(SPLIT_TABLE *table, const uint64_t *set) {
+    int slot = (int)(hash_split(set, table->words) & table->mask);
+    while (*(table->slots + slot) >= 0) {
+        int k = *(table->slots + slot);
+        if (memcmp(table->splits + (size_t)k * table->words, set, table->words * sizeof(uint64_t)) == 0)
+            return k;
+        slot = (slot + 1) & table->mask;
+    }
+    return -1;
+}
+
+/* Add a split to the table, unless it is already there.  Returns its number. */
+static int add_split(SPLIT_TABLE *table, const uint64_t *set) {
+    int k = find_split(table, set);
+    if (k >= 0)
+        return k;
+    int slot = (int)(hash_split(set, table->words) & table->mask);
+    while (*(table->slots + slot) >= 0)
+        slot = (slot + 1) & table->mask;
+    k = table->count++;
+    memcpy(table->splits + (size_t)k * table->words, set, table->words * sizeof(uint64_t));
+    *(table->slots + slot) = k;
+    return k;
+}
+
+/*
+ * Number the splits of the tree of the current context in the table, and
+ * store the number of the split of each edge to a neighbors[0] in
+ * node_splits (-1 for a trivial one).  The table is allocated here.
+ */
+static int reference_splits(SPLIT_TABLE *table, int *node_splits) {
+    PHILO_CONTEXT *ctx = current_context;
+    table->taxa = ctx->num_taxa;
+    table->words = (ctx->num_taxa + 63) / 64;
+    table->count = 0;
+    table->mask = 1;
+    while (table->mask < 2 * ctx->num_all_nodes)
+        table->mask *= 2;
+    table->slots = malloc(table->mask * sizeof(int));
+    table->mask--;
+    table->splits = malloc((size_t)ctx->num_all_nodes * table->words * sizeof(uint64_t));
+    uint64_t *clusters = malloc((size_t)ctx->num_all_nodes * table->words * sizeof(uint64_t));
+    if (table->slots == NULL || table->splits == NULL || clusters == NULL) {
+        free(clusters);
+        return -1;
+    }
+    memset(table->slots, -1, (table->mask + 1) * sizeof(int));
+
+    node_clusters(clusters, table->words);
+    for (int x = 0; x < ctx->num_all_nodes; x++) {
+        uint64_t *set = clusters + (size_t)x * table->words;
+        *(node_splits + x) = normalize_split(set, table->taxa, table->words) ? add_split(table, set) : -1;
+    }
+    free(clusters);
+    return 0;
+}
+
+static uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += UINT64_C(0x9e3779b97f4a7c15));
+    z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+    return z ^ (z >> 31);
+}
+
+/* A uniform deviate in (0, 1]. */
+static double uniform(uint64_t *state) {
+    return ((splitmix64(state) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * Fill the matrix of the current context with replicate r of the input:
+ * each distance below the diagonal times exp(sigma * g), for a standard
+ * normal deviate g (Box-Muller), drawn in the order of the packed matrix.
+ */
+static void generate_replicate(const double *input, int taxa, int r) {
+    uint64_t state = BOOTSTRAP_SEED;
+    state ^= splitmix64(&state) + (uint64_t)r;
+    for (int i = 0; i < taxa; i++) {
+        const double *row = input + tri_index(i, 0);
+        for (int j = 0; j < i; j++) {
+            double g = sqrt(-2.0 * log(uniform(&state))) * cos(2.0 * M_PI * uniform(&state));
+            set_distance(i, j, *(row + j) * exp(BOOTSTRAP_SIGMA * g));
+        }
+        set_distance(i, i, *(row + i));
+    }
+}
+
+/*
+ * Each worker builds replicates one after the other in a context of its
+ * own, sized for the input once, and counts the replicate trees that have
+ * each split of the tree of the input.
+ */
+static void *bootstrap_worker(void *arg) {
+    BOOTSTRAP_WORKER *worker = arg;
+    BOOTSTRAP_RUN *run = worker->run;
+    SPLIT_TABLE *table = &run->table;
+    int taxa = table->taxa;
+    int total_nodes = 2 * taxa - 2 < taxa ? taxa : 2 * taxa - 2;
+
+    PHILO_CONTEXT *context = philo_create();
+    uint64_t *clusters = malloc((size_t)total_nodes * table->words * sizeof(uint64_t));
+    int *seen = calloc(table->count + 1, sizeof(int));      // last replicate that counted each split
+    int ret = -1;
+    if (context != NULL && clusters != NULL && seen != NULL) {
+        philo_set_options(context, run->options, NULL, 1);
+        current_context = context;
+        ret = grow_node_tables(total_nodes) || grow_distance_matrix(taxa) ? -1 : 0;
+    }
+
+    while (ret == 0) {
+        pthread_mutex_lock(&run->lock);
+        int r = run->next < run->replicates && !run->failed ? run->next++ : -1;
+        pthread_mutex_unlock(&run->lock);
+        if (r < 0)
+            break;
+
+        philo_reset(context);
+        generate_replicate(run->input, taxa, r);
+        init_leaves(taxa);
+        if (build_taxonomy(NULL)) {
+            ret = -1;
+            break;
+        }
+
+        node_clusters(clusters, table->words);
+        for (int x = 0; x < context->num_all_nodes; x++) {
+            uint64_t *set = clusters + (size_t)x * table->words;
+            if (!normalize_split(set, taxa, table->words))
+                continue;
+            int k = find_split(table, set);
+            if (k >= 0 && *(seen + k) != r + 1) {               // the last edge is seen from both ends
+                *(seen + k) = r + 1;
+                (*(worker->counts + k))++;
+            }
+        }
+    }
+
+    if (ret) {
+        pthread_mutex_lock(&run->lock);
+        run->failed = 1;
+        pthread_mutex_unlock(&run->lock);
+    }
+    philo_destroy(context);
+    free(clusters);
+    free(seen);
+    return NULL;
+}
+
+/*
+ * Build the replicates on up to the given number of worker threads, and
+ * add up their counts in counts.  If no thread can be started, the
+ * replicates are built by the calling thread.
+ */
+static int run_replicates(BOOTSTRAP_RUN *run, int threads, long *counts) {
+    if (threads > run->replicates)
+        threads = run->replicates;
+    BOOTSTRAP_WORKER *workers = calloc(threads, sizeof(BOOTSTRAP_WORKER));
+    pthread_t *ids = malloc(threads * sizeof(pthread_t));
+    if (workers == NULL || ids == NULL) {
+        free(workers);
+        free(ids);
+        return -1;
+    }
+    for (int t = 0; t < threads; t++) {
+        (workers + t)->run = run;
+        (workers + t)->counts = calloc(run->table.count + 1, sizeof(long));
+        if ((workers + t)->counts == NULL)
+            run->failed = 1;
+    }
+
+    int started = 0;
+    PHILO_CONTEXT *saved = current_context;
+    if (!run->failed) {
+        while (started < threads && pthread_create(ids + started, NULL, bootstrap_worker, workers + started) == 0)
+            started++;
+        if (started == 0)
+            bootstrap_worker(workers);
+    }
+    current_context = saved;
+
+    for (int t = 0; t < threads; t++) {
+        if (t < started)
+            pthread_join(*(ids + t), NULL);
+        for (int k = 0; (workers + t)->counts != NULL && k < run->table.count; k++)
+            *(counts + k) += *((workers + t)->counts + k);
+        free((workers + t)->counts);
+    }
+    free(workers);
+    free(ids);
+    return run->failed ? -1 : 0;
+}
+
+/*
+ * The splits of the first tree are numbered in a table, and those of the
+ * second looked up in it.  The last edge of a tree is the neighbors[0] of
+ * both of its ends, so it is only counted from the one with the lower number.
+ */
+int split_distance(PHILO_CONTEXT *first, PHILO_CONTEXT *second) {
+    PHILO_CONTEXT *saved = current_context;
+    current_context = first;
+    SPLIT_TABLE table;
+    memset(&table, 0, sizeof(SPLIT_TABLE));
+    int *node_splits = malloc(first->num_all_nodes * sizeof(int));
+    int distance = -1;
+    if (node_splits != NULL && reference_splits(&table, node_splits) == 0) {
+        current_context = second;
+        uint64_t *clusters = malloc((size_t)second->num_all_nodes * table.words * sizeof(uint64_t));
+        int *seen = calloc(table.count + 1, sizeof(int));
+        if (clusters != NULL && seen != NULL) {
+            node_clusters(clusters, table.words);
+            int count = 0;
+            int common = 0;
+            for (int x = 0; x < second->num_all_nodes; x++) {
+                NODE *parent = *((second->nodes + x)->neighbors + 0);
+                if (parent != NULL && *(parent->neighbors + 0) == second->nodes + x && parent < second->nodes + x)
+                    continue;
+                uint64_t *set = clusters + (size_t)x * table.words;
+                if (!normalize_split(set, table.taxa, table.words))
+                    continue;
+                count++;
+                int k = find_split(&table, set);
+                if (k >= 0 && !*(seen + k)) {
+                    *(seen + k) = 1;
+                    common++;
+                }
+            }
+            distance = table.count + count - 2 * common;
+        }
+        free(clusters);
+        free(seen);
+    }
+    current_context = saved;
+    free(node_splits);
+    free(table.splits);
+    free(table.slots);
+    return distance;
+}
+
+int run_bootstrap(int replicates, FILE *in, FILE *out) {
+    PHILO_CONTEXT *saved = current_context;
+    int threads = saved->num_threads;
+    PHILO_CONTEXT *context = philo_create();
+    if (context == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+    philo_set_options(context, saved->global_options, saved->outlier_name, threads);
+    if (philo_read(context, in)) {
+        philo_destroy(context);
+        return -1;
+    }
+
+    current_context = context;
+
+    BOOTSTRAP_RUN run;
+    memset(&run, 0, sizeof(BOOTSTRAP_RUN));
+    run.options = context->global_options & (RAPID_OPTION | RELAXED_OPTION | FLOAT32_OPTION);
+    run.replicates = replicates;
+    pthread_mutex_init(&run.lock, NULL);
+
+    int ret = -1;
+    long *counts = NULL;
+    double *input = malloc(TRI_SIZE(context->num_taxa) * sizeof(double));
+    if (input != NULL) {
+        for (int i = 0; i < context->num_taxa; i++) {
+            for (int j = 0; j <= i; j++)
+                *(input + tri_index(i, j)) = get_distance(i, j);
+        }
+        run.input = input;
+        if (build_taxonomy(NULL) == 0) {
+            if (context->global_options & RELAXED_OPTION)
+                fprintf(stderr, "relaxed joining: %d passes over the matrix\n", philo_passes(context));
+            context->node_support = malloc(context->num_all_nodes * sizeof(int));
+            if (context->node_support != NULL && reference_splits(&run.table, context->node_support) == 0
+                && (counts = calloc(run.table.count + 1, sizeof(long))) != NULL
+                && run_replicates(&run, threads, counts) == 0)
+                ret = 0;
+            else
+                fprintf(stderr, "out of memory\n");
+        }
+    }
+    else
+        fprintf(stderr, "out of memory\n");
+
+    if (ret == 0) {
+        // node_support held the split of each edge, and now gets its support
+        for (int x = 0; x < context->num_all_nodes; x++) {
+            int k = *(context->node_support + x);
+            *(context->node_support + x) = k < 0 ? 100 : (int)((200 * *(counts + k) + replicates) / (2L * replicates));
+        }
+        debug("%d replicates, %d splits", replicates, run.table.count);
+        ret = emit_newick_format(out);
+    }
+
+    free(context->node_support);
+    context->node_support = NULL;
+    current_context = saved;
+    philo_destroy(context);
+    pthread_mutex_destroy(&run.lock);
+    free(run.table.splits);
+    free(run.table.slots);
+    free(counts);
+    free(input);
+    return ret;
+}
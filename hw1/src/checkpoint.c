@@ -0,0 +1,258 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "context.h"
+#include "debug.h"
+#include "binmatrix.h"
+#include "checkpoint.h"
+
+double checkpoint_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Bytes per entry of the distances matrix of the build. */
+static size_t matrix_precision(void) {
+    PHILO_CONTEXT *ctx = current_context;
+    return ctx->float_distances != NULL ? sizeof(float) : sizeof(double);
+}
+
+/* Write the parts of a checkpoint after its header.  Returns -1 if the output could not be written. */
+static int write_state(FILE *out) {
+    PHILO_CONTEXT *ctx = current_context;
+    for (int i = 0; i < ctx->num_taxa; i++)
+        fwrite(*(ctx->node_names + i), 1, strlen(*(ctx->node_names + i)) + 1, out);
+    fwrite(ctx->active_node_map, sizeof(int), ctx->num_active_nodes, out);
+    fwrite(ctx->row_sums, sizeof(double), ctx->num_active_nodes, out);
+    for (int w = ctx->num_taxa; w < ctx->num_all_nodes; w++) {
+        int children[2];
+        *children = *((ctx->nodes + w)->neighbors + 1) - ctx->nodes;
+        *(children + 1) = *((ctx->nodes + w)->neighbors + 2) - ctx->nodes;
+        fwrite(children, sizeof(int), 2, out);
+    }
+    fwrite(ctx->edge_lengths, sizeof(double), ctx->num_all_nodes, out);
+    fwrite(ctx->float_distances != NULL ? (void *)ctx->float_distances : (void *)ctx->distances, matrix_precision(),
+           TRI_SIZE(ctx->num_active_nodes), out);
+    if (ctx->node_distances != NULL)
+        fwrite(ctx->node_distances, sizeof(double), TRI_SIZE(ctx->num_all_nodes), out);
+    if (fflush(out) || ferror(out))
+        return -1;
+    return fsync(fileno(out));
+}
+
+int write_checkpoint(void) {
+    PHILO_CONTEXT *ctx = current_context;
+    CKPT_HEADER header;
+    memset(&header, 0, sizeof(CKPT_HEADER));
+    memcpy(header.magic, CKPT_MAGIC, CKPT_MAGIC_LENGTH);
+    header.version = CKPT_VERSION;
+    header.byte_order = BIN_BYTE_ORDER;
+    header.options = ctx->global_options & CKPT_OPTIONS;
+    header.taxa = ctx->num_taxa;
+    header.all_nodes = ctx->num_all_nodes;
+    header.active_nodes = ctx->num_active_nodes;
+    header.outlier = ctx->default_outlier;
+    header.passes = ctx->num_passes;
+    header.row_sums_scale = ctx->row_sums_scale;
+    for (int i = 0; i < ctx->num_taxa; i++)
+        header.names_length += strlen(*(ctx->node_names + i)) + 1;
+
+    size_t length = strlen(ctx->checkpoint_file);
+    char *temporary = malloc(length + sizeof(".tmp"));
+    if (temporary == NULL) {
+        fprintf(message_stream(), "out of memory\n");
+        return -1;
+    }
+    memcpy(temporary, ctx->checkpoint_file, length);
+    memcpy(temporary + length, ".tmp", sizeof(".tmp"));
+
+    FILE *out = fopen(temporary, "wb");
+    int ret = -1;
+    if (out != NULL) {
+        fwrite(&header, sizeof(CKPT_HEADER), 1, out);
+        ret = write_state(out);
+        if (fclose(out))
+            ret = -1;
+        if (ret == 0)
+            ret = rename(temporary, ctx->checkpoint_file);
+    }
+    if (ret) {
+        fprintf(message_stream(), "cannot write the checkpoint %s: %s\n", ctx->checkpoint_file, strerror(errno));
+        if (out != NULL)
+            unlink(temporary);
+    }
+    else
+        debug("checkpoint after %d joins", ctx->num_all_nodes - ctx->num_taxa);
+    free(temporary);
+    return ret;
+}
+
+/* Size of a checkpoint file with the given header, or 0 if it is too large to be one. */
+static uint64_t checkpoint_size(CKPT_HEADER *header) {
+    uint64_t taxa = header->taxa;
+    uint64_t all = header->all_nodes;
+    uint64_t active = header->active_nodes;
+    uint64_t precision = (header->options & FLOAT32_OPTION) ? sizeof(float) : sizeof(double);
+    if (taxa > (1u << 30) || header->names_length > taxa * (INPUT_MAX + 1))
+        return 0;
+    return sizeof(CKPT_HEADER) + header->names_length
+        + active * (sizeof(int) + sizeof(double))
+        + (all - taxa) * 2 * sizeof(int) + all * sizeof(double)
+        + TRI_SIZE(active) * precision
+        + ((header->options & MATRIX_OPTION) ? TRI_SIZE(all) * sizeof(double) : 0);
+}
+
+/* What is wrong with the header of a checkpoint file of the given size, or NULL if nothing is. */
+static const char *check_header(CKPT_HEADER *header, uint64_t size) {
+    PHILO_CONTEXT *ctx = current_context;
+    if (memcmp(header->magic, CKPT_MAGIC, CKPT_MAGIC_LENGTH) != 0)
+        return "not a checkpoint file";
+    if (header->byte_order != BIN_BYTE_ORDER)
+        return "written with another byte order";
+    if (header->version != CKPT_VERSION)
+        return "unsupported version";
+    if (header->options != (ctx->global_options & CKPT_OPTIONS))
+        return "written with other -m, -x or --float32 options";
+    // each join makes one node and leaves one node fewer active; checkpoints
+    // are written after a join and before the last one
+    if (header->taxa < 4 || header->active_nodes < 3 || header->active_nodes >= header->taxa
+        || header->all_nodes - header->taxa != header->taxa - header->active_nodes
+        || header->outlier < 0 || header->outlier >= (int32_t)header->taxa)
+        return "bad numbers of nodes";
+    uint64_t expected = checkpoint_size(header);
+    if (expected == 0 || size != expected)
+        return "size does not match its header";
+    return NULL;
+}
+
+/*
+ * Check the names read from a checkpoint: count null-terminated names of 1
+ * to INPUT_MAX characters that fill the given length exactly.
+ */
+static int check_names(const char *names, size_t length, int count) {
+    const char *end = names + length;
+    for (int i = 0; i < count; i++) {
+        const char *null = memchr(names, '\0', end - names);
+        if (null == NULL || null == names || null - names > INPUT_MAX)
+            return -1;
+        names = null + 1;
+    }
+    return names == end ? 0 : -1;
+}
+
+/*
+ * Read the tables of the checkpoint that follow its names, and link the
+ * nodes.  Every node but the active ones must have been joined exactly once.
+ * Returns NULL, or a message saying what is wrong.
+ */
+static const char *read_state(FILE *in) {
+    PHILO_CONTEXT *ctx = current_context;
+    if (fread(ctx->active_node_map, sizeof(int), ctx->num_active_nodes, in) != (size_t)ctx->num_active_nodes
+        || fread(ctx->row_sums, sizeof(double), ctx->num_active_nodes, in) != (size_t)ctx->num_active_nodes)
+        return "truncated";
+    for (int p = ctx->num_active_nodes; p <= ctx->num_taxa; p++)
+        *(ctx->active_node_map + p) = -2;
+
+    for (int w = ctx->num_taxa; w < ctx->num_all_nodes; w++) {
+        int children[2];
+        if (fread(children, sizeof(int), 2, in) != 2)
+            return "truncated";
+        for (int c = 0; c < 2; c++) {
+            int child = *(children + c);
+            if (child < 0 || child >= w || *((ctx->nodes + child)->neighbors + 0) != NULL)
+                return "bad tree";
+            *((ctx->nodes + child)->neighbors + 0) = ctx->nodes + w;
+            *((ctx->nodes + w)->neighbors + 1 + c) = ctx->nodes + child;
+        }
+    }
+    for (int p = 0; p < ctx->num_active_nodes; p++) {
+        int node = *(ctx->active_node_map + p);
+        if (node < 0 || node >= ctx->num_all_nodes || *((ctx->nodes + node)->neighbors + 0) != NULL)
+            return "bad active nodes";
+    }
+    if (fread(ctx->edge_lengths, sizeof(double), ctx->num_all_nodes, in) != (size_t)ctx->num_all_nodes)
+        return "truncated";
+
+    if (grow_distance_matrix(ctx->num_active_nodes))
+        return "cannot allocate the matrix";
+    size_t entries = TRI_SIZE(ctx->num_active_nodes);
+    stats_hold(entries * matrix_precision());
+    if (fread(ctx->float_distances != NULL ? (void *)ctx->float_distances : (void *)ctx->distances, matrix_precision(),
+              entries, in) != entries)
+        return "truncated";
+
+    if (ctx->global_options & MATRIX_OPTION) {
+        free(ctx->node_distances);
+        ctx->node_distances = calloc(TRI_SIZE(ctx->node_capacity), sizeof(double));
+        if (ctx->node_distances == NULL)
+            return "out of memory";
+        stats_hold(TRI_SIZE(ctx->node_capacity) * sizeof(double));
+        if (fread(ctx->node_distances, sizeof(double), TRI_SIZE(ctx->num_all_nodes), in)
+            != TRI_SIZE(ctx->num_all_nodes))
+            return "truncated";
+    }
+    return NULL;
+}
+
+int read_checkpoint(void) {
+    PHILO_CONTEXT *ctx = current_context;
+    FILE *in = fopen(ctx->checkpoint_file, "rb");
+    if (in == NULL && errno == ENOENT)
+        return 1;
+    if (in == NULL) {
+        fprintf(message_stream(), "cannot open the checkpoint %s: %s\n", ctx->checkpoint_file, strerror(errno));
+        return -1;
+    }
+
+    CKPT_HEADER header;
+    memset(&header, 0, sizeof(CKPT_HEADER));
+    struct stat info;
+    const char *error = NULL;
+    char *names = NULL;
+    if (fstat(fileno(in), &info) || fread(&header, sizeof(CKPT_HEADER), 1, in) != 1)
+        error = "truncated header";
+    else
+        error = check_header(&header, info.st_size);
+
+    int count = header.taxa;
+    if (error == NULL && (grow_node_tables(2 * count - 2)
+                          || (names = malloc(header.names_length)) == NULL))
+        error = "out of memory";
+    if (error == NULL && (fread(names, 1, header.names_length, in) != header.names_length
+                          || check_names(names, header.names_length, count)))
+        error = "bad names";
+    if (error == NULL) {
+        int duplicate = set_taxon_names(names, count);
+        error = duplicate < 0 ? "out of memory" : duplicate < count ? "duplicate taxon name" : NULL;
+    }
+    if (error == NULL) {
+        init_leaves(count);
+        ctx->num_all_nodes = header.all_nodes;
+        ctx->num_active_nodes = header.active_nodes;
+        if (name_internal_nodes())
+            error = "out of memory";
+    }
+    if (error == NULL) {
+        for (int node = count; node < ctx->num_all_nodes; node++)
+            (ctx->nodes + node)->name = *(ctx->node_names + node);
+        error = read_state(in);
+    }
+    free(names);
+    fclose(in);
+    if (error != NULL) {
+        fprintf(message_stream(), "checkpoint %s: %s\n", ctx->checkpoint_file, error);
+        return -1;
+    }
+
+    ctx->default_outlier = header.outlier;
+    ctx->num_passes = header.passes;
+    ctx->row_sums_scale = header.row_sums_scale;
+    ctx->stats.joins = ctx->num_all_nodes - ctx->num_taxa;
+    debug("resumed after %d joins", ctx->num_all_nodes - ctx->num_taxa);
+    return 0;
+}
@@ -0,0 +1,415 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "context.h"
+#include "debug.h"
+#include "csvread.h"
+
+/* Size of the blocks in which a stream that cannot be mapped is read. */
+#define READ_BLOCK (1 << 20)
+
+int csv_open(CSV_READER *reader, FILE *in) {
+    memset(reader, 0, sizeof(CSV_READER));
+    reader->in = in;
+
+    struct stat st;
+    off_t offset = ftello(in);
+    if (offset >= 0 && fstat(fileno(in), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > offset) {
+        size_t length = st.st_size;
+        char *map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fileno(in), 0);
+        if (map != MAP_FAILED) {
+            madvise(map, length, MADV_SEQUENTIAL);
+            reader->data = map;
+            reader->map_length = length;
+            reader->size = length;
+            reader->pos = offset;
+            reader->at_eof = 1;
+            return 0;
+        }
+    }
+
+    reader->capacity = READ_BLOCK;
+    reader->data = malloc(reader->capacity);
+    return reader->data == NULL ? -1 : 0;
+}
+
+/* Read another block from the stream, after moving the unread data to the front. */
+static int fill_buffer(CSV_READER *reader) {
+    if (reader->pos > 0) {
+        memmove(reader->data, reader->data + reader->pos, reader->size - reader->pos);
+        reader->size -= reader->pos;
+        reader->pos = 0;
+    }
+    if (reader->size == reader->capacity) {                 // a line longer than the buffer
+        char *data = realloc(reader->data, 2 * reader->capacity);
+        if (data == NULL)
+            return -1;
+        reader->data = data;
+        reader->capacity *= 2;
+    }
+
+    size_t got = fread(reader->data + reader->size, 1, reader->capacity - reader->size, reader->in);
+    reader->size += got;
+    if (got == 0) {
+        if (ferror(reader->in))
+            return -1;
+        reader->at_eof = 1;
+    }
+    return 0;
+}
+
+int csv_next_line(CSV_READER *reader, char **line, size_t *length) {
+    char *start;
+    char *newline;
+    size_t scanned = 0;
+
+    while (1) {
+        start = reader->data + reader->pos;
+        newline = memchr(start + scanned, '\n', reader->size - reader->pos - scanned);
+        if (newline != NULL || reader->at_eof)
+            break;
+        scanned = reader->size - reader->pos;
+        if (fill_buffer(reader))
+            return -1;
+    }
+
+    size_t len;
+    if (newline != NULL) {
+        len = newline - start;
+        reader->pos += len + 1;
+    }
+    else {                                                  // last line, without a newline
+        len = reader->size - reader->pos;
+        if (len == 0)
+            return 0;
+        reader->pos += len;
+    }
+    if (len > 0 && *(start + len - 1) == '\r')
+        len--;
+
+    reader->line++;
+    *line = start;
+    *length = len;
+    return 1;
+}
+
+size_t csv_fill(CSV_READER *reader, size_t wanted) {
+    while (reader->size - reader->pos < wanted && !reader->at_eof) {
+        if (fill_buffer(reader))
+            return (size_t)-1;
+    }
+    return reader->size - reader->pos;
+}
+
+char *csv_detach_mapping(CSV_READER *reader, size_t *length) {
+    if (reader->map_length == 0)
+        return NULL;
+    char *map = reader->data;
+    if (mprotect(map, reader->map_length, PROT_READ | PROT_WRITE))
+        return NULL;
+    madvise(map, reader->map_length, MADV_NORMAL);
+    *length = reader->map_length;
+    reader->data = NULL;
+    reader->map_length = 0;
+    reader->size = reader->pos = 0;
+    return map;
+}
+
+void csv_close(CSV_READER *reader) {
+    if (reader->map_length > 0)
+        munmap(reader->data, reader->map_length);
+    else
+        free(reader->data);
+    reader->data = NULL;
+}
+
+/* Powers of ten that are exactly representable as doubles. */
+static const double exact_powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+int csv_parse_double(const char *field, size_t length, double *value) {
+    const char *p = field;
+    const char *end = field + length;
+    int negative = 0;
+    uint64_t mantissa = 0;
+    int significant = 0;                                    // digits in the mantissa, after leading zeros
+    int digits = 0;
+    int exponent = 0;
+
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    for (; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+        if (significant < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa != 0)
+                significant++;
+        }
+        else {
+            significant++;
+            exponent++;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+            if (significant < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa != 0)
+                    significant++;
+                exponent--;
+            }
+            else {
+                significant++;
+            }
+        }
+    }
+    if (digits == 0)
+        return -1;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        int exp_negative = 0;
+        int exp_value = 0;
+        p++;
+        if (p < end && (*p == '-' || *p == '+')) {
+            exp_negative = *p == '-';
+            p++;
+        }
+        if (p == end)
+            return -1;
+        for (; p < end && *p >= '0' && *p <= '9'; p++) {
+            if (exp_value < 100000)
+                exp_value = exp_value * 10 + (*p - '0');
+        }
+        exponent += exp_negative ? -exp_value : exp_value;
+    }
+    if (p != end)
+        return -1;
+
+    if (significant <= 15 && exponent >= -22 && exponent <= 22) {
+        // the mantissa and the power of ten are both exact, so one
+        // correctly rounded operation gives the correctly rounded result
+        double result = (double)mantissa;
+        if (exponent >= 0)
+            result *= exact_powers[exponent];
+        else
+            result /= exact_powers[-exponent];
+        *value = negative ? -result : result;
+        return 0;
+    }
+
+    char text[INPUT_MAX+1];
+    if (length > INPUT_MAX)
+        return -1;
+    memcpy(text, field, length);
+    *(text + length) = '\0';
+    double result = strtod(text, NULL);
+    if (!isfinite(result))
+        return -1;
+    *value = result;
+    return 0;
+}
+
+/* Below this many taxa, or this many bytes per chunk, the rows are read serially. */
+#define MIN_PARALLEL_TAXA 64
+#define MIN_CHUNK_BYTES (1 << 20)
+
+typedef struct ingest_chunk {
+    char *start;                /* first byte of the chunk, at the start of a line */
+    char *end;                  /* one past the last byte of the chunk */
+    int count;                  /* number of taxa */
+    int first_row;              /* index of the first data row in the chunk */
+    int rows;                   /* number of data lines in the chunk */
+    int failed;
+    uint64_t upper;             /* fingerprint of the entries above the diagonal */
+    uint64_t lower;             /* fingerprint of the entries below the diagonal */
+    PHILO_CONTEXT *context;     /* of the run the matrix belongs to */
+} INGEST_CHUNK;
+
+/* Hash of an entry of the matrix, keyed by the unordered pair of indices. */
+static uint64_t entry_hash(int i, int j, double value) {
+    uint64_t bits = 0;
+    if (value != 0.0)                                       // 0.0 and -0.0 compare equal
+        memcpy(&bits, &value, sizeof(bits));
+    uint64_t h = ((uint64_t)i << 32 | (uint32_t)j) * 0x9e3779b97f4a7c15ULL ^ bits;
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+/* Find the end of the line starting at p, before end.  Sets *next to the start of the next line. */
+static char *line_end(char *p, char *end, char **next) {
+    char *newline = memchr(p, '\n', end - p);
+    if (newline == NULL) {
+        *next = end;
+        return end;
+    }
+    *next = newline + 1;
+    return newline;
+}
+
+static void *count_rows(void *arg) {
+    INGEST_CHUNK *chunk = arg;
+    char *p = chunk->start;
+    char *next;
+
+    chunk->rows = 0;
+    while (p < chunk->end) {
+        line_end(p, chunk->end, &next);
+        if (*p != '#')
+            chunk->rows++;
+        p = next;
+    }
+    return NULL;
+}
+
+/* Parse row number row, whose line is [p, end), into the matrix.  Returns 0 or -1. */
+static int parse_row(INGEST_CHUNK *chunk, char *p, char *end, int row) {
+    PHILO_CONTEXT *ctx = current_context;
+    int count = chunk->count;
+    if (end > p && *(end - 1) == '\r')
+        end--;
+
+    char *comma = memchr(p, ',', end - p);
+    size_t len = (comma != NULL ? comma : end) - p;
+    if (len != strlen(*(ctx->node_names + row)) || memcmp(p, *(ctx->node_names + row), len) != 0)
+        return -1;
+    p += len;
+
+    for (int col = 0; col < count; col++) {
+        if (p == end)
+            return -1;
+        p++;
+        comma = memchr(p, ',', end - p);
+        len = (comma != NULL ? comma : end) - p;
+
+        double dist;
+        if (len > INPUT_MAX || csv_parse_double(p, len, &dist))
+            return -1;
+        if (ctx->float_distances != NULL)
+            dist = (float)dist;
+
+        if (col < row) {
+            set_distance(row, col, dist);
+            chunk->lower += entry_hash(col, row, dist);
+        }
+        else if (col > row) {
+            chunk->upper += entry_hash(row, col, dist);
+        }
+        else {
+            if (dist != 0.0)
+                return -1;
+            set_distance(row, col, dist);
+        }
+        p += len;
+    }
+    return p == end ? 0 : -1;
+}
+
+static void *parse_rows(void *arg) {
+    INGEST_CHUNK *chunk = arg;
+    char *p = chunk->start;
+    char *next;
+    int row = chunk->first_row;
+    current_context = chunk->context;
+
+    while (p < chunk->end && row < chunk->count) {
+        char *end = line_end(p, chunk->end, &next);
+        if (*p != '#') {
+            if (parse_row(chunk, p, end, row)) {
+                chunk->failed = 1;
+                break;
+            }
+            row++;
+        }
+        p = next;
+    }
+    return NULL;
+}
+
+/* Run fn on every chunk, each on its own thread except the first, which runs on the caller. */
+static void run_chunks(INGEST_CHUNK *chunks, int num_chunks, void *(*fn)(void *)) {
+    pthread_t *threads = malloc(num_chunks * sizeof(pthread_t));
+    int *started = calloc(num_chunks, sizeof(int));
+
+    for (int t = 1; t < num_chunks; t++) {
+        if (threads != NULL && started != NULL && pthread_create(threads + t, NULL, fn, chunks + t) == 0)
+            *(started + t) = 1;
+    }
+    fn(chunks);
+    for (int t = 1; t < num_chunks; t++) {
+        if (started != NULL && *(started + t))
+            pthread_join(*(threads + t), NULL);
+        else
+            fn(chunks + t);                                 // could not start a thread for it
+    }
+    free(threads);
+    free(started);
+}
+
+int csv_read_rows_parallel(CSV_READER *reader, int count, int threads, int always) {
+    if (reader->map_length == 0 || (!always && (count < MIN_PARALLEL_TAXA || threads < 2)))
+        return -1;
+
+    char *start = reader->data + reader->pos;
+    char *end = reader->data + reader->size;
+    size_t bytes = end - start;
+    int num_chunks = threads;
+    if ((size_t)num_chunks > bytes / MIN_CHUNK_BYTES)
+        num_chunks = bytes / MIN_CHUNK_BYTES;
+    if (num_chunks < 2 && !always)
+        return -1;
+    if (num_chunks < 1)
+        num_chunks = 1;
+
+    INGEST_CHUNK *chunks = calloc(num_chunks, sizeof(INGEST_CHUNK));
+    if (chunks == NULL)
+        return -1;
+
+    // cut the rows into chunks of about the same size, at line boundaries
+    char *p = start;
+    for (int t = 0; t < num_chunks; t++) {
+        (chunks + t)->start = p;
+        (chunks + t)->count = count;
+        (chunks + t)->context = current_context;
+        if (t == num_chunks - 1)
+            p = end;
+        else if (p < start + bytes / num_chunks * (t + 1))
+            line_end(start + bytes / num_chunks * (t + 1), end, &p);
+        (chunks + t)->end = p;
+    }
+
+    run_chunks(chunks, num_chunks, count_rows);
+    int rows = 0;
+    for (int t = 0; t < num_chunks; t++) {
+        (chunks + t)->first_row = rows;
+        rows += (chunks + t)->rows;
+    }
+
+    int ret = 1;
+    if (rows >= count) {
+        run_chunks(chunks, num_chunks, parse_rows);
+        uint64_t upper = 0;
+        uint64_t lower = 0;
+        int failed = 0;
+        for (int t = 0; t < num_chunks; t++) {
+            failed |= (chunks + t)->failed;
+            upper += (chunks + t)->upper;
+            lower += (chunks + t)->lower;
+        }
+        if (!failed && upper == lower)
+            ret = 0;
+    }
+    free(chunks);
+    debug("parallel read of %d rows in %d chunks: %s", count, num_chunks, ret ? "failed" : "done");
+    return ret;
+}
@@ -0,0 +1,666 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "context.h"
+#include "debug.h"
+#include "philo.h"
+#include "bootstrap.h"
+#include "insert.h"
+
+/*
+ * Number of edges from the nearest leaf within which the tree is joined
+ * again around a new taxon.  The internal nodes within that distance are
+ * at most MAX_REGION, and the subtrees that hang off them at most MAX_UNITS.
+ */
+#define INSERT_RADIUS 4
+#define MAX_REGION ((3 << (INSERT_RADIUS - 1)) - 2)
+#define MAX_UNITS (MAX_REGION + 2)
+
+/*
+ * The tree as it grows, as lists of adjacent nodes.  The leaves are the
+ * taxa, nodes 0 to taxa - 1 of the matrix, and the internal nodes are
+ * numbered from num_taxa on, in no particular order: those that a
+ * placement takes out are kept in free_nodes for the next ones.
+ */
+typedef struct insert_tree {
+    int taxa;                   /* number of taxa placed so far */
+    int *degree;
+    int *adjacent;              /* 3 per node */
+    double *lengths;            /* of the edges to the adjacent nodes */
+    int *free_nodes;
+    int num_free;
+
+    // for a placement
+    int *mark;                  /* the taxon last placed near each node */
+    int *region_index;          /* position of each node of the region in region */
+    int *stack;
+    int *from;
+    double *depth;
+    int region[MAX_REGION];
+    int num_region;
+    int unit_root[MAX_UNITS];   /* the node of the subtree next to the region */
+    int unit_node[MAX_UNITS];   /* the node of the region it hangs off */
+    double unit_length[MAX_UNITS];
+    double to_unit[MAX_UNITS];  /* distance from the new taxon to unit_root */
+    int num_units;
+} INSERT_TREE;
+
+static void add_edge(INSERT_TREE *tree, int a, int b, double length) {
+    *(tree->adjacent + 3 * a + *(tree->degree + a)) = b;
+    *(tree->lengths + 3 * a + (*(tree->degree + a))++) = length;
+    *(tree->adjacent + 3 * b + *(tree->degree + b)) = a;
+    *(tree->lengths + 3 * b + (*(tree->degree + b))++) = length;
+}
+
+/* Take b out of the list of a, moving the last entry into its place. */
+static void drop_neighbor(INSERT_TREE *tree, int a, int b) {
+    int last = --(*(tree->degree + a));
+    for (int k = 0; k < last; k++) {
+        if (*(tree->adjacent + 3 * a + k) == b) {
+            *(tree->adjacent + 3 * a + k) = *(tree->adjacent + 3 * a + last);
+            *(tree->lengths + 3 * a + k) = *(tree->lengths + 3 * a + last);
+            return;
+        }
+    }
+}
+
+static void free_tree(INSERT_TREE *tree) {
+    free(tree->degree);
+    free(tree->adjacent);
+    free(tree->lengths);
+    free(tree->free_nodes);
+    free(tree->mark);
+    free(tree->region_index);
+    free(tree->stack);
+    free(tree->from);
+    free(tree->depth);
+}
+
+/* Walk the side of the edge from a to b that a is on, giving its nodes their depth below a and the mark side. */
+static void walk_side(INSERT_TREE *tree, int a, int b, int side) {
+    int top = 0;
+    *(tree->stack + top++) = a;
+    *(tree->from + a) = b;
+    *(tree->depth + a) = 0.0;
+    while (top > 0) {
+        int node = *(tree->stack + --top);
+        *(tree->mark + node) = side;
+        for (int k = 0; k < *(tree->degree + node); k++) {
+            int next = *(tree->adjacent + 3 * node + k);
+            if (next == *(tree->from + node))
+                continue;
+            *(tree->from + next) = node;
+            *(tree->depth + next) = *(tree->depth + node) + *(tree->lengths + 3 * node + k);
+            *(tree->stack + top++) = next;
+        }
+    }
+}
+
+/* Set the length of the edge between a and b, in the lists of both. */
+static void set_length(INSERT_TREE *tree, int a, int b, double length) {
+    for (int k = 0; k < *(tree->degree + a); k++) {
+        if (*(tree->adjacent + 3 * a + k) == b)
+            *(tree->lengths + 3 * a + k) = length;
+    }
+    for (int k = 0; k < *(tree->degree + b); k++) {
+        if (*(tree->adjacent + 3 * b + k) == a)
+            *(tree->lengths + 3 * b + k) = length;
+    }
+}
+
+/*
+ * Estimate the length of the edge between a and b again from the matrix:
+ * the mean, over the taxa on either side, of their distance to the taxon
+ * nearest to the edge on the other side, less the lengths of the paths
+ * from both to the edge.  That is the last edge of the edges philo writes,
+ * whose length build_taxonomy() works out in a way of its own, which is
+ * not the distance across it.
+ */
+static void refit_edge(INSERT_TREE *tree, int a, int b) {
+    walk_side(tree, a, b, 0);
+    walk_side(tree, b, a, 1);
+    int nearest[2] = { -1, -1 };
+    for (int leaf = 0; leaf < tree->taxa; leaf++) {
+        int side = *(tree->mark + leaf);
+        if (*(nearest + side) < 0 || *(tree->depth + leaf) < *(tree->depth + *(nearest + side)))
+            *(nearest + side) = leaf;
+    }
+    double sum = 0.0;
+    for (int leaf = 0; leaf < tree->taxa; leaf++) {
+        int other = *(nearest + !*(tree->mark + leaf));
+        sum += get_distance(leaf, other) - *(tree->depth + leaf) - *(tree->depth + other);
+    }
+    set_length(tree, a, b, sum / tree->taxa);
+}
+
+/*
+ * Read the tree of the first taxa of the matrix from the edges philo wrote
+ * for it: "a,b,length" lines (others, such as the "# <name>" of a batch,
+ * are skipped), where the k taxa are nodes 0 to k - 1 and the k - 2
+ * internal nodes follow.  k is found from the number of edges, 2 * k - 3.
+ * The last edge is that of the last line, whose length is estimated again.
+ */
+static int read_tree(INSERT_TREE *tree, const char *path) {
+    PHILO_CONTEXT *ctx = current_context;
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    int capacity = 1024;
+    int count = 0;
+    int *ends = malloc(2 * capacity * sizeof(int));
+    double *lengths = malloc(capacity * sizeof(double));
+    char line[256];
+    int failed = ends == NULL || lengths == NULL;
+    while (!failed && fgets(line, sizeof(line), in) != NULL) {
+        int a;
+        int b;
+        double length;
+        if (*line == '#' || sscanf(line, "%d,%d,%lf", &a, &b, &length) != 3)
+            continue;
+        if (count == capacity) {
+            capacity *= 2;
+            int *more_ends = realloc(ends, 2 * capacity * sizeof(int));
+            if (more_ends != NULL)
+                ends = more_ends;
+            double *more_lengths = realloc(lengths, capacity * sizeof(double));
+            if (more_lengths != NULL)
+                lengths = more_lengths;
+            failed = more_ends == NULL || more_lengths == NULL;
+            if (failed)
+                break;
+        }
+        *(ends + 2 * count) = a;
+        *(ends + 2 * count + 1) = b;
+        *(lengths + count) = length;
+        count++;
+    }
+    failed = failed || ferror(in);
+    fclose(in);
+    if (failed) {
+        fprintf(stderr, "cannot read %s\n", path);
+        free(ends);
+        free(lengths);
+        return -1;
+    }
+
+    // the leaves keep their numbers; internal node f of the file is num_taxa + f - k
+    int k = (count + 3) / 2;
+    int ret = 0;
+    int last_a = 0;
+    int last_b = 0;
+    if (count < 3 || count != 2 * k - 3) {
+        fprintf(stderr, "%s: not the edges of a tree of at least 3 taxa\n", path);
+        ret = -1;
+    }
+    else if (k > ctx->num_taxa) {
+        fprintf(stderr, "%s: the tree has %d taxa, but the matrix only %d\n", path, k, ctx->num_taxa);
+        ret = -1;
+    }
+    for (int e = 0; ret == 0 && e < count; e++) {
+        int a = *(ends + 2 * e);
+        int b = *(ends + 2 * e + 1);
+        if (a < 0 || b < 0 || a >= 2 * k - 2 || b >= 2 * k - 2 || a == b) {
+            fprintf(stderr, "%s: bad edge %d,%d\n", path, a, b);
+            ret = -1;
+            break;
+        }
+        a = a < k ? a : ctx->num_taxa + a - k;
+        b = b < k ? b : ctx->num_taxa + b - k;
+        if (*(tree->degree + a) == (a < ctx->num_taxa ? 1 : 3) || *(tree->degree + b) == (b < ctx->num_taxa ? 1 : 3)) {
+            fprintf(stderr, "%s: the taxa are not nodes 0 to %d, or a node has more than three edges\n",
+                    path, k - 1);
+            ret = -1;
+            break;
+        }
+        add_edge(tree, a, b, *(lengths + e));
+        last_a = a;
+        last_b = b;
+    }
+    free(ends);
+    free(lengths);
+    if (ret)
+        return -1;
+
+    // 2 * k - 3 edges between 2 * k - 2 nodes make a tree if they connect them all;
+    // with a cycle, the walk would go round it, and is cut short
+    int reached = 0;
+    int top = 0;
+    *(tree->stack + top++) = 0;
+    *(tree->from + 0) = -1;
+    while (top > 0 && reached <= 2 * k - 2) {
+        int node = *(tree->stack + --top);
+        reached++;
+        for (int a = 0; a < *(tree->degree + node); a++) {
+            int next = *(tree->adjacent + 3 * node + a);
+            if (next != *(tree->from + node)) {
+                *(tree->from + next) = node;
+                *(tree->stack + top++) = next;
+            }
+        }
+    }
+    if (reached != 2 * k - 2) {
+        fprintf(stderr, "%s: the edges do not make a tree\n", path);
+        return -1;
+    }
+
+    tree->taxa = k;
+    refit_edge(tree, last_a, last_b);
+    tree->num_free = 0;
+    for (int node = 2 * ctx->num_taxa - 3; node >= ctx->num_taxa + k - 2; node--)
+        *(tree->free_nodes + tree->num_free++) = node;
+    return 0;
+}
+
+/*
+ * Find the region for taxon x: the internal nodes within INSERT_RADIUS
+ * edges of the leaf nearest to x, and the units, the subtrees that hang
+ * off them, each with the distance from x to its root.
+ */
+static void find_region(INSERT_TREE *tree, int x) {
+    PHILO_CONTEXT *ctx = current_context;
+    int nearest = 0;
+    double best = get_distance(x, 0);
+    for (int leaf = 1; leaf < tree->taxa; leaf++) {
+        double dist = get_distance(x, leaf);
+        if (dist < best) {
+            best = dist;
+            nearest = leaf;
+        }
+    }
+
+    // breadth first from the neighbor of the leaf, over internal nodes only
+    int first = *(tree->adjacent + 3 * nearest);
+    tree->num_region = 0;
+    *(tree->region + tree->num_region++) = first;
+    *(tree->mark + first) = x;
+    *(tree->depth + first) = 1;
+    for (int k = 0; k < tree->num_region; k++) {
+        int node = *(tree->region + k);
+        *(tree->region_index + node) = k;
+        if (*(tree->depth + node) == INSERT_RADIUS)
+            continue;
+        for (int a = 0; a < 3; a++) {
+            int next = *(tree->adjacent + 3 * node + a);
+            if (next >= ctx->num_taxa && *(tree->mark + next) != x) {
+                *(tree->mark + next) = x;
+                *(tree->depth + next) = *(tree->depth + node) + 1;
+                *(tree->region + tree->num_region++) = next;
+            }
+        }
+    }
+
+    // the units, and the mean of d(x, leaf) - d(root, leaf) over the leaves of each
+    tree->num_units = 0;
+    for (int k = 0; k < tree->num_region; k++) {
+        int node = *(tree->region + k);
+        for (int a = 0; a < 3; a++) {
+            int root = *(tree->adjacent + 3 * node + a);
+            if (root >= ctx->num_taxa && *(tree->mark + root) == x)
+                continue;
+            int u = tree->num_units++;
+            *(tree->unit_root + u) = root;
+            *(tree->unit_node + u) = node;
+            *(tree->unit_length + u) = *(tree->lengths + 3 * node + a);
+
+            double sum = 0.0;
+            int leaves = 0;
+            int top = 0;
+            *(tree->stack + top++) = root;
+            *(tree->from + root) = node;
+            *(tree->depth + root) = 0.0;
+            while (top > 0) {
+                int next = *(tree->stack + --top);
+                if (next < ctx->num_taxa) {
+                    sum += get_distance(x, next) - *(tree->depth + next);
+                    leaves++;
+                    continue;
+                }
+                for (int b = 0; b < 3; b++) {
+                    int child = *(tree->adjacent + 3 * next + b);
+                    if (child == *(tree->from + next))
+                        continue;
+                    *(tree->from + child) = next;
+                    *(tree->depth + child) = *(tree->depth + next) + *(tree->lengths + 3 * next + b);
+                    *(tree->stack + top++) = child;
+                }
+            }
+            *(tree->to_unit + u) = sum / leaves;
+        }
+    }
+}
+
+/*
+ * Fill the matrix of the local context (the current one) with the
+ * distances between the units and x, which is the last taxon: between two
+ * units, the length of the path between their roots in the tree.
+ */
+static void fill_local_matrix(INSERT_TREE *tree) {
+    PHILO_CONTEXT *ctx = current_context;
+    double along[MAX_REGION];                    // from one node of the region to the others
+    int order[MAX_REGION];
+    int m = tree->num_units;
+    for (int u = 0; u < m; u++) {
+        int start = *(tree->region_index + *(tree->unit_node + u));
+        for (int k = 0; k < tree->num_region; k++)
+            *(along + k) = -1.0;
+        *(along + start) = 0.0;
+        int length = 0;
+        *(order + length++) = start;
+        for (int k = 0; k < length; k++) {
+            int node = *(tree->region + *(order + k));
+            for (int a = 0; a < 3; a++) {
+                int next = *(tree->adjacent + 3 * node + a);
+                if (next < ctx->num_taxa || *(tree->mark + next) != tree->taxa)
+                    continue;
+                int index = *(tree->region_index + next);
+                if (*(along + index) < 0.0) {
+                    *(along + index) = *(along + *(order + k)) + *(tree->lengths + 3 * node + a);
+                    *(order + length++) = index;
+                }
+            }
+        }
+        for (int v = 0; v <= u; v++) {
+            double dist = v == u ? 0.0 : *(tree->unit_length + u)
+                + *(along + *(tree->region_index + *(tree->unit_node + v))) + *(tree->unit_length + v);
+            set_distance(u, v, dist);
+        }
+    }
+    for (int u = 0; u < m; u++)
+        set_distance(m, u, *(tree->to_unit + u));
+    set_distance(m, m, 0.0);
+}
+
+/*
+ * Length of the last edge of the tree of a local join, given by the parent
+ * of each node and the length of the edge to it, for the matrix it was
+ * joined from: the mean over the pairs of leaves on either side of the edge
+ * of their distance less the lengths of their paths to it.  The edge is
+ * the one between the last node and its parent, and build_taxonomy() gives
+ * it a length of its own making, which keeps the output of the program
+ * as it was, but is not the distance across it.
+ */
+static double last_edge_length(const double *input, int leaves, const int *parent, const double *length,
+                               int count) {
+    int side[MAX_UNITS + 1];
+    double depth[MAX_UNITS + 1];
+    int last = count - 1;
+    for (int s = 0; s < leaves; s++) {
+        *(depth + s) = 0.0;
+        int node = s;
+        while (node != last && node != *(parent + last)) {
+            *(depth + s) += *(length + node);
+            node = *(parent + node);
+        }
+        *(side + s) = node == last;
+    }
+
+    double sum = 0.0;
+    int pairs = 0;
+    for (int a = 0; a < leaves; a++) {
+        for (int b = 0; b < a; b++) {
+            if (*(side + a) != *(side + b)) {
+                sum += *(input + tri_index(a, b)) - *(depth + a) - *(depth + b);
+                pairs++;
+            }
+        }
+    }
+    return sum / pairs;
+}
+
+/*
+ * Place taxon x (the next one, tree->taxa): join the units of its region
+ * and x in the local context, and put the tree of the join in place of
+ * the region, with the nodes of the region taken for internal nodes of
+ * the join and one more from free_nodes.
+ */
+static int place_taxon(INSERT_TREE *tree, PHILO_CONTEXT *local) {
+    int x = tree->taxa;
+    find_region(tree, x);
+
+    int m = tree->num_units;
+    int parent[2 * MAX_UNITS];
+    double length[2 * MAX_UNITS];
+    double input[TRI_SIZE(MAX_UNITS + 1)];
+    int count;
+    PHILO_CONTEXT *ctx = current_context;
+    philo_reset(local);
+    current_context = local;
+    fill_local_matrix(tree);
+    for (size_t e = 0; e < TRI_SIZE(m + 1); e++)
+        *(input + e) = *(local->distances + e);
+    init_leaves(m + 1);
+    int ret = build_taxonomy(NULL);
+    count = local->num_all_nodes;
+    for (int s = 0; s < count; s++) {
+        *(parent + s) = *((local->nodes + s)->neighbors + 0) - local->nodes;
+        *(length + s) = *(local->edge_lengths + s);
+    }
+    current_context = ctx;
+    if (ret)
+        return -1;
+    ctx->stats.joins += local->stats.joins;
+    ctx->stats.pairs_scored += local->stats.pairs_scored;
+    *(length + count - 1) = *(length + *(parent + count - 1)) = last_edge_length(input, m + 1, parent, length, count);
+
+    for (int k = 0; k < tree->num_region; k++) {
+        int node = *(tree->region + k);
+        for (int a = 0; a < 3; a++) {
+            int next = *(tree->adjacent + 3 * node + a);
+            if (next < ctx->num_taxa || *(tree->mark + next) != x)
+                drop_neighbor(tree, next, node);
+        }
+        *(tree->degree + node) = 0;
+        *(tree->free_nodes + tree->num_free++) = node;
+    }
+
+    // the leaves of the join are the units and x; its internal nodes come after them
+    int node_of[2 * MAX_UNITS];
+    for (int s = 0; s < count; s++)
+        *(node_of + s) = s < m ? *(tree->unit_root + s) : s == m ? x : *(tree->free_nodes + --tree->num_free);
+    for (int s = 0; s < count; s++) {
+        int p = *(parent + s);
+        if (*(parent + p) == s && p < s)                        // the last edge, seen from both ends
+            continue;
+        add_edge(tree, *(node_of + s), *(node_of + p), *(length + s));
+    }
+    tree->taxa++;
+    return 0;
+}
+
+/*
+ * Make the tree the tree of the current context, as build_taxonomy() would
+ * have left it: it is walked from the edge between taxon 0 and its
+ * neighbor, which becomes the last edge, and the internal nodes are
+ * numbered in the reverse of the walk, so that the children of a node come
+ * before it.  The edges are written to out, two per internal node in the
+ * order of their numbers and then the last one, as build_taxonomy() writes
+ * them, unless out is NULL.  Returns 0 if successful, -1 otherwise.
+ */
+static int adopt_tree(INSERT_TREE *tree, FILE *out) {
+    PHILO_CONTEXT *ctx = current_context;
+    int total = 2 * ctx->num_taxa - 2;
+    int *order = tree->stack;
+    int *number = tree->region_index;                   // the new number of each node
+    int length = 0;
+    int top = *(tree->adjacent + 0);
+    *(order + length++) = top;
+    *(tree->from + top) = 0;
+    for (int k = 0; k < length; k++) {
+        int node = *(order + k);
+        for (int a = 0; node >= ctx->num_taxa && a < 3; a++) {
+            int next = *(tree->adjacent + 3 * node + a);
+            if (next != *(tree->from + node)) {
+                *(tree->from + next) = node;
+                *(order + length++) = next;
+            }
+        }
+    }
+    int next_number = ctx->num_taxa;
+    for (int node = 0; node < ctx->num_taxa; node++)
+        *(number + node) = node;
+    for (int k = length - 1; k >= 0; k--) {
+        if (*(order + k) >= ctx->num_taxa)
+            *(number + *(order + k)) = next_number++;
+    }
+
+    if (name_internal_nodes())
+        return -1;
+    for (int node = 0; node < total; node++)
+        memset((ctx->nodes + node)->neighbors, 0, sizeof((ctx->nodes + node)->neighbors));
+    // each node points at the one it was reached from, and taxon 0 and the
+    // node it hangs off at each other
+    for (int node = 0; node < total; node++) {
+        int w = *(number + node);
+        (ctx->nodes + w)->name = *(ctx->node_names + w);
+        for (int a = 0; a < *(tree->degree + node); a++) {
+            int next = *(tree->adjacent + 3 * node + a);
+            if (next != *(tree->from + node) && !(node == 0 && next == top))
+                continue;
+            *((ctx->nodes + w)->neighbors + 0) = ctx->nodes + *(number + next);
+            *(ctx->edge_lengths + w) = *(tree->lengths + 3 * node + a);
+            if (node == 0 || next == 0)
+                continue;
+            NODE *up = ctx->nodes + *(number + next);
+            *(up->neighbors + (*(up->neighbors + 1) == NULL ? 1 : 2)) = ctx->nodes + w;
+        }
+    }
+    ctx->num_all_nodes = total;
+
+    if (out == NULL)
+        return 0;
+    for (int w = ctx->num_taxa; w < total; w++) {
+        for (int c = 1; c < 3; c++) {
+            int child = *((ctx->nodes + w)->neighbors + c) - ctx->nodes;
+            ctx->stats.bytes_written += fprintf(out, "%d,%d,%.2f\n", child, w, *(ctx->edge_lengths + child));
+        }
+    }
+    ctx->stats.bytes_written += fprintf(out, "%d,%d,%.2f\n", 0, total - 1, *ctx->edge_lengths);
+    return 0;
+}
+
+/*
+ * Build the tree of the matrix of the current context again, in a context
+ * of its own, and report the number of splits in which it differs from the
+ * tree of the current context.  The matrix is copied a row at a time.
+ */
+static int rebuild_check(void) {
+    PHILO_CONTEXT *context = current_context;
+    PHILO_CONTEXT *rebuild = philo_create();
+    double *row = malloc(context->num_taxa * sizeof(double));
+    int taxa = context->num_taxa;
+    int ret = -1;
+    if (rebuild != NULL && row != NULL) {
+        philo_set_options(rebuild, context->global_options & (RAPID_OPTION | RELAXED_OPTION | FLOAT32_OPTION), NULL,
+                          context->num_threads);
+        if (philo_set_matrix_file(rebuild, context->matrix_file) == 0) {
+            current_context = rebuild;
+            ret = grow_node_tables(2 * taxa - 2) || grow_distance_matrix(taxa) ? -1 : 0;
+        }
+        for (int i = 0; ret == 0 && i < taxa; i++) {
+            current_context = context;
+            for (int j = 0; j <= i; j++)
+                *(row + j) = get_distance(i, j);
+            current_context = rebuild;
+            for (int j = 0; j <= i; j++)
+                set_distance(i, j, *(row + j));
+        }
+        if (ret == 0) {
+            init_leaves(taxa);
+            ret = build_taxonomy(NULL);
+        }
+    }
+    current_context = context;
+
+    int distance = -1;
+    if (ret)
+        fprintf(stderr, "rebuild check: cannot build the tree again\n");
+    else if ((distance = split_distance(context, rebuild)) < 0)
+        fprintf(stderr, "rebuild check: out of memory\n");
+    else
+        fprintf(stderr, "rebuild check: %d of the %d splits differ from those of a full rebuild\n",
+                (distance + 1) / 2, taxa - 3);
+    philo_destroy(rebuild);
+    free(row);
+    return distance >= 0 ? 0 : -1;
+}
+
+int run_insert(const char *tree_file, FILE *in, FILE *out) {
+    PHILO_CONTEXT *saved = current_context;
+    PHILO_CONTEXT *context = philo_create();
+    if (context == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+    philo_set_options(context, saved->global_options, saved->outlier_name, saved->num_threads);
+    if (philo_set_matrix_file(context, saved->matrix_file) || philo_read(context, in)) {
+        philo_destroy(context);
+        return -1;
+    }
+
+    current_context = context;
+    int total = 2 * context->num_taxa - 2;
+    INSERT_TREE tree;
+    memset(&tree, 0, sizeof(INSERT_TREE));
+    tree.degree = calloc(total, sizeof(int));
+    tree.adjacent = malloc(3 * total * sizeof(int));
+    tree.lengths = malloc(3 * total * sizeof(double));
+    tree.free_nodes = malloc(total * sizeof(int));
+    tree.mark = malloc(total * sizeof(int));
+    tree.region_index = malloc(total * sizeof(int));
+    tree.stack = malloc(3 * total * sizeof(int));             // room for the walk of a bad tree file
+    tree.from = malloc(total * sizeof(int));
+    tree.depth = malloc(total * sizeof(double));
+    PHILO_CONTEXT *local = philo_create();
+
+    int ret = -1;
+    if (tree.degree == NULL || tree.adjacent == NULL || tree.lengths == NULL || tree.free_nodes == NULL
+        || tree.mark == NULL || tree.region_index == NULL || tree.stack == NULL || tree.from == NULL
+        || tree.depth == NULL || local == NULL)
+        fprintf(stderr, "out of memory\n");
+    else if (context->num_taxa < 3)
+        fprintf(stderr, "too few taxa to insert into a tree\n");
+    else if (read_tree(&tree, tree_file) == 0) {
+        // the local context is sized once for the largest join
+        current_context = local;
+        ret = grow_node_tables(2 * MAX_UNITS) || grow_distance_matrix(MAX_UNITS + 1) ? -1 : 0;
+        current_context = context;
+        if (ret)
+            fprintf(stderr, "out of memory\n");
+        for (int node = 0; node < total; node++)
+            *(tree.mark + node) = -1;
+
+        int inserted = context->num_taxa - tree.taxa;
+        PHASE_CLOCK clock;
+        stats_start(&clock);
+        while (ret == 0 && tree.taxa < context->num_taxa)
+            ret = place_taxon(&tree, local);
+        stats_stop(&clock, &context->stats.update);
+        debug("%d taxa inserted", inserted);
+    }
+
+    if (ret == 0) {
+        PHASE_CLOCK clock;
+        stats_start(&clock);
+        ret = adopt_tree(&tree, context->global_options & NEWICK_OPTION ? NULL : out);
+        if (ret == 0 && (context->global_options & NEWICK_OPTION)) {
+            if (context->outlier_name == NULL)
+                find_default_outlier();
+            ret = emit_newick_format(out);
+        }
+        stats_stop(&clock, &context->stats.output);
+    }
+    if (ret == 0 && (context->global_options & REBUILD_CHECK_OPTION))
+        ret = rebuild_check();
+    if (context->global_options & STATS_OPTION)
+        stats_report(stderr);
+
+    current_context = saved;
+    free_tree(&tree);
+    philo_destroy(local);
+    philo_destroy(context);
+    return ret;
+}
@@ -0,0 +1,151 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "context.h"
+#include "debug.h"
+#include "philo.h"
+#include "checkpoint.h"
+
+/*
+ * Entry points of the library (see philo.h).  Each one that does some work
+ * makes the given context the current one for the calling thread, calls
+ * the function of the program that does it, and puts the previous context
+ * back.
+ * philo_create(), philo_reset() and philo_destroy() are in philo.c.
+ */
+
+static PHILO_CONTEXT *enter(PHILO_CONTEXT *context) {
+    PHILO_CONTEXT *saved = current_context;
+    current_context = context;
+    return saved;
+}
+
+void philo_set_options(PHILO_CONTEXT *context, long options, const char *outlier, int threads) {
+    context->global_options = options;
+    free(context->outlier_name);
+    context->outlier_name = outlier != NULL ? strdup(outlier) : NULL;
+    context->num_threads = threads < 1 ? 1 : threads > MAX_THREADS ? MAX_THREADS : threads;
+}
+
+int philo_set_matrix_file(PHILO_CONTEXT *context, const char *path) {
+    char *copy = NULL;
+    if (path != NULL && (copy = strdup(path)) == NULL)
+        return -1;
+    free(context->matrix_file);
+    context->matrix_file = copy;
+    return 0;
+}
+
+int philo_set_checkpoint(PHILO_CONTEXT *context, const char *path, int interval) {
+    char *copy = NULL;
+    if (path != NULL && (copy = strdup(path)) == NULL)
+        return -1;
+    free(context->checkpoint_file);
+    context->checkpoint_file = copy;
+    context->checkpoint_interval = interval < 0 ? 0 : interval;
+    return 0;
+}
+
+void philo_set_messages(PHILO_CONTEXT *context, FILE *messages) {
+    context->messages = messages;
+}
+
+int philo_read(PHILO_CONTEXT *context, FILE *in) {
+    philo_reset(context);
+    PHILO_CONTEXT *saved = enter(context);
+    PHASE_CLOCK clock;
+    stats_start(&clock);
+    int ret = read_distance_data(in);
+    stats_stop(&clock, &context->stats.read);
+    current_context = saved;
+    return ret;
+}
+
+/* The checkpoint is read in the read phase, in place of the input. */
+int philo_resume(PHILO_CONTEXT *context) {
+    philo_reset(context);
+    PHILO_CONTEXT *saved = enter(context);
+    PHASE_CLOCK clock;
+    stats_start(&clock);
+    int ret = context->checkpoint_file != NULL ? read_checkpoint() : 1;
+    stats_stop(&clock, &context->stats.read);
+    current_context = saved;
+    return ret;
+}
+
+/* build_taxonomy() times its searches itself; the rest of the build is the update phase. */
+int philo_build(PHILO_CONTEXT *context, FILE *out) {
+    PHILO_CONTEXT *saved = enter(context);
+    PHASE_TIME search = context->stats.search;
+    PHASE_TIME build = { 0.0, 0.0 };
+    PHASE_CLOCK clock;
+    stats_start(&clock);
+    int ret = build_taxonomy(out);
+    stats_stop(&clock, &build);
+    context->stats.update.wall += build.wall - (context->stats.search.wall - search.wall);
+    context->stats.update.cpu += build.cpu - (context->stats.search.cpu - search.cpu);
+    current_context = saved;
+    return ret;
+}
+
+int philo_passes(PHILO_CONTEXT *context) {
+    return context->num_passes;
+}
+
+void philo_stats(PHILO_CONTEXT *context, FILE *out) {
+    PHILO_CONTEXT *saved = enter(context);
+    stats_report(out);
+    current_context = saved;
+}
+
+int philo_emit_newick(PHILO_CONTEXT *context, FILE *out) {
+    PHILO_CONTEXT *saved = enter(context);
+    PHASE_CLOCK clock;
+    stats_start(&clock);
+    int ret = emit_newick_format(out);
+    stats_stop(&clock, &context->stats.output);
+    current_context = saved;
+    return ret;
+}
+
+int philo_emit_matrix(PHILO_CONTEXT *context, FILE *out) {
+    PHILO_CONTEXT *saved = enter(context);
+    PHASE_CLOCK clock;
+    stats_start(&clock);
+    int ret = emit_distance_matrix(out);
+    stats_stop(&clock, &context->stats.output);
+    current_context = saved;
+    return ret;
+}
+
+int philo_emit_binary(PHILO_CONTEXT *context, FILE *out) {
+    PHILO_CONTEXT *saved = enter(context);
+    PHASE_CLOCK clock;
+    stats_start(&clock);
+    int ret = emit_binary_matrix(out);
+    stats_stop(&clock, &context->stats.output);
+    current_context = saved;
+    return ret;
+}
+
+int philo_run(PHILO_CONTEXT *context, FILE *in, FILE *out) {
+    long options = context->global_options;
+    FILE *messages = context->messages != NULL ? context->messages : stderr;
+    int ret = (options & PHILO_RESUME) && !(options & PHILO_CONVERT) ? philo_resume(context) : 1;
+    if (ret > 0)                                                // no checkpoint to resume from
+        ret = philo_read(context, in);
+    if (ret == 0 && (options & PHILO_CONVERT))
+        ret = philo_emit_binary(context, out);
+    else if (ret == 0) {
+        ret = philo_build(context, out);
+        if (ret == 0 && (options & PHILO_RELAXED))
+            fprintf(messages, "relaxed joining: %d passes over the matrix\n", philo_passes(context));
+        if (ret == 0 && (options & PHILO_NEWICK))
+            ret = philo_emit_newick(context, out);
+        else if (ret == 0 && (options & PHILO_MATRIX))
+            ret = philo_emit_matrix(context, out);
+    }
+    if (options & PHILO_STATS)
+        philo_stats(context, messages);
+    return ret;
+}
@@ -3,33 +3,38 @@
 
 #include "global.h"
 #include "debug.h"
+#include "options.h"
+#include "philo.h"
+#include "batch.h"
+#include "bootstrap.h"
+#include "insert.h"
 
 int main(int argc, char **argv)
 {
     if(validargs(argc, argv))
-        USAGE(*argv, EXIT_FAILURE);
+        PROGRAM_USAGE(*argv, EXIT_FAILURE);
     if(global_options == HELP_OPTION)
-        USAGE(*argv, EXIT_SUCCESS);
-    // TO BE IMPLEMENTED
-    if (global_options & 2)
-        if(read_distance_data(stdin) == 0)
-            if (build_taxonomy(stdout) == 0)
-                if (emit_newick_format(stdout) == 0)
-                    return EXIT_SUCCESS;
+        PROGRAM_USAGE(*argv, EXIT_SUCCESS);
 
-    if (global_options & 4)
-        if(read_distance_data(stdin) == 0)
-            if (build_taxonomy(stdout) == 0)
-                if (emit_distance_matrix(stdout) == 0)
-                    return EXIT_SUCCESS;
+    if (global_options & (BATCH_OPTION | STREAM_OPTION))
+        return run_batch(batch_manifest, stdin, stdout) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (global_options & BOOTSTRAP_OPTION)
+        return run_bootstrap(bootstrap_replicates, stdin, stdout) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (global_options & INSERT_OPTION)
+        return run_insert(insert_tree, stdin, stdout) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 
-    if (global_options == 0)
-        if (read_distance_data(stdin) == 0)
-            if(build_taxonomy(stdout) == 0)
-                return EXIT_SUCCESS;
-
-    // printf("I failed :( \n");
-    return EXIT_FAILURE;
+    PHILO_CONTEXT *context = philo_create();
+    if (context == NULL)
+        return EXIT_FAILURE;
+    philo_set_options(context, global_options, outlier_name, thread_count);
+    if (philo_set_matrix_file(context, matrix_path)
+        || philo_set_checkpoint(context, checkpoint_path, checkpoint_seconds)) {
+        philo_destroy(context);
+        return EXIT_FAILURE;
+    }
+    int ret = philo_run(context, stdin, stdout);
+    philo_destroy(context);
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 /*
@@ -1,7 +1,696 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
-#include "global.h"
+#include "context.h"
 #include "debug.h"
+#include "qsearch.h"
+#include "csvread.h"
+#include "binmatrix.h"
+#include "checkpoint.h"
+#include "placement.h"
+
+/*
+ * The context of the runs of the thread (see context.h).  The context of
+ * a plain run of the program is default_context.
+ */
+static PHILO_CONTEXT default_context = { 1 };              // num_threads
+__thread PHILO_CONTEXT *current_context = &default_context;
+
+/*
+ * The blocks of the arena of the node names (see add_name()).  A run
+ * starts over at the start of the block being filled, and lets the others
+ * go.
+ */
+#define NAME_BLOCK_SIZE (1 << 16)
+
+typedef struct name_block {
+    struct name_block *next;                            /* the block filled before this one */
+    char data[NAME_BLOCK_SIZE];
+} NAME_BLOCK;
+
+FILE *message_stream(void) {
+    PHILO_CONTEXT *ctx = current_context;
+    return ctx->messages != NULL ? ctx->messages : stderr;
+}
+
+/*
+ * Contexts of the library (see philo.h).  philo_reset() only clears the
+ * tables, so that the next run can fill them in again as read_distance_data()
+ * expects of fresh ones, and leaves the matrix on the heap to be reused;
+ * only a matrix in a mapping, of a binary input, of the matrix file or of
+ * huge pages, is let go.
+ */
+PHILO_CONTEXT *philo_create(void) {
+    PHILO_CONTEXT *context = malloc(sizeof(PHILO_CONTEXT));
+    if (context != NULL)
+        *context = (PHILO_CONTEXT){ 1 };                        // num_threads
+    return context;
+}
+
+void philo_reset(PHILO_CONTEXT *context) {
+    PHILO_CONTEXT *ctx = context;
+    if (ctx->matrix_mapping != NULL) {
+        munmap(ctx->matrix_mapping, ctx->matrix_mapping_length);
+        ctx->matrix_mapping = NULL;
+        ctx->distances = NULL;
+        ctx->float_distances = NULL;
+        ctx->matrix_capacity = 0;
+    }
+    free(ctx->node_distances);
+    ctx->node_distances = NULL;
+    while (ctx->name_blocks != NULL && ctx->name_blocks->next != NULL) {
+        NAME_BLOCK *next = ctx->name_blocks->next;
+        ctx->name_blocks->next = next->next;
+        free(next);
+    }
+    ctx->name_block_used = 0;
+    if (ctx->node_capacity > 0) {
+        memset(ctx->node_names, 0, ctx->node_capacity * sizeof(*ctx->node_names));
+        memset(ctx->nodes, 0, ctx->node_capacity * sizeof(NODE));
+        memset(ctx->row_sums, 0, ctx->node_capacity * sizeof(double));
+        memset(ctx->edge_lengths, 0, ctx->node_capacity * sizeof(double));
+        memset(ctx->active_node_map, 0, (ctx->node_capacity + 1) * sizeof(int));
+    }
+    ctx->num_taxa = 0;
+    ctx->num_all_nodes = 0;
+    ctx->num_active_nodes = 0;
+    ctx->default_outlier = 0;
+    memset(&ctx->stats, 0, sizeof(RUN_STATS));
+}
+
+void philo_destroy(PHILO_CONTEXT *context) {
+    if (context == NULL)
+        return;
+    philo_reset(context);
+
+    PHILO_CONTEXT *ctx = context;
+    free(ctx->distances);
+    free(ctx->float_distances);
+    free(ctx->node_names);
+    free(ctx->nodes);
+    free(ctx->row_sums);
+    free(ctx->edge_lengths);
+    free(ctx->active_node_map);
+    free(ctx->outlier_name);
+    free(ctx->matrix_file);
+    free(ctx->checkpoint_file);
+    free(ctx->name_blocks);                                     // philo_reset() left only one
+    free(ctx->name_index);
+    free(context);
+}
+
+/**
+ * @brief  Grow the per-node tables to hold at least the given number of nodes.
+ * @details  The node_names, nodes, row_sums, edge_lengths and active_node_map tables are
+ * reallocated, preserving their contents and zero-filling the new entries.
+ * Capacity grows geometrically, so that calling this once per taxon name
+ * while reading the header line costs amortized constant time.
+ * Pointers from NODE structures to other NODE structures are only set up
+ * after the tables have reached their final size, so the tables may move
+ * freely while they are being grown.  The names themselves are in the
+ * name arena, which does not move.
+ *
+ * @param capacity  The minimum number of nodes that the tables must hold.
+ * @return 0 if successful, -1 if memory could not be allocated.
+ */
+int grow_node_tables(int capacity) {
+    PHILO_CONTEXT *ctx = current_context;
+    if (capacity <= ctx->node_capacity)
+        return 0;
+
+    int new_capacity = ctx->node_capacity ? ctx->node_capacity : 16;
+    while (new_capacity < capacity)
+        new_capacity *= 2;
+
+    char **new_names = realloc(ctx->node_names, new_capacity * sizeof(*ctx->node_names));
+    if (new_names == NULL)
+        return -1;
+    ctx->node_names = new_names;
+
+    NODE *new_nodes = realloc(ctx->nodes, new_capacity * sizeof(NODE));
+    if (new_nodes == NULL)
+        return -1;
+    ctx->nodes = new_nodes;
+
+    double *new_sums = realloc(ctx->row_sums, new_capacity * sizeof(double));
+    if (new_sums == NULL)
+        return -1;
+    ctx->row_sums = new_sums;
+
+    double *new_lengths = realloc(ctx->edge_lengths, new_capacity * sizeof(double));
+    if (new_lengths == NULL)
+        return -1;
+    ctx->edge_lengths = new_lengths;
+
+    int *new_map = realloc(ctx->active_node_map, (new_capacity + 1) * sizeof(int));
+    if (new_map == NULL)
+        return -1;
+    ctx->active_node_map = new_map;
+
+    int added = new_capacity - ctx->node_capacity;
+    memset(ctx->node_names + ctx->node_capacity, 0, added * sizeof(*ctx->node_names));
+    memset(ctx->nodes + ctx->node_capacity, 0, added * sizeof(NODE));
+    memset(ctx->row_sums + ctx->node_capacity, 0, added * sizeof(double));
+    memset(ctx->edge_lengths + ctx->node_capacity, 0, added * sizeof(double));
+    memset(ctx->active_node_map + ctx->node_capacity, 0, (added + 1) * sizeof(int));
+    ctx->node_capacity = new_capacity;
+    return 0;
+}
+
+/*
+ * Names are copied into the blocks one after the other, with their null
+ * characters, and a new block is started when one is full.  Blocks are
+ * never moved or freed during a run, so node_names and the nodes can point
+ * at the names while more are added.  A name is at most INPUT_MAX
+ * characters, so it always fits in a block.
+ */
+
+/* Copy a name of the given length into the arena.  Returns the copy, or NULL if out of memory. */
+static char *add_name(const char *name, size_t length) {
+    PHILO_CONTEXT *ctx = current_context;
+    if (ctx->name_blocks == NULL || ctx->name_block_used + length + 1 > NAME_BLOCK_SIZE) {
+        NAME_BLOCK *block = malloc(sizeof(NAME_BLOCK));
+        if (block == NULL)
+            return NULL;
+        block->next = ctx->name_blocks;
+        ctx->name_blocks = block;
+        ctx->name_block_used = 0;
+    }
+    char *copy = ctx->name_blocks->data + ctx->name_block_used;
+    memcpy(copy, name, length);
+    *(copy + length) = '\0';
+    ctx->name_block_used += length + 1;
+    return copy;
+}
+
+/* FNV-1a hash of a name. */
+static unsigned hash_name(const char *name) {
+    unsigned h = 2166136261u;
+    while (*name != '\0')
+        h = (h ^ (unsigned char)*name++) * 16777619u;
+    return h;
+}
+
+/*
+ * Index the names of the first count nodes, the taxa, in name_index, at
+ * most half full.  *duplicate is set to the first taxon whose name is that
+ * of an earlier one, or -1 if the names are distinct; only the first of
+ * two taxa with the same name is indexed.  Returns -1 if out of memory.
+ */
+static int index_names(int count, int *duplicate) {
+    PHILO_CONTEXT *ctx = current_context;
+    int slots = 16;
+    while (slots < 2 * count)
+        slots *= 2;
+    if (slots > ctx->name_index_mask + 1) {
+        free(ctx->name_index);
+        ctx->name_index = malloc(slots * sizeof(int));
+        ctx->name_index_mask = ctx->name_index != NULL ? slots - 1 : -1;
+        if (ctx->name_index == NULL)
+            return -1;
+    }
+    memset(ctx->name_index, -1, (ctx->name_index_mask + 1) * sizeof(int));
+
+    *duplicate = -1;
+    for (int i = 0; i < count; i++) {
+        int slot = (int)(hash_name(*(ctx->node_names + i)) & ctx->name_index_mask);
+        while (*(ctx->name_index + slot) >= 0
+               && strcmp(*(ctx->node_names + *(ctx->name_index + slot)), *(ctx->node_names + i)) != 0)
+            slot = (slot + 1) & ctx->name_index_mask;
+        if (*(ctx->name_index + slot) < 0)
+            *(ctx->name_index + slot) = i;
+        else if (*duplicate < 0)
+            *duplicate = i;
+    }
+    return 0;
+}
+
+/* The taxon with the given name, or -1 if there is none. */
+static int find_taxon(const char *name) {
+    PHILO_CONTEXT *ctx = current_context;
+    if (ctx->name_index == NULL || ctx->num_taxa == 0)
+        return -1;
+    int slot = (int)(hash_name(name) & ctx->name_index_mask);
+    while (*(ctx->name_index + slot) >= 0) {
+        if (strcmp(*(ctx->node_names + *(ctx->name_index + slot)), name) == 0)
+            return *(ctx->name_index + slot);
+        slot = (slot + 1) & ctx->name_index_mask;
+    }
+    return -1;
+}
+
+int set_taxon_names(const char *names, int count) {
+    PHILO_CONTEXT *ctx = current_context;
+    int duplicate;
+    for (int i = 0; i < count; i++) {
+        size_t length = strlen(names);
+        if ((*(ctx->node_names + i) = add_name(names, length)) == NULL)
+            return -1;
+        names += length + 1;
+    }
+    if (index_names(count, &duplicate))
+        return -1;
+    return duplicate >= 0 ? duplicate : count;
+}
+
+int name_internal_nodes(void) {
+    PHILO_CONTEXT *ctx = current_context;
+    char name[16];
+    for (int node = ctx->num_taxa; node < 2 * ctx->num_taxa - 2; node++) {
+        int length = snprintf(name, sizeof(name), "#%d", node);
+        if ((*(ctx->node_names + node) = add_name(name, length)) == NULL)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * Copy the matrix in use into map, which holds capacity rows, free or unmap
+ * the old storage, and make map the matrix.
+ */
+static void adopt_matrix_mapping(char *map, size_t length, int capacity) {
+    PHILO_CONTEXT *ctx = current_context;
+    int f32 = (ctx->global_options & FLOAT32_OPTION) != 0;
+    size_t precision = f32 ? sizeof(float) : sizeof(double);
+    void *old = f32 ? (void *)ctx->float_distances : (void *)ctx->distances;
+    if (old != NULL && ctx->matrix_capacity > 0) {
+        int rows = ctx->matrix_capacity < capacity ? ctx->matrix_capacity : capacity;
+        memcpy(map, old, TRI_SIZE(rows) * precision);
+    }
+    if (ctx->matrix_mapping != NULL)
+        munmap(ctx->matrix_mapping, ctx->matrix_mapping_length);
+    else {
+        free(ctx->distances);
+        free(ctx->float_distances);
+    }
+    ctx->distances = f32 ? NULL : (double *)map;
+    ctx->float_distances = f32 ? (float *)map : NULL;
+    ctx->matrix_mapping = map;
+    ctx->matrix_mapping_length = length;
+    ctx->matrix_capacity = capacity;
+}
+
+/*
+ * Grow the matrix into a new file at matrix_file, mapped shared so that
+ * its pages are written back to the file rather than to swap, and removed
+ * as soon as it is mapped.  The blocks of the file are allocated up front,
+ * so that a full disk is reported here instead of faulting on a write to
+ * the mapping later.  The entries of the matrix in use, on the heap or in
+ * another mapping, are copied in; the rest of the file reads as zeros.
+ * Sets errno and returns -1 on failure.
+ */
+static int grow_file_matrix(int capacity) {
+    PHILO_CONTEXT *ctx = current_context;
+    int f32 = (ctx->global_options & FLOAT32_OPTION) != 0;
+    if (ctx->matrix_mapping != NULL && (f32 ? ctx->float_distances : (void *)ctx->distances) != NULL
+        && capacity <= ctx->matrix_capacity)
+        return 0;
+
+    size_t precision = f32 ? sizeof(float) : sizeof(double);
+    size_t length = TRI_SIZE(capacity) * precision;
+    int fd = open(ctx->matrix_file, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return -1;
+    int error = posix_fallocate(fd, 0, length);
+    char *map = MAP_FAILED;
+    if (error == 0) {
+        map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+            error = errno;
+    }
+    close(fd);
+    unlink(ctx->matrix_file);
+    if (map == MAP_FAILED) {
+        errno = error;
+        return -1;
+    }
+    madvise(map, length, MADV_SEQUENTIAL);
+    adopt_matrix_mapping(map, length, capacity);
+    ctx->matrix_alloc = ALLOC_FILE;
+    ctx->matrix_nodes = 1;
+    return 0;
+}
+
+/* Size of the huge pages --huge-pages asks for, and aligns the matrix to. */
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+/*
+ * Map an anonymous block of at least *length bytes: of explicit huge pages
+ * if enough of them have been reserved (vm.nr_hugepages), else of
+ * transparent huge pages, or else of plain pages if those cannot be had
+ * either.  *length is rounded up to a whole number of huge pages, and the
+ * block starts on a huge page boundary.  *mode is set to the ALLOC_ mode
+ * of the block.  Returns MAP_FAILED on failure.
+ */
+static char *map_huge_pages(size_t *length, int *mode) {
+    size_t rounded = (*length + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    *length = rounded;
+    char *map = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (map != MAP_FAILED) {
+        *mode = ALLOC_HUGETLB;
+        return map;
+    }
+
+    // one huge page more than needed, trimmed to huge page boundaries at both ends
+    char *block = mmap(NULL, rounded + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (block == MAP_FAILED)
+        return MAP_FAILED;
+    size_t head = (HUGE_PAGE_SIZE - (uintptr_t)block % HUGE_PAGE_SIZE) % HUGE_PAGE_SIZE;
+    if (head > 0)
+        munmap(block, head);
+    munmap(block + head + rounded, HUGE_PAGE_SIZE - head);
+    map = block + head;
+    *mode = madvise(map, rounded, MADV_HUGEPAGE) == 0 ? ALLOC_THP : ALLOC_PAGES;
+    return map;
+}
+
+/*
+ * Grow the matrix into a new anonymous mapping of huge pages (--huge-pages).
+ * Its pages are untouched, so with several threads they are first touched
+ * on the NUMA nodes of the first search bands (see placement.h) before the
+ * entries of the matrix in use are copied in.  Returns -1 on failure.
+ */
+static int grow_huge_matrix(int capacity) {
+    PHILO_CONTEXT *ctx = current_context;
+    int f32 = (ctx->global_options & FLOAT32_OPTION) != 0;
+    if (ctx->matrix_mapping != NULL && (f32 ? ctx->float_distances : (void *)ctx->distances) != NULL
+        && capacity <= ctx->matrix_capacity)
+        return 0;
+
+    size_t precision = f32 ? sizeof(float) : sizeof(double);
+    size_t length = TRI_SIZE(capacity) * precision;
+    int mode;
+    char *map = map_huge_pages(&length, &mode);
+    if (map == MAP_FAILED)
+        return -1;
+    int placed = placement_first_touch(map, precision, capacity, ctx->num_threads);
+    adopt_matrix_mapping(map, length, capacity);
+    ctx->matrix_alloc = mode;
+    ctx->matrix_nodes = placed;
+    debug("matrix of %d rows in mode %d, placed on %d nodes", capacity, mode, placed);
+    return 0;
+}
+
+/**
+ * @brief  Grow the distance matrix to at least capacity x capacity entries.
+ * @details  The matrix is kept packed (see tri_entry() in context.h), so
+ * growing it only adds rows at the end of the block and the existing entries
+ * stay where they are.  With --float32 the matrix is kept in
+ * float_distances instead.  Unlike the node tables, the matrix is grown to
+ * exactly the requested size, because it is normally sized only once, as
+ * soon as the number of taxa is known.  New entries are zero-filled.
+ * A matrix that lies in the mapping of a binary input is first copied to
+ * the heap, and one of the other precision, left by an earlier run of the
+ * context, is dropped.
+ *
+ * With --matrix-file, the matrix is kept in a file instead (see
+ * grow_file_matrix()), and with --huge-pages in huge pages (see
+ * grow_huge_matrix()).
+ *
+ * @param capacity  The minimum number of rows and columns.
+ * @return 0 if successful, -1 if memory (or the file) could not be allocated.
+ */
+int grow_distance_matrix(int capacity) {
+    PHILO_CONTEXT *ctx = current_context;
+    if (ctx->matrix_file != NULL)
+        return grow_file_matrix(capacity);
+    if (ctx->global_options & HUGE_PAGES_OPTION)
+        return grow_huge_matrix(capacity);
+    if (ctx->matrix_mapping == NULL
+        && ((ctx->global_options & FLOAT32_OPTION) ? ctx->distances != NULL : ctx->float_distances != NULL)) {
+        free(ctx->distances);
+        free(ctx->float_distances);
+        ctx->distances = NULL;
+        ctx->float_distances = NULL;
+        ctx->matrix_capacity = 0;
+    }
+    if (capacity <= ctx->matrix_capacity)
+        return 0;
+
+    size_t old_size = TRI_SIZE(ctx->matrix_capacity);
+    size_t new_size = TRI_SIZE(capacity);
+    if (ctx->global_options & FLOAT32_OPTION) {
+        float *block = realloc(ctx->matrix_mapping ? NULL : ctx->float_distances, new_size * sizeof(float));
+        if (block == NULL)
+            return -1;
+        if (ctx->matrix_mapping)
+            memcpy(block, ctx->float_distances, old_size * sizeof(float));
+        memset(block + old_size, 0, (new_size - old_size) * sizeof(float));
+        ctx->float_distances = block;
+    }
+    else {
+        double *block = realloc(ctx->matrix_mapping ? NULL : ctx->distances, new_size * sizeof(double));
+        if (block == NULL)
+            return -1;
+        if (ctx->matrix_mapping)
+            memcpy(block, ctx->distances, old_size * sizeof(double));
+        memset(block + old_size, 0, (new_size - old_size) * sizeof(double));
+        ctx->distances = block;
+    }
+    if (ctx->matrix_mapping) {
+        munmap(ctx->matrix_mapping, ctx->matrix_mapping_length);
+        ctx->matrix_mapping = NULL;
+    }
+    ctx->matrix_capacity = capacity;
+    ctx->matrix_alloc = ALLOC_HEAP;
+    ctx->matrix_nodes = 1;
+    return 0;
+}
+
+/* Report that grow_distance_matrix() failed. */
+static void matrix_error(void) {
+    PHILO_CONTEXT *ctx = current_context;
+    if (ctx->matrix_file != NULL)
+        fprintf(message_stream(), "cannot make the matrix file %s: %s\n", ctx->matrix_file, strerror(errno));
+    else
+        fprintf(message_stream(), "out of memory\n");
+}
+
+/*
+ * Print a one-line message about an error in the input, at the given field
+ * (counted from 1) of the line last read, or about the whole line if field
+ * is 0.  Always returns -1.
+ */
+static int input_error(CSV_READER *reader, int field, char *message) {
+    if (field > 0)
+        fprintf(message_stream(), "line %ld, field %d: %s\n", reader->line, field, message);
+    else
+        fprintf(message_stream(), "line %ld: %s\n", reader->line, message);
+    return -1;
+}
+
+/* Get the next line that is not a comment.  Returns as csv_next_line() does. */
+static int next_data_line(CSV_READER *reader, char **line, size_t *length) {
+    int ret;
+    while ((ret = csv_next_line(reader, line, length)) == 1) {
+        if (*length == 0 || **line != '#')
+            break;
+    }
+    return ret;
+}
+
+/* Length of the field that starts at p, up to the next ',' or the end of the line. */
+static size_t field_length(char *p, char *end) {
+    char *comma = memchr(p, ',', end - p);
+    return (comma != NULL ? comma : end) - p;
+}
+
+/*
+ * Read the first data line and store the taxon names it lists.
+ * Returns the number of taxa, or -1 if there was an error.
+ */
+static int read_header(CSV_READER *reader) {
+    PHILO_CONTEXT *ctx = current_context;
+    char *line;
+    size_t length;
+    int ret = next_data_line(reader, &line, &length);
+    if (ret < 0)
+        return input_error(reader, 0, "cannot read the input");
+    if (ret == 0) {
+        reader->line++;                                         // report the missing line
+        return input_error(reader, 0, "no data in the input");
+    }
+    if (length == 0 || *line != ',')
+        return input_error(reader, 1, "the first field of the first line must be empty");
+
+    char *p = line + 1;
+    char *end = line + length;
+    int count = 0;
+    while (1) {
+        size_t len = field_length(p, end);
+        if (len == 0)
+            return input_error(reader, count + 2, "empty taxon name");
+        if (len > INPUT_MAX)
+            return input_error(reader, count + 2, "taxon name is too long");
+        if (grow_node_tables(count + 1) || (*(ctx->node_names + count) = add_name(p, len)) == NULL)
+            return input_error(reader, 0, "out of memory");
+        count++;
+
+        p += len;
+        if (p == end)
+            break;
+        p++;                                                    // past the ','
+    }
+
+    int duplicate;
+    if (index_names(count, &duplicate))
+        return input_error(reader, 0, "out of memory");
+    if (duplicate >= 0)
+        return input_error(reader, duplicate + 2, "duplicate taxon name");
+    return count;
+}
+
+/*
+ * Read the count rows of distances.  Only the entries on and above the
+ * diagonal are stored; those below it are checked against them as they
+ * are read, and the diagonal is checked to be zero.
+ * Returns 0, or -1 if there was an error.
+ */
+static int read_rows(CSV_READER *reader, int count) {
+    PHILO_CONTEXT *ctx = current_context;
+    for (int row = 0; row < count; row++) {
+        char *line;
+        size_t length;
+        int ret = next_data_line(reader, &line, &length);
+        if (ret < 0)
+            return input_error(reader, 0, "cannot read the input");
+        if (ret == 0) {
+            reader->line++;                                     // report the missing line
+            return input_error(reader, 0, "premature end of input");
+        }
+
+        char *p = line;
+        char *end = line + length;
+        size_t len = field_length(p, end);
+        if (len != strlen(*(ctx->node_names + row)) || memcmp(p, *(ctx->node_names + row), len) != 0)
+            return input_error(reader, 1, "taxon name does not match the first line");
+        p += len;
+
+        for (int col = 0; col < count; col++) {
+            if (p == end)
+                return input_error(reader, col + 2, "too few fields");
+            p++;                                                // past the ','
+            len = field_length(p, end);
+
+            double dist;
+            if (len > INPUT_MAX || csv_parse_double(p, len, &dist))
+                return input_error(reader, col + 2, "not a number");
+            if (ctx->float_distances != NULL)
+                dist = (float)dist;                             // compared at the precision kept
+
+            if (col > row)
+                set_distance(row, col, dist);
+            else if (col == row) {
+                if (dist != 0.0)
+                    return input_error(reader, col + 2, "distance on the diagonal is not zero");
+                set_distance(row, col, dist);
+            }
+            else if (!(get_distance(row, col) == dist)) {
+                return input_error(reader, col + 2, "distances are not symmetric");
+            }
+            p += len;
+        }
+        if (p != end)
+            return input_error(reader, count + 2, "too many fields");
+    }
+    return 0;
+}
+
+/*
+ * Read a binary input (see binmatrix.h) and store its names and matrix.
+ * If the input is mapped and its matrix has the precision in use, the
+ * mapping is kept and the matrix is used where it lies, without a copy:
+ * pages are only read in as the matrix is used, and changes made by
+ * build_taxonomy() stay private to the process.  Otherwise the matrix is
+ * copied to the heap, converted between float and double if needed.  Only
+ * the diagonal is checked (to be zero); the matrix is symmetric by
+ * construction and the other entries are taken as they are.
+ * Returns the number of taxa, or -1 if there was an error.
+ */
+static int read_binary_data(CSV_READER *reader) {
+    PHILO_CONTEXT *ctx = current_context;
+    if (reader->map_length == 0 && csv_fill(reader, SIZE_MAX) == (size_t)-1) {
+        fprintf(message_stream(), "cannot read the input\n");
+        return -1;
+    }
+
+    BIN_MATRIX bin;
+    const char *error = bin_parse(reader->data + reader->pos, reader->size - reader->pos,
+                                  INPUT_MAX, &bin);
+    if (error != NULL) {
+        fprintf(message_stream(), "binary input: %s\n", error);
+        return -1;
+    }
+
+    int count = bin.count;
+    if (grow_node_tables(count > 2 ? 2 * count - 2 : count)) {
+        fprintf(message_stream(), "out of memory\n");
+        return -1;
+    }
+    int duplicate = set_taxon_names(bin.names, count);
+    if (duplicate < 0) {
+        fprintf(message_stream(), "out of memory\n");
+        return -1;
+    }
+    if (duplicate < count) {
+        fprintf(message_stream(), "binary input: duplicate taxon name %s\n", *(ctx->node_names + duplicate));
+        return -1;
+    }
+
+    int precision = (ctx->global_options & FLOAT32_OPTION) ? sizeof(float) : sizeof(double);
+    if (bin.precision == precision && ctx->matrix_capacity == 0 && (uintptr_t)bin.matrix % precision == 0
+        && ctx->matrix_file == NULL && !(ctx->global_options & HUGE_PAGES_OPTION)) {
+        size_t length;
+        char *map = csv_detach_mapping(reader, &length);
+        if (map != NULL) {
+            ctx->matrix_mapping = map;
+            ctx->matrix_mapping_length = length;
+            ctx->matrix_capacity = count;
+            ctx->matrix_alloc = ALLOC_INPUT;
+            ctx->matrix_nodes = 1;
+            if (precision == sizeof(float))
+                ctx->float_distances = (float *)bin.matrix;
+            else
+                ctx->distances = (double *)bin.matrix;
+        }
+    }
+    if (ctx->matrix_mapping == NULL) {
+        if (grow_distance_matrix(count)) {
+            matrix_error();
+            return -1;
+        }
+        size_t size = TRI_SIZE(count);
+        const float *floats = bin.matrix;
+        const double *doubles = bin.matrix;
+        if (bin.precision == precision)
+            memcpy(precision == sizeof(float) ? (void *)ctx->float_distances : (void *)ctx->distances,
+                   bin.matrix, size * precision);
+        else if (ctx->float_distances != NULL) {
+            for (size_t e = 0; e < size; e++)
+                *(ctx->float_distances + e) = *(doubles + e);
+        }
+        else {
+            for (size_t e = 0; e < size; e++)
+                *(ctx->distances + e) = *(floats + e);
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (get_distance(i, i) != 0.0) {
+            fprintf(message_stream(), "binary input: distance on the diagonal is not zero for %s\n",
+                    *(ctx->node_names + i));
+            return -1;
+        }
+    }
+    return count;
+}
 
 /**
  * @brief  Read genetic distance data and initialize data structures.
@@ -33,11 +722,14 @@
  * If 0 is returned, indicating data successfully read, then upon return
  * the following global variables and data structures have been set:
  *   num_taxa - set to the number N of taxa, determined from the first data line
+ *   node_capacity - the node tables have been allocated to hold the 2*N-2
+ *     nodes (leaf + internal) the algorithm will need
  *   num_all_nodes - initialized to be equal to num_taxa
  *   num_active_nodes - initialized to be equal to num_taxa
  *   node_names - the first N entries contain the N taxa names, as C strings
- *   distances - initialized to an NxN matrix of distance values, where each
+ *   distances - initialized to the NxN matrix of distance values, where each
  *     row of the matrix contains the distance data from one of the data lines
+ *     (stored packed, see tri_entry() in context.h)
  *   nodes - the "name" fields of the first N entries have been initialized
  *     with pointers to the corresponding taxa names stored in the node_names
  *     array.
@@ -49,296 +741,74 @@
  * if there was any error.  Premature termination of the input data,
  * failure of each line to have the same number of fields, and distance
  * fields that are not in numeric format should cause a one-line error
- * message to be printed to stderr and -1 to be returned.
+ * message to be printed to stderr and -1 to be returned.  The message gives
+ * the line (counting comment lines) and the field, counted from 1, at
+ * which the error was found.
+ *
+ * The input is read through a CSV_READER (see csvread.h), which maps it
+ * into memory when it is a regular file and reads it in large blocks
+ * otherwise, and numbers are converted by csv_parse_double().  With -j,
+ * the rows of a large mapped input are parsed on several threads; if that
+ * finds anything wrong, they are read again serially to report the error.
+ * With --matrix-file, a mapped input is always parsed that way, even on one
+ * thread, because each row then only writes its own packed row, and so the
+ * matrix file is written in order.
+ *
+ * Instead of CSV, the input may be in the binary form written by -c (see
+ * binmatrix.h), which is recognized by its first bytes.  Its matrix is
+ * used without any parsing, and in place when the input can be mapped
+ * (but copied with --matrix-file, since the run overwrites it, and with
+ * --huge-pages).
  */
 
-void clean_buffer(char* buffer, int size) {
-    for (int i = 0; i < size; i++) {
-        *(buffer + i) = 0;
-    }
-}
-
-double char_to_number(char* input_buffer, int size, int deci_size) {
-    int count = 0;
-    int flo = size;
-    double power = 1.0;
-    double decimal = 1.0;
-    double value = 0.0;
-    double final = 0.0;
-    int temp = size;
-    int i = 0;
-
-    //printf("number size: %d \n", size);
-    while (*(input_buffer+i) != '\0') {
-        //printf("content of buffer: %c \n", *(input_buffer+i));
-        //printf("next content of buffer: %d \n", *(input_buffer+i+1));
-        temp = temp-1;
-        count++;
-
-        if (*(input_buffer+i) == '.') {
-            //printf("period section \n");
-            flo = flo - count;
-            i++;
-            continue;
-        }
-
-        if (*(input_buffer+i) < '0' || *(input_buffer+i) > '9'){
-            //printf("it is not number \n");
-            return -1;
-        }
-
-        if (flo != size) {
-            //printf("decimal section \n");
-            decimal = decimal * 0.1;
-            value = *(input_buffer+i) - '0';
-            value = value * decimal;
-            i++;
-        }
-        else {
-            if (temp == 0) {
-                //printf("single digit \n");
-                value = *(input_buffer+i) - '0';
-                i++;
-            }
-
-            else {
-                //printf("more than single digit and temp value is %d \n", temp);
-                int j = count;
-                if (deci_size == 1)
-                    value = *(input_buffer+i) - '0';
-                else {
-                    while (j != 0) {
-                        //printf("j value is %d \n", j);
-                        power = power * 10.0;
-                        j--;
-                    }
-
-                    value = *(input_buffer+i) - '0';
-                    value = value * power;
-                }
-
-                //printf("power: %f, value: %f \n", power, value);
-                i++;
-            }
-        }
-        //printf("next buffer content %c \n", *(input_buffer+i));
-        //printf("got final value \n");
-        final = final + value;
-    }
-    //printf("final value: %f \n", final);
-    clean_buffer(input_buffer, size);
-
-    return final;
-}
-
 int read_distance_data(FILE *in) {
-    // TO BE IMPLEMENTED
-
-    char input = fgetc(in);
-    //printf("this is the input \n");
-    while (input != EOF) {
-        if (input == '#') {
-            while (input != '\n')
-                input = fgetc(in);
-
-            //printf("input1 is %c \n", input);
-            input = fgetc(in);
-            //printf("input2 is %c \n", input);
-        }
-
-        if (input == ',') {
-            break;
-        }
-    }                                      // get input without comment lines
-    int count = 0;
-    int i = 0;
-
-    //printf("value input is %d \n", input);
-
-    while (input != '\n') {
-        // if (input == '#') {
-        //     while (input != '\n')
-        //         input = fgetc(in);
-        //     input = fgetc(in);
-        //     printf("input is %d \n", input);
-        // }
-        // printf("passing first line \n");
-
-        if (input == ',') {
-            //printf("comma function  and input is %c \n", input);
-            // while (input != '\n') {
-            //     input = fgetc(in);
-            // }
-            input = fgetc(in);
-            //printf("value is %d \n", input);
-        }
-
-        else if (input == '#') {
-            while (input != '\n')
-                input = fgetc(in);
-
-            input = fgetc(in);
-        }
-
-        else {                                                  // collecting node name
-            //printf("node name function \n");
-            //printf("%c \n", input);
-            count++;
-            int j = 0;
-
-            while (input != ','){
-                if (input == '\n') {
-                    //printf("new line is detected \n");
-                    //input = fgetc(in);
-                    break;
-                }
-                //printf("%c \n", input);
-                *(*(node_names+i)+j) = input;
-                input = fgetc(in);
-                j++;
-                if (j > INPUT_MAX)
-                    return -1;
-            }
-            *(*(node_names+i)+j+1) = '\0';
-            i++;
-
-            if (i > MAX_NODES)
-                return -1;
-        }
-        //printf("%c \n", input);
-        //input = fgetc(in);
+    PHILO_CONTEXT *ctx = current_context;
+    CSV_READER reader;
+    if (csv_open(&reader, in)) {
+        fprintf(message_stream(), "cannot read the input\n");
+        return -1;
     }
 
-    // checking node name has all names
-    // printf("putting names is done \n");
-    int j = 0;
-
-    for (int i = 0; i < count; i++) {
-        //printf("inside for loop \n");
-        while (*(*(node_names+i)+j) != '\0') {
-            //printf("this is node name[%d][%d]: %c \n", i, j, *(*(node_names+i)+j));
-            j++;
-        }
-        j=0;
+    int ret = -1;
+    int count;
+    size_t available = csv_fill(&reader, BIN_MAGIC_LENGTH);
+    if (available != (size_t)-1 && bin_is_matrix(reader.data + reader.pos, available)) {
+        count = read_binary_data(&reader);
+        if (count > 0)
+            ret = 0;
     }
-
-    // printf("while loop for first line is done %d \n", count);
-    input = fgetc(in);
-    //printf("next input value is %d \n", input);
-
-    int row_count = 0;
-
-    int first_char_read = 0;
-    int l = 0;
-
-    while (input != EOF) {                                      // read each line
-        //printf("wl 2 \n");
-        int content_count = 0;
-
-        if (first_char_read == 0) {
-            //printf("first char \n");
-            int i=0;
-            //printf("input 1 value is %c \n", input);
-            while (input != ',') {                              // read name field & checking names on column and row are same
-                if (input == '#') {
-                    while (input != '\n')
-                        input = fgetc(in);
-
-                    input =fgetc(in);
-                }
-                first_char_read = 1;
-                //sprintf("input: %c node_names: %c \n", input, *(*(node_names+row_count)+content_count));
-
-                *(input_buffer+i)= input;
-                i++;
-
-                input = fgetc(in);
-                //printf("input 2 value is %c \n", input);
-            }
-
-            while (*(*(node_names+row_count)+content_count) != '\0') {
-                if(*(input_buffer+content_count) != *(*(node_names+row_count)+content_count)) {
-                    // printf("name is not symmetric \n");
-                    // printf("this is node name[%d][%d]: %c \n", row_count, content_count, *(*(node_names+row_count)+content_count));
-                    // printf("this is buffer name[%d]: %c \n", content_count, *(input_buffer+content_count));
-                    return -1;
-                }
-                else {
-                    // printf("name is matched well \n");
-                    // printf("this is node name[%d][%d]: %c \n", row_count, content_count, *(*(node_names+row_count)+content_count));
-                    // printf("this is buffer name[%d]: %c \n", content_count, *(input_buffer+content_count));
-                    content_count++;
-                }
-            }
-            input = fgetc(in);
-        }
-        else {
-
-            // printf("distance check and current input: %c \n", (char)input);
-
-            int size = 0;
-            int i=0;
-            double dist = 0.0;
-            int period_check = 0;
-            int deci_size = 0;
-
-            while (input != ',' && input != '\n') {
-                *(input_buffer+i) = input;
-                if (input == '.')
-                    period_check = 1;
-                if (period_check == 0)
-                    deci_size++;
-                i++;
-                size++;
-                input = fgetc(in);
-            }
-            *(input_buffer+i) = '\0';
-            // printf("input buffer is %c \n", *input_buffer);
-            dist = char_to_number(input_buffer, size, deci_size);
-            *(*(distances+row_count)+l) = dist;
-            //printf(" distance[%d][%d] = %f \n", row_count, l, *(*(distances+row_count)+l));
-            if (input == '\n'){
-                first_char_read = 0;
-                row_count++;
-                l = -1;
-                //break;
-            }
-            input = fgetc(in);
-            l++;
-        }
-
-    }
-    row_count++;
-
-    num_taxa = count;
-    num_all_nodes = count;
-    num_active_nodes = count;
-
-    // symmetric checking
-    int a = 0;
-    int b = 0;
-    while (a != num_taxa) {
-        //printf("a: %d b: %d \n", a, b);
-        //printf("distance[%d][%d]: %f == distances[%d][%d]: %f \n", a,b,*(*(distances+a)+b),b,a,*(*(distances+b)+a));
-        if (*(*(distances+a)+b) == *(*(distances+b)+a)) {
-            b++;
-            if (b == num_taxa) {
-                //printf("%d line is symmetric \n", a);
-                a++;
-                b = 0;
-            }
-        }
-
-        else{
-            //printf("not symmetric \n");
-            return -1;
-        }
-
+    else if ((count = read_header(&reader)) > 0) {
+        // size the tables for the leaves plus the count - 2 internal nodes to come
+        int total_nodes = 2 * count - 2;
+        if (total_nodes < count)
+            total_nodes = count;
+        if (grow_node_tables(total_nodes))
+            fprintf(message_stream(), "out of memory\n");
+        else if (grow_distance_matrix(count))
+            matrix_error();
+        else if (csv_read_rows_parallel(&reader, count, ctx->num_threads, ctx->matrix_file != NULL) == 0)
+            ret = 0;
+        else if (read_rows(&reader, count) == 0)                // also reports any error
+            ret = 0;
     }
+    csv_close(&reader);
+    if (ret)
+        return -1;
 
+    stats_hold(TRI_SIZE(ctx->matrix_capacity) * (ctx->float_distances != NULL ? sizeof(float) : sizeof(double)));
+    init_leaves(count);
     return 0;
 }
 
+void init_leaves(int count) {
+    PHILO_CONTEXT *ctx = current_context;
+    for (int i = 0; i < count; i++)
+        (ctx->nodes + i)->name = *(ctx->node_names + i);
+    ctx->num_taxa = count;
+    ctx->num_all_nodes = count;
+    ctx->num_active_nodes = count;
+}
+
 /**
  * @brief  Emit a representation of the phylogenetic tree in Newick
  * format to a specified output stream.
@@ -372,208 +842,301 @@ int read_distance_data(FILE *in) {
  * in the tree.
  */
 
-double get_distance_from_node (NODE* nod1, NODE* nod2) {
-    int i = 0;
-    int index = 0;
-    int jndex = 0;
-    double gdfn= 0.0;
+void find_default_outlier(void) {
+    PHILO_CONTEXT *ctx = current_context;
+    double outlier_val = 0.0;
 
-    while (i != num_all_nodes) {
-        if(*(node_names + i) == nod1->name) {
-            index = i;
-            break;
+    // the pairs (i, j), i < j, are visited by packed row j, so on a tie
+    // the pair with the smaller i must be kept explicitly
+    ctx->default_outlier = 0;
+    for (int j = 1; j < ctx->num_taxa; j++) {
+        for (int i = 0; i < j; i++) {
+            double temp = get_distance(j, i);
+            if (outlier_val < temp || (outlier_val == temp && temp > 0.0 && i < ctx->default_outlier)) {
+                outlier_val = temp;
+                ctx->default_outlier = i;
+            }
         }
-        i++;
     }
+}
 
-    i = 0;
-    while (i != num_all_nodes) {
-        if(*(node_names + i) == nod2->name) {
-            jndex = i;
-            break;
-        }
-        i++;
-    }
+double get_distance_from_node (NODE* nod1, NODE* nod2) {
+    PHILO_CONTEXT *ctx = current_context;
+    // the index of a node, in the nodes array and the tables indexed by node
+    int index = nod1 - ctx->nodes;
+    int jndex = nod2 - ctx->nodes;
+    double gdfn= 0.0;
 
-    gdfn = *(*(distances + index) + jndex);
+    // adjacent nodes: one of them is the neighbors[0] of the other
+    if (*((ctx->nodes + index)->neighbors + 0) == ctx->nodes + jndex)
+        gdfn = *(ctx->edge_lengths + index);
+    else if (*((ctx->nodes + jndex)->neighbors + 0) == ctx->nodes + index)
+        gdfn = *(ctx->edge_lengths + jndex);
     return gdfn;
 }
 
+// bootstrap support of the edge between two adjacent nodes, found like its length
+static int get_support_from_node(NODE* nod1, NODE* nod2) {
+    PHILO_CONTEXT *ctx = current_context;
+    if (*(nod1->neighbors + 0) == nod2)
+        return *(ctx->node_support + (nod1 - ctx->nodes));
+    return *(ctx->node_support + (nod2 - ctx->nodes));
+}
 
 
-int node_change_count = 0;
-int node_count = 0;
-int have_sibling = 1;
 
-// recursive function to get each node's distance
-void compare_two(NODE* node1, NODE* node2, FILE* out) {
-    // printf("ww1 change count is %d \n", node_change_count);
-    // printf("node1 name is  %s \n", node1->name);
-    // printf("node2 name is  %s \n", node2->name);
-    //printf("(");
-    // NODE* node3 = node1;
-    // NODE* node4 = node2;
-    //printf("%s, ", node1->name);
+/*
+ * Output written in large chunks: text is appended to the buffer, which is
+ * written out whenever less than OUT_RESERVE bytes are left, enough for any
+ * one name or number.  written counts the bytes that have gone out.
+ */
+#define OUT_BUFFER_SIZE (1 << 16)
+#define OUT_RESERVE (2 * INPUT_MAX + 64)
+
+typedef struct out_buffer {
+    FILE *out;
+    size_t length;
+    long written;
+    char data[OUT_BUFFER_SIZE];
+} OUT_BUFFER;
+
+static void out_flush(OUT_BUFFER *buffer) {
+    fwrite(buffer->data, 1, buffer->length, buffer->out);
+    buffer->written += buffer->length;
+    buffer->length = 0;
+}
 
-    int i = 0;
-    node_change_count = 0;
-    double newick_dist = 0.0;
+static void out_reserve(OUT_BUFFER *buffer) {
+    if (OUT_BUFFER_SIZE - buffer->length < OUT_RESERVE)
+        out_flush(buffer);
+}
 
-    while (i != 3) {
-        // printf("num of sibling 0: %d \n", have_sibling);
-        //printf("ww2 change count is %d \n", node_change_count);
+static void out_char(OUT_BUFFER *buffer, char c) {
+    out_reserve(buffer);
+    *(buffer->data + buffer->length++) = c;
+}
 
-        if (*(node1->neighbors + i) == NULL) {
-            //printf("%s neighbor %d is NULL \n", node1->name, i);
-            node_change_count++;
-            i++;
+static void out_string(OUT_BUFFER *buffer, const char *string) {
+    size_t len = strlen(string);
+    out_reserve(buffer);
+    memcpy(buffer->data + buffer->length, string, len);
+    buffer->length += len;
+}
 
-            continue;
-        }
+// the digits of value, which must be less than 10^20
+static void out_digits(OUT_BUFFER *buffer, unsigned long long value) {
+    char digits[20];
+    int n = 0;
+    do {
+        *(digits + n++) = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    out_reserve(buffer);
+    while (n > 0)
+        *(buffer->data + buffer->length++) = *(digits + --n);
+}
 
-        else if (*(node1->neighbors + i) == node2) {
-            //printf("%s neighbor %d is same with previous node \n", node1->name, i);
-            node_change_count++;
-            i++;
+static void out_int(OUT_BUFFER *buffer, int value) {
+    if (value < 0) {
+        out_char(buffer, '-');
+        out_digits(buffer, -(long long)value);
+    }
+    else
+        out_digits(buffer, value);
+}
 
-            continue;
-        }
+/*
+ * Write value as printf("%.2f") does, sign of a negative zero included.
+ * The value times 100 is rounded to the nearest integer.  The product is
+ * within a millionth of the exact one below 10^9, so the rounding only
+ * needs the exact value when the fraction is about one half; then, and for
+ * larger values, infinities and NaNs, printf is used.
+ */
+static void out_fixed2(OUT_BUFFER *buffer, double value) {
+    double magnitude = fabs(value);
+    double scaled = magnitude * 100;
+    double whole = floor(scaled);
+    double fraction = scaled - whole;
+    if (!(magnitude < 1e9) || fabs(fraction - 0.5) < 1e-4) {
+        out_flush(buffer);
+        buffer->written += fprintf(buffer->out, "%.2f", value);
+        return;
+    }
 
-        else {
-            //printf("%s neighbor %d is the first appeared node \n", node1->name, i);
-            NODE* node3 = *(node1->neighbors + i);
-            NODE* node4 = node1;
-            have_sibling++;
+    unsigned long long cents = (unsigned long long)whole + (fraction > 0.5);
+    if (signbit(value))
+        out_char(buffer, '-');
+    out_digits(buffer, cents / 100);
+    out_reserve(buffer);
+    *(buffer->data + buffer->length++) = '.';
+    *(buffer->data + buffer->length++) = '0' + cents % 100 / 10;
+    *(buffer->data + buffer->length++) = '0' + cents % 10;
+}
 
-            if (have_sibling == 1)
-                fprintf(out, ",");
-            else
-                fprintf(out, "(");
+/*
+ * Write the tree in Newick format, as seen from node1 coming from node2.
+ * This walks the tree depth first with an explicit stack, so that deep
+ * trees cannot exhaust the call stack, and follows the steps of the
+ * recursive function it replaces exactly, so the text is unchanged: at
+ * each node, a neighbor that is missing or the node it came from only
+ * counts a change, and each other neighbor is preceded by a "," when it is
+ * the first sibling and a "(" otherwise, and then visited.  The
+ * change count is the one left by the last node visited, like a global
+ * shared by all the levels of the recursion, and so is the sibling count.
+ * After its neighbors, a node closes a ")" if no sibling is pending, and
+ * then writes its name (or bootstrap support) and the length of the edge
+ * it came by.
+ */
+typedef struct newick_frame {
+    NODE *node1;
+    NODE *node2;
+    int i;                                              // next neighbor to look at
+} NEWICK_FRAME;
+
+static int write_newick(NODE *node1, NODE *node2, OUT_BUFFER *buffer) {
+    PHILO_CONTEXT *ctx = current_context;
+    NEWICK_FRAME *stack = malloc((ctx->num_all_nodes + 1) * sizeof(NEWICK_FRAME));
+    if (stack == NULL) {
+        fprintf(message_stream(), "out of memory\n");
+        return -1;
+    }
 
-            // printf("num of sibling 1: %d \n", have_sibling);
+    int depth = 0;
+    int node_change_count = 0;
+    int have_sibling = 1;
+    *stack = (NEWICK_FRAME){ node1, node2, 0 };
+    depth++;
 
-            compare_two(node3, node4, out);
-        }
-        //printf("ww3 change count is %d \n", node_change_count);
-        // printf("num of sibling 2: %d \n", have_sibling);
+    while (depth > 0) {
+        NEWICK_FRAME *frame = stack + depth - 1;
 
-        i++;
-    }
+        if (frame->i == 3) {
+            if (have_sibling == 0)
+                out_char(buffer, ')');
+            if (node_change_count == 3)
+                have_sibling = 0;
 
-    newick_dist = get_distance_from_node(node1, node2);
+            if (ctx->node_support != NULL && *(frame->node1->neighbors + 1) != NULL)
+                out_int(buffer, get_support_from_node(frame->node1, frame->node2));
+            else
+                out_string(buffer, frame->node1->name);
+            out_char(buffer, ':');
+            out_fixed2(buffer, get_distance_from_node(frame->node1, frame->node2));
 
-    // printf("num of sibling 3: %d \n", have_sibling);
+            depth--;
+            if (depth > 0)
+                (stack + depth - 1)->i++;                   // back to the neighbor after this one
+            continue;
+        }
 
-    if (have_sibling == 0) {
-        fprintf(out, ")");
-    }
+        NODE *next = *(frame->node1->neighbors + frame->i);
+        if (next == NULL || next == frame->node2) {
+            node_change_count++;
+            frame->i++;
+            continue;
+        }
 
-    if (node_change_count == 3) {
-        node_count ++;
-        have_sibling = 0;
+        have_sibling++;
+        out_char(buffer, have_sibling == 1 ? ',' : '(');
+        *(stack + depth) = (NEWICK_FRAME){ next, frame->node1, 0 };
+        depth++;
+        node_change_count = 0;
     }
 
-    //printf("num of sibling 4: %d \n", have_sibling);
-    //printf("ww4 change count is %d \n", node_change_count);
-
-    fprintf(out, "%s:%.2f", node1->name, newick_dist);
+    free(stack);
+    return 0;
 }
 
 
 
 int emit_newick_format(FILE *out) {
+    PHILO_CONTEXT *ctx = current_context;
     // TO BE IMPLEMENTED
-    int valid_outlier = 0;
-    int outlier_index = 0;
-    int i = 0;
-    int j = 0;
-    double temp = 0.0;
-    double outlier_val = 0.0;
-
-    // valid_outlier = out_num_count;
-
-    // -o : outlier is defined              ---- need to fix ----
-    if (outlier_name != NULL) {
-        int out_num_count = 0;
-        while (*(outlier_name + j) != '\0') {
-            out_num_count++;
-            j++;
-        }
-
-        // printf("num of taxa is %d \n", num_taxa);
-        // printf("outlier is defined: %c \n", *outlier_name);
-        while (i != num_taxa) {
-            j = 0;
-            // printf("hi1 \n");
-            while (*(*(node_names + i) + j) != '\0') {
-                // printf("hi2 \n");
-                if (*(outlier_name + j) == *(*(node_names + i) + j)) {
-                    // printf("hi3 \n");
-                    valid_outlier++;
-                    j++;
-                    if (valid_outlier == out_num_count) {
-                        outlier_index = i;
-                    }
-                    continue;
-                }
-
-                else {
-                    //printf("hi4 \n");
-                    break;
-                }
-            }
-            // printf("increase i, %d \n", i);
-            i++;
-            // j = 0;
-            // while (*(outlier_name + j) != '\0') {
-            //     if (*(outlier_name + j) == *(*(node_names + i) + j))
-            //         valid_outlier = 1;
-            //     j++;
-            // }
-            // i++;
-        }
-        //printf("hi2 \n");
-        //printf("valid_outlier is %d\n", valid_outlier);
-        if (valid_outlier != out_num_count)
-            return -1;
+    int outlier_index = ctx->default_outlier;
 
+    // the tree is written from the edge joining the outlier to the rest, which needs at least 3 taxa
+    if (ctx->num_taxa < 3) {
+        fprintf(message_stream(), "too few taxa for a Newick tree\n");
+        return -1;
     }
 
-
-    // finding defualt outlier
-    else {
-        //printf("num taxa is %d \n", num_taxa);
-        i = 0;
-        j = 1;
-        while (i != num_taxa) {
-            //printf("wl 1 \n");
-            while (j != num_taxa) {
-                //printf("wl2 \n");
-                temp = *(*(distances + i) + j);
-                if (outlier_val < temp) {
-                    outlier_val = temp;
-                    outlier_index = i;
-                }
-                j++;
-            }
-            i++;
-            j = i + 1;
-        }
+    // -o : the outlier is looked up by its exact name
+    if (ctx->outlier_name != NULL && (outlier_index = find_taxon(ctx->outlier_name)) < 0) {
+        fprintf(message_stream(), "no taxon is named %s\n", ctx->outlier_name);
+        return -1;
     }
 
-    //printf("\n outlier index is %d \n", outlier_index);
-
-
     // make newick
-    NODE* node_1 = nodes + outlier_index;
+    NODE* node_1 = ctx->nodes + outlier_index;
     NODE* node_2 = *(node_1->neighbors+0);
     //NODE* node_2 = *(node_1->neighbors+0);
     //printf("\n outlier name is %s \n", node_1->name);
 
-    compare_two(node_2, node_1, out);
-    printf("\n");
+    OUT_BUFFER buffer;
+    buffer.out = out;
+    buffer.length = 0;
+    buffer.written = 0;
+    int ret = write_newick(node_2, node_1, &buffer);
+    if (ret == 0)
+        out_char(&buffer, '\n');
+    out_flush(&buffer);
+    ctx->stats.bytes_written += buffer.written;
+
+    return ret;
+}
 
-    return 0;
+/*
+ * For -m with several threads, the rows of the matrix are formatted in
+ * blocks of about MATRIX_BLOCK_BYTES of text, one block per thread at a
+ * time, each into a memory stream of its own, and the blocks are then
+ * written in order.  An entry takes about MATRIX_ENTRY_BYTES.
+ */
+#define MATRIX_BLOCK_BYTES (1 << 20)
+#define MATRIX_ENTRY_BYTES 6
+
+typedef struct matrix_block {
+    int first_row;
+    int rows;
+    char *text;                 /* the formatted rows, NULL if out of memory */
+    size_t length;
+    PHILO_CONTEXT *context;     /* of the run, for the helper thread */
+} MATRIX_BLOCK;
+
+static void format_rows(MATRIX_BLOCK *block, OUT_BUFFER *buffer) {
+    PHILO_CONTEXT *ctx = current_context;
+    for (int i = block->first_row; i < block->first_row + block->rows; i++) {
+        out_string(buffer, *(ctx->node_names + i));
+        double *row = tri_row(ctx->node_distances, i);
+        for (int j = 0; j <= i; j++) {
+            out_char(buffer, ',');
+            out_fixed2(buffer, *(row + j));
+        }
+        for (int j = i + 1; j < ctx->num_all_nodes; j++) {
+            out_char(buffer, ',');
+            out_fixed2(buffer, *tri_entry(ctx->node_distances, i, j));
+        }
+        out_char(buffer, '\n');
+    }
+}
+
+static void *format_block(void *arg) {
+    MATRIX_BLOCK *block = arg;
+    current_context = block->context;
+    FILE *out = open_memstream(&block->text, &block->length);
+    if (out == NULL)
+        return NULL;
+
+    OUT_BUFFER buffer;
+    buffer.out = out;
+    buffer.length = 0;
+    buffer.written = 0;
+    format_rows(block, &buffer);
+    out_flush(&buffer);
+    if (fclose(out)) {
+        free(block->text);
+        block->text = NULL;
+    }
+    return NULL;
 }
 
 /**
@@ -586,7 +1149,9 @@ int emit_newick_format(FILE *out) {
  * The submatrix that consists of the first num_leaves rows and columns
  * is identical to the matrix given as input.  The remaining rows and columns
  * contain estimated distances to internal nodes that were synthesized during
- * the execution of the algorithm.
+ * the execution of the algorithm.  With --binary the matrix is written in
+ * the binary form of binmatrix.h instead, in double precision, so that it
+ * can be read back as input.
  *
  * @param out  Stream to which to output a CSV representation of the
  * synthesized distance matrix.
@@ -594,40 +1159,106 @@ int emit_newick_format(FILE *out) {
  * if any error occurred.
  */
 int emit_distance_matrix(FILE *out) {
+    PHILO_CONTEXT *ctx = current_context;
     // TO BE IMPLEMENTED
+    if (ctx->node_distances == NULL)                                 // only kept for -m
+        return -1;
+    if (ctx->global_options & BINARY_OPTION) {
+        long written = bin_write(out, ctx->num_all_nodes, ctx->node_names, ctx->node_distances, sizeof(double));
+        if (written < 0)
+            return -1;
+        ctx->stats.bytes_written += written;
+        return 0;
+    }
+
+    OUT_BUFFER buffer;
+    buffer.out = out;
+    buffer.length = 0;
+    buffer.written = 0;
     int i = 0;
-    while (i != num_all_nodes) {
-        int j = 0;
-        fprintf(out, ",");
-        while (*(*(node_names + i) + j) != '\0') {
-            fprintf(out, "%c", *(*(node_names + i) + j));
-            j++;
-        }
+    while (i != ctx->num_all_nodes) {
+        out_char(&buffer, ',');
+        out_string(&buffer, *(ctx->node_names + i));
         i++;
     }
-    fprintf(out, "\n");
+    out_char(&buffer, '\n');
+
+    int rows_per_block = MATRIX_BLOCK_BYTES / MATRIX_ENTRY_BYTES / ctx->num_all_nodes;
+    if (rows_per_block < 1)
+        rows_per_block = 1;
+    if (ctx->num_threads < 2 || ctx->num_all_nodes <= rows_per_block) {
+        MATRIX_BLOCK block = { 0, ctx->num_all_nodes };
+        format_rows(&block, &buffer);
+        out_flush(&buffer);
+        ctx->stats.bytes_written += buffer.written;
+        return 0;
+    }
+    out_flush(&buffer);
+    ctx->stats.bytes_written += buffer.written;
+
+    MATRIX_BLOCK *blocks = calloc(ctx->num_threads, sizeof(MATRIX_BLOCK));
+    pthread_t *threads = malloc(ctx->num_threads * sizeof(pthread_t));
+    int *started = calloc(ctx->num_threads, sizeof(int));
+    int ret = blocks != NULL && threads != NULL && started != NULL ? 0 : -1;
+
+    for (int first = 0; ret == 0 && first < ctx->num_all_nodes; first += ctx->num_threads * rows_per_block) {
+        int num_blocks = 0;
+        for (int row = first; num_blocks < ctx->num_threads && row < ctx->num_all_nodes; row += rows_per_block) {
+            MATRIX_BLOCK *block = blocks + num_blocks++;
+            memset(block, 0, sizeof(MATRIX_BLOCK));
+            block->first_row = row;
+            block->rows = row + rows_per_block < ctx->num_all_nodes ? rows_per_block : ctx->num_all_nodes - row;
+            block->context = current_context;
+        }
 
-    int frist_char = 0;
-    i = 0;
-    while (i != num_all_nodes) {
-        if (frist_char == 0) {
-            int j = 0;
-            while (*(*(node_names + i) + j) != '\0') {
-                fprintf(out, "%c", *(*(node_names + i) + j));
-                j++;
+        for (int t = 1; t < num_blocks; t++)
+            *(started + t) = pthread_create(threads + t, NULL, format_block, blocks + t) == 0;
+        format_block(blocks);
+        for (int t = 0; t < num_blocks; t++) {
+            if (t > 0 && *(started + t))
+                pthread_join(*(threads + t), NULL);
+            else if (t > 0)
+                format_block(blocks + t);                       // could not start a thread for it
+            if ((blocks + t)->text == NULL)
+                ret = -1;
+            else if (ret == 0) {
+                fwrite((blocks + t)->text, 1, (blocks + t)->length, out);
+                ctx->stats.bytes_written += (blocks + t)->length;
             }
+            free((blocks + t)->text);
         }
+    }
 
-        int j = 0;
-        while (j != num_all_nodes) {
-            fprintf(out, ",%.2f", *(*(distances + i) + j));
-            j++;
-        }
-        i++;
-        frist_char = 0;
-        fprintf(out, "\n");
+    if (ret)
+        fprintf(message_stream(), "out of memory\n");
+    free(blocks);
+    free(threads);
+    free(started);
+    return ret;
+}
 
-    }
+/**
+ * @brief  Output the distance data read as input in binary form.
+ * @details  The taxon names and the matrix read by read_distance_data()
+ * are written in the format described in binmatrix.h, in single precision
+ * with --float32 and in double precision otherwise.  The output can be
+ * given back to the program as input in place of the CSV it came from.
+ * It must be called before build_taxonomy(), which overwrites the matrix.
+ *
+ * @param out  Stream to which to output the data.
+ * @return 0 in case the output is successfully emitted, otherwise -1
+ * if any error occurred.
+ */
+int emit_binary_matrix(FILE *out) {
+    PHILO_CONTEXT *ctx = current_context;
+    long written;
+    if (ctx->float_distances != NULL)
+        written = bin_write(out, ctx->num_taxa, ctx->node_names, ctx->float_distances, sizeof(float));
+    else
+        written = bin_write(out, ctx->num_taxa, ctx->node_names, ctx->distances, sizeof(double));
+    if (written < 0)
+        return -1;
+    ctx->stats.bytes_written += written;
     return 0;
 }
 
@@ -671,310 +1302,357 @@ int emit_distance_matrix(FILE *out) {
  * pointer to the name of that node (which is stored in the corresponding
  * entry of the node_names array).
  *
+ * With a checkpoint_file, the state of the build is written to it from
+ * time to time (see checkpoint.h).  A build that read_checkpoint() has
+ * restored, which has more nodes than taxa, starts with the edges of the
+ * joins made before the checkpoint, and goes on from there.
+ *
  * @param out  If non-NULL, an output stream to which to emit the edge data.
  * If NULL, then no edge data is output.
  * @return 0 in case the output is successfully emitted, otherwise -1
  * if any error occurred.
  */
 
-double calc_row_sum(int i, int num_active) {
-    int j = 0;
-    double sum = 0.0;
-    //printf("lets do row sum for %d row \n", i);
-    while (j != num_active) {
-        //printf("*(active_node_map+j) is %d \n", *(active_node_map+j));
-        // if (*(active_node_map+j) == -1) {
-        //     j++;
-        //     continue;
-        // }
-        if (*(active_node_map+j) == -2)
-            break;
-
-        sum += *(*(distances + i) + *(active_node_map+j));
+/*
+ * Compute row_sums[p] from scratch for every active position p.
+ * This is O(n^2), so it is done only once at the start of build_taxonomy;
+ * after that join_active() keeps the sums current as nodes are joined.
+ * The packed rows are read in order: row q contributes its entries (q, p),
+ * p <= q, both to row_sums[q] and to row_sums[p], so every sum still
+ * receives its terms in position order.  row_sums_scale starts again from
+ * the largest of the new sums.
+ */
+void init_row_sums(void) {
+    PHILO_CONTEXT *ctx = current_context;
+    for (int q = 0; q < ctx->num_active_nodes; q++)
+        *(ctx->row_sums + q) = 0.0;
+
+    for (int q = 0; q < ctx->num_active_nodes; q++) {
+        for (int p = 0; p < q; p++) {
+            double dist = get_distance(q, p);
+            *(ctx->row_sums + q) += dist;
+            *(ctx->row_sums + p) += dist;
+        }
+        *(ctx->row_sums + q) += get_distance(q, q);
+    }
+    ctx->row_sums_scale = 0.0;
+    for (int q = 0; q < ctx->num_active_nodes; q++)
+        if (fabs(*(ctx->row_sums + q)) > ctx->row_sums_scale)
+            ctx->row_sums_scale = fabs(*(ctx->row_sums + q));
+}
 
-        //printf("each sum is %f \n", sum);
-        j++;
+/*
+ * The row sums of positions pos_i and pos_j added up afresh, in position
+ * order as init_row_sums() does, for the edge lengths of the join of the
+ * two and to settle near ties in Q (see qsearch.h).  The patched sums can
+ * be off in their last bits, enough to round a length the other way.  The
+ * matrix is visited front to back, as join_active() visits it next.
+ */
+void exact_row_sums(int pos_i, int pos_j, double *sum_i, double *sum_j) {
+    PHILO_CONTEXT *ctx = current_context;
+    *sum_i = 0.0;
+    *sum_j = 0.0;
+    for (int q = 0; q < ctx->num_active_nodes; q++) {
+        *sum_i += get_distance(pos_i, q);
+        *sum_j += get_distance(pos_j, q);
     }
-    //printf("sum is %f \n", sum);
-    return sum;
 }
 
-double dist_new_to_rest(int ind_i, int ind_j, int rest) {
-    double dist = 0.0;
+/*
+ * Join the active nodes at positions pos_i < pos_j into new_node.
+ * The distances from new_node to the other active nodes overwrite row pos_i,
+ * and the row of the last active position moves to pos_j, along with its
+ * row sum and its entry in active_node_map.  For every
+ * other active node, the row sum loses the distances to the joined nodes
+ * and gains the distance to new_node; the row sum of new_node is
+ * accumulated from its row, in position order.  This is O(n) per join.
+ *
+ * All of it is done in a single sweep over the positions p, in which the
+ * entries (p, pos_i), (p, pos_j) and (p, last) lie in rows pos_i, pos_j
+ * and last while p is below them and in row p after that, so the matrix is
+ * only ever visited front to back, once, as the matrix file wants.  The
+ * last node is handled first: its distance to new_node is the one that
+ * moves to (pos_i, pos_j).
+ */
+void join_active(int pos_i, int pos_j, int new_node) {
+    PHILO_CONTEXT *ctx = current_context;
+    int last = ctx->num_active_nodes - 1;
+    double dist_ij = get_distance(pos_i, pos_j);
+    int move = pos_j != last;                                   // move the last active node into pos_j
+
+    double last_to_new = 0.0;
+    if (move) {
+        double to_i = get_distance(last, pos_i);
+        double to_j = get_distance(last, pos_j);
+        last_to_new = set_distance(last, pos_i, (to_i + to_j - dist_ij) / 2);  // as stored
+        *(ctx->row_sums + last) = *(ctx->row_sums + last) - to_i - to_j + last_to_new;
+    }
 
-    dist = (*(*(distances + ind_i) + rest) + *(*(distances + ind_j) + rest) - *(*(distances + ind_i) + ind_j)) / 2;
+    double new_sum = 0.0;
+    for (int p = 0; p < last; p++) {
+        if (p == pos_i) {
+            if (move)
+                set_distance(pos_i, pos_j, last_to_new);
+            continue;
+        }
+        if (p == pos_j) {
+            new_sum += last_to_new;
+            continue;
+        }
+        double to_i = get_distance(p, pos_i);
+        double to_j = get_distance(p, pos_j);
+        double to_new = set_distance(p, pos_i, (to_i + to_j - dist_ij) / 2);   // as stored
+        *(ctx->row_sums + p) = *(ctx->row_sums + p) - to_i - to_j + to_new;
+        if (move)
+            set_distance(p, pos_j, get_distance(p, last));
+        new_sum += to_new;
+    }
+    set_distance(pos_i, pos_i, 0.0);
 
-    //printf("i is %d, j is %d, dist is %f \n", ind_i, ind_j, dist);
+    if (move) {
+        set_distance(pos_j, pos_j, get_distance(last, last));
+        *(ctx->row_sums + pos_j) = *(ctx->row_sums + last);
+        *(ctx->active_node_map + pos_j) = *(ctx->active_node_map + last);
+    }
+    *(ctx->active_node_map + pos_i) = new_node;
+    *(ctx->active_node_map + last) = -2;
+    ctx->num_active_nodes = last;
+    *(ctx->row_sums + pos_i) = new_sum;
+}
 
-    return dist;
+/*
+ * For -m, set up the matrix of distances between all nodes, starting with
+ * the input distances between the leaves.
+ */
+static int init_node_distances(void) {
+    PHILO_CONTEXT *ctx = current_context;
+    free(ctx->node_distances);
+    ctx->node_distances = calloc(TRI_SIZE(ctx->node_capacity), sizeof(double));
+    if (ctx->node_distances == NULL)
+        return -1;
+    stats_hold(TRI_SIZE(ctx->node_capacity) * sizeof(double));
+    if (ctx->float_distances != NULL) {
+        for (size_t e = 0; e < TRI_SIZE(ctx->num_taxa); e++)
+            *(ctx->node_distances + e) = *(ctx->float_distances + e);
+    }
+    else {
+        memcpy(ctx->node_distances, ctx->distances, TRI_SIZE(ctx->num_taxa) * sizeof(double));    // same packed layout
+    }
+    return 0;
 }
 
-int build_taxonomy(FILE *out) {
-    // TO BE IMPLEMENTED
+static void set_node_distance(int a, int b, double dist) {
+    PHILO_CONTEXT *ctx = current_context;
+    *tri_entry(ctx->node_distances, a, b) = dist;
+}
 
-    // put data into active_node_name
-    int s = 0;
+/* Output the edges of the joins made so far, as they were output when they were made. */
+static void emit_joined_edges(FILE *out) {
+    PHILO_CONTEXT *ctx = current_context;
+    for (int w = ctx->num_taxa; w < ctx->num_all_nodes; w++) {
+        for (int c = 1; c < 3; c++) {
+            int child = *((ctx->nodes + w)->neighbors + c) - ctx->nodes;
+            ctx->stats.bytes_written += fprintf(out, "%d,%d,%.2f\n", child, w, *(ctx->edge_lengths + child));
+        }
+    }
+}
 
-    while (s != num_taxa) {
-        *(active_node_map+s) = s;
-        //printf("active_node_map[%d] is %d \n", s, *(active_node_map+s));
-        s++;
+int build_taxonomy(FILE *out) {
+    PHILO_CONTEXT *ctx = current_context;
 
-        //printf("active_node_map[%d] is %d \n", s, *(active_node_map+s));
-    }
-    *(active_node_map+ (s)) = -2;
-    //printf("active_node_map[%d] is %d \n", s, *(active_node_map+(s)));
+    int resumed = ctx->num_all_nodes > ctx->num_taxa;                             // by read_checkpoint()
+    if (!resumed) {
+        int s = 0;
 
+        while (s != ctx->num_taxa) {
+            *(ctx->active_node_map+s) = s;
+            s++;
 
-    //printf("num_active_nodes = %d \n", num_active_nodes);
-    while (num_active_nodes != 2) {
+        }
+        *(ctx->active_node_map+ (s)) = -2;
 
-        //int node_count = 0;
+        find_default_outlier();
+        if (name_internal_nodes())                                      // "#<number>", named up front
+            return -1;
+        if (ctx->global_options & MATRIX_OPTION) {
+            if (init_node_distances())
+                return -1;
+        }
 
-        int index_i = 0;
-        int index_j = 0;
+        init_row_sums();
+        ctx->num_passes = 0;
+    }
+    else if (out != NULL && !(ctx->global_options & (NEWICK_OPTION | MATRIX_OPTION))) {
+        emit_joined_edges(out);
+    }
 
-        int actual_i = 0;
-        int actual_j = 0;
+    if (qsearch_init(ctx->num_threads))
+        return -1;
+    if ((ctx->global_options & RAPID_OPTION) && rapid_init()) {
+        qsearch_fini();
+        return -1;
+    }
 
-        //printf("num al node: %d \n", num_all_nodes);
+    // for -x, the pairs found by the last pass that are still to be joined, two nodes each
+    int *pending = NULL;
+    int num_pending = 0;
+    int next_pending = 0;
+    if ((ctx->global_options & RELAXED_OPTION) && (pending = malloc(ctx->num_taxa * sizeof(int))) == NULL) {
+        qsearch_fini();
+        return -1;
+    }
+    PHASE_CLOCK clock;
+    double next_checkpoint = ctx->checkpoint_file != NULL ? checkpoint_clock() + ctx->checkpoint_interval : 0.0;
 
-        int i = 0;
-        int j = 1;
 
-        double q_val = 0.0;
-        double temp = 0.0;
-        //printf("get in to get_j_by_q function \n");
-        //printf("active_node_map is %d \n", *(active_node_map + i));
+    while (ctx->num_active_nodes > 2) {
 
-        while (*(active_node_map + i) != -2) {
 
-            while (*(active_node_map + j) != -2) {
-                //printf("wl 2 \n");
-                if (i == j) {
-                    j++;
-                    continue;
-                }
+        int index_i = 0;
+        int index_j = 0;
 
-                temp = ((num_active_nodes-2) * (*(*(distances + *(active_node_map + i)) + *(active_node_map + j))) - calc_row_sum(*(active_node_map + i), num_active_nodes) - calc_row_sum(*(active_node_map + j), num_active_nodes));           // calculating Q value
-                // printf("(n-2) = %d, d(%d,%d) = %f, row_sum(%d) = %f, row_sum(%d) = %f \n", (num_active_nodes-2), *(active_node_map + i), *(active_node_map + j), (*(*(distances+*(active_node_map + i))+*(active_node_map + j))), *(active_node_map + i), calc_row_sum(*(active_node_map + i), num_all_nodes), *(active_node_map + j), calc_row_sum(*(active_node_map + j), num_all_nodes));
-                // printf("temp value is %f and index is (%d,%d) \n\n", temp, *(active_node_map + i), *(active_node_map + j));
-                if (q_val > temp) {
-                    q_val = temp;
-                    index_i = i;
-                    index_j = j;
-                    actual_i = *(active_node_map + i);
-                    actual_j = *(active_node_map + j);
-                    j++;
-                }
-                else
-                    j++;
+        if (pending != NULL && ctx->num_active_nodes > 3 && next_pending == num_pending) {
+            stats_start(&clock);
+            num_pending = relaxed_pairs(pending);
+            stats_stop(&clock, &ctx->stats.search);
+            next_pending = 0;
+            ctx->num_passes++;
+            if (num_pending < 0) {
+                free(pending);
+                qsearch_fini();
+                return -1;
             }
-
-            i++;
-            j = i;
         }
 
-        // printf("index_i is %d \n", actual_i);
-        // printf("index_j is %d \n", actual_j);
-
-        double dist_i_to_new = ((*(*(distances+ actual_i) + actual_j) / 2)) + (((calc_row_sum(actual_i, num_active_nodes) - calc_row_sum(actual_j, num_active_nodes)) / 2) / (num_active_nodes-2));
-        double dist_j_to_new = (*(*(distances+ actual_i) + actual_j)) - dist_i_to_new;
-        // printf("distance from i to new: %f \n", dist_i_to_new);
-        // printf("distance from j to new: %f \n", dist_j_to_new);
-
-        int new_node_name = num_all_nodes;
-        int int_char = 0;
-        int buffer_index = 0;
-        int digit = 4;
-
-        *(input_buffer + buffer_index) = '#';
-        buffer_index++;
-
-        while(digit != 0){
-            if (new_node_name >= 1000) {
-                //printf("digit 4 \n");
-                int_char = new_node_name / 1000;
-                *(input_buffer + buffer_index) = int_char + '0';
-                new_node_name = new_node_name % 1000;
-                buffer_index++;
-                digit = 3;
-            }
-            else if (new_node_name >= 100 || digit == 3) {
-                //printf("digit 3 \n");
-                int_char = new_node_name / 100;
-                *(input_buffer + buffer_index) = int_char + '0';
-                new_node_name = new_node_name % 100;
-                buffer_index++;
-                digit = 2;
-            }
-            else if (new_node_name >= 10 || digit == 2) {
-                //printf("digit 2 \n");
-                int_char = new_node_name / 10;
-                *(input_buffer + buffer_index) = int_char + '0';
-                new_node_name = new_node_name % 10;
-                buffer_index++;
-                digit = 1;
+        if (pending != NULL && ctx->num_active_nodes > 3 && next_pending < num_pending) {
+            // the positions of the pair, which move as other pairs are joined
+            int node_i = *(pending + 2 * next_pending);
+            int node_j = *(pending + 2 * next_pending + 1);
+            next_pending++;
+            for (int q = 0; q < ctx->num_active_nodes; q++) {
+                if (*(ctx->active_node_map + q) == node_i)
+                    index_i = q;
+                else if (*(ctx->active_node_map + q) == node_j)
+                    index_j = q;
             }
-            else {
-                //printf("digit 1 \n");
-                *(input_buffer + buffer_index) = new_node_name + '0';
-                buffer_index++;
-                digit = 0;
-                *(input_buffer + buffer_index) = '\0';
-                //printf("%d \n", digit);
+            if (index_i > index_j) {
+                int swap = index_i;
+                index_i = index_j;
+                index_j = swap;
             }
         }
-
-        num_all_nodes += 1;                                             // adding new node
-        num_active_nodes -= 1;                                          // num_active_nodes + new node - 2(neighbors)
-
-        *(active_node_map + index_i) = num_all_nodes-1;                              // deactivate node
-        *(active_node_map + index_j) = *(active_node_map + (num_active_nodes));                              // deactivate node
-        *(active_node_map + num_active_nodes) = -2;
-
-        int p = 0;
-        //printf("new input node name is ");
-        while (*(input_buffer + p) != '\0') {               // put new node name is to the node_name array
-            //printf("%c", *(input_buffer + p));
-            *(*(node_names+ (num_all_nodes-1))+p) = *(input_buffer + p);
-            //printf("%c", *(*(node_names + (num_all_nodes-1))+p));
-            p++;
+        else {
+            stats_start(&clock);
+            if (ctx->global_options & RAPID_OPTION)
+                rapid_min_q(&index_i, &index_j);
+            else
+                exhaustive_min_q(&index_i, &index_j);
+            stats_stop(&clock, &ctx->stats.search);
+            ctx->num_passes++;
+        }
+        ctx->stats.joins++;
+
+        int actual_i = *(ctx->active_node_map + index_i);
+        int actual_j = *(ctx->active_node_map + index_j);
+
+
+        double dist_ij = get_distance(index_i, index_j);
+        double sum_i;
+        double sum_j;
+        exact_row_sums(index_i, index_j, &sum_i, &sum_j);
+        double dist_i_to_new = (dist_ij / 2) + (((sum_i - sum_j) / 2) / (ctx->num_active_nodes-2));
+        double dist_j_to_new = dist_ij - dist_i_to_new;
+
+        int new_node = ctx->num_all_nodes;
+        ctx->num_all_nodes += 1;                                             // adding new node
+
+        (ctx->nodes + actual_i)->name = *(ctx->node_names + actual_i);
+        (ctx->nodes + actual_j)->name = *(ctx->node_names + actual_j);
+        (ctx->nodes + new_node)->name = *(ctx->node_names + new_node);
+        *((ctx->nodes + actual_i)->neighbors + 0) = (ctx->nodes + new_node);
+        *((ctx->nodes + actual_j)->neighbors + 0) = (ctx->nodes + new_node);
+        *((ctx->nodes + new_node)->neighbors + 1) = (ctx->nodes + actual_i);
+        *((ctx->nodes + new_node)->neighbors + 2) = (ctx->nodes + actual_j);
+        *(ctx->edge_lengths + actual_i) = dist_i_to_new;
+        *(ctx->edge_lengths + actual_j) = dist_j_to_new;
+
+        if (ctx->node_distances != NULL) {
+            set_node_distance(new_node, actual_i, dist_i_to_new);
+            set_node_distance(new_node, actual_j, dist_j_to_new);
         }
 
 
-        // put distances into the distance matrix
-        *(*(distances + (num_all_nodes-1))+ actual_i) = dist_i_to_new;
-        *(*(distances + actual_i)+ (num_all_nodes-1)) = dist_i_to_new;
-        *(*(distances + (num_all_nodes-1))+ actual_j) = dist_j_to_new;
-        *(*(distances + actual_j)+ (num_all_nodes-1)) = dist_j_to_new;
-
-
-        // put data in the node structure
-        (nodes + actual_i)->name = *(node_names + actual_i);
-        (nodes + actual_j)->name = *(node_names + actual_j);
-        (nodes + (num_all_nodes-1))->name = *(node_names + (num_all_nodes-1));
-        *((nodes + actual_i)->neighbors + 0) = (nodes + (num_all_nodes-1));
-        *((nodes + actual_j)->neighbors + 0) = (nodes + (num_all_nodes-1));
-        *((nodes + (num_all_nodes-1))->neighbors + 1) = (nodes + actual_i);
-        *((nodes + (num_all_nodes-1))->neighbors + 2) = (nodes + actual_j);
-
-        // printf("%d node's name is  %s \n", actual_i, (nodes + actual_i)->name);
-        // printf("%d node's name is  %s \n", actual_j, (nodes + actual_j)->name);
-        // printf("%d node's name is  %s \n", (num_all_nodes-1), (nodes + (num_all_nodes-1))->name);
-
-        // printf("%d node's child 1 name is  %s \n", (num_all_nodes-1), ((nodes + (num_all_nodes-1))->neighbors[1])->name);
-        // printf("%d node's child 2 name is  %s \n", (num_all_nodes-1), ((nodes + (num_all_nodes-1))->neighbors[2])->name);
-
-        // printf("%d node's parent name is  %s \n", actual_i, ((nodes + actual_i)->neighbors[0])->name);
-        // printf("%d node's parent name is  %s \n", actual_j, ((nodes + actual_j)->neighbors[0])->name);
-
-
-        // no flags print child node and parent node with distance
-        if (global_options == 0) {
-            fprintf(out, "%d,%d,%.2f\n", actual_i, (num_all_nodes -1), dist_i_to_new);
-            fprintf(out, "%d,%d,%.2f\n", actual_j, (num_all_nodes -1), dist_j_to_new);
+        if (out != NULL && !(ctx->global_options & (NEWICK_OPTION | MATRIX_OPTION))) {
+            ctx->stats.bytes_written += fprintf(out, "%d,%d,%.2f\n", actual_i, new_node, dist_i_to_new);
+            ctx->stats.bytes_written += fprintf(out, "%d,%d,%.2f\n", actual_j, new_node, dist_j_to_new);
         }
 
 
-        // calculate distance to rest
-        int t = 0;
-        while (t != num_all_nodes-1) {
-            //printf("t = %d \n", t);
-            if (t == actual_i || t == actual_j) {
-                //printf("t = index_i or index j \n");
-                t++;
-                continue;
-            }
+        if (ctx->num_active_nodes > 3) {
+            join_active(index_i, index_j, new_node);
 
-            int z = 0;
-            while (z != num_active_nodes) {
-                if (*(active_node_map + z) != t) {
-                    //printf("t: %d is not equal to z: %d \n", t, z);
-                    z++;
-                    continue;
-                }
-                else {
-                    //printf("t: %d is equal to z: %d \n", t, z);
-                    break;
+            if (ctx->node_distances != NULL) {
+                for (int q = 0; q < ctx->num_active_nodes; q++) {
+                    if (q != index_i)
+                        set_node_distance(new_node, *(ctx->active_node_map + q), get_distance(index_i, q));
                 }
             }
 
-            if (z == num_active_nodes) {
-                //printf("z: %d is equal to num_active_nodes: %d \n", z, num_active_nodes);
-
-                t++;
-                continue;
+            if ((ctx->global_options & RAPID_OPTION) && rapid_join(actual_i, actual_j, new_node)) {
+                rapid_fini();
+                qsearch_fini();
+                free(pending);
+                return -1;
             }
 
-            else {
-                //printf("num_active_nodes is %d \n", num_active_nodes);
-                if (num_active_nodes == 2) {
-                    // printf("num of active node is 2 \n");
-                    // printf("deactivate node is %d and %d \n", actual_i, actual_j);
-                    *(*(distances + *(active_node_map)) + *(active_node_map + 1)) = *(*(distances + (num_all_nodes - 2)) + *(active_node_map + 1)) - *(*(distances + (num_all_nodes - 2)) + *(active_node_map));
-                    *(*(distances + *(active_node_map + 1)) + *(active_node_map)) = *(*(distances + *(active_node_map)) + *(active_node_map + 1));
-                    //printf("distances[%d][%d] is %f \n", num_all_nodes-1, t, *(*(distances + (num_all_nodes-1))+ t));
-
-
-                    // put last node's data in node structure
-                    int last_i = *(active_node_map);
-                    int last_j = *(active_node_map + 1);
-
-                    (nodes + last_j)->name = *(node_names + last_j);
-                    *((nodes + last_i)->neighbors + 0) = (nodes + last_j);
-                    *((nodes + last_j)->neighbors + 0) = (nodes + last_i);
-                    *((nodes + (num_all_nodes-1))->neighbors + 1) = (nodes + actual_i);
-
-                    // printf("%d node's name is  %s \n", last_j, (nodes + last_j)->name);
-                    // printf("%d node's name is  %s \n", last_i, (nodes + last_i)->name);
-                    // //printf("%d node's name is  %s \n", (num_all_nodes-1), (nodes + (num_all_nodes-1))->name);
-
-                    // printf("%d node's child 1 name is  %s \n", last_i, ((nodes + last_i)->neighbors[1])->name);
-                    // printf("%d node's child 2 name is  %s \n", last_i, ((nodes + last_i)->neighbors[2])->name);
-
-                    // printf("%d node's parent name is  %s \n", last_i, ((nodes + last_i)->neighbors[0])->name);
-                    // printf("%d node's parent name is  %s \n", last_j, ((nodes + last_j)->neighbors[0])->name);
-
-
-                    // no flags print child node and parent node with distance
-                    if (global_options == 0) {
-                        fprintf(out, "%d,%d,%.2f\n", t, (num_all_nodes -1), *(*(distances + *(active_node_map)) + *(active_node_map + 1)));
-                    }
-                    break;
-                }
-                else {
-                    //printf("deactivate node is %d and %d \n", actual_i, actual_j);
-                    *(*(distances + (num_all_nodes-1))+ t) = dist_new_to_rest(actual_i, actual_j, t);
-                    *(*(distances + t)+ (num_all_nodes-1)) = *(*(distances + (num_all_nodes-1))+ t);
-                    //printf("distances[%d][%d] is %f \n", num_all_nodes-1, t, *(*(distances + (num_all_nodes-1))+ t));
-                    t++;
-                }
-
+            // with -x, only once the pairs of the pass have all been joined;
+            // a checkpoint that cannot be written does not stop the build
+            if (ctx->checkpoint_file != NULL && (pending == NULL || next_pending == num_pending)
+                && checkpoint_clock() >= next_checkpoint) {
+                write_checkpoint();
+                next_checkpoint = checkpoint_clock() + ctx->checkpoint_interval;
             }
-
+            continue;
         }
 
-        // int r = 0;
-        // while (r != num_active_nodes+1) {
-        //     printf("active node map: %d ", *(active_node_map+r));
-        //     r++;
-        // }
-        // printf("\n");
-
+        // The last join leaves two active nodes: new_node and the remaining
+        // node k.  The edge between them gets the length
+        //     d(prev, last_j) - d(prev, last_i),
+        // where prev is the node created just before new_node (a leaf if
+        // there were only three taxa) and last_i, last_j are the two
+        // remaining nodes in the order of their positions.  prev is always
+        // one of the three nodes active at this point.
+        int pos_k = 3 - index_i - index_j;
+        int k = *(ctx->active_node_map + pos_k);
+        int prev = new_node - 1;
+        int pos_prev = prev == actual_i ? index_i : (prev == actual_j ? index_j : pos_k);
+        double prev_to_new = prev == actual_i ? dist_i_to_new : (prev == actual_j ? dist_j_to_new : 0.0);
+        double prev_to_k = get_distance(pos_prev, pos_k);
+
+        *(ctx->active_node_map + index_i) = new_node;
+        *(ctx->active_node_map + index_j) = *(ctx->active_node_map + 2);
+        *(ctx->active_node_map + 2) = -2;
+        ctx->num_active_nodes = 2;
+
+        int last_i = *(ctx->active_node_map);
+        int last_j = *(ctx->active_node_map + 1);
+        double last_dist = last_i == new_node ? prev_to_k - prev_to_new : prev_to_new - prev_to_k;
+
+        *((ctx->nodes + last_i)->neighbors + 0) = (ctx->nodes + last_j);
+        *((ctx->nodes + last_j)->neighbors + 0) = (ctx->nodes + last_i);
+        *(ctx->edge_lengths + last_i) = last_dist;
+        *(ctx->edge_lengths + last_j) = last_dist;
+        if (ctx->node_distances != NULL)
+            set_node_distance(last_i, last_j, last_dist);
+
+        if (out != NULL && !(ctx->global_options & (NEWICK_OPTION | MATRIX_OPTION))) {
+            ctx->stats.bytes_written += fprintf(out, "%d,%d,%.2f\n", k, new_node, last_dist);
+        }
     }
 
-    // int p = 0;
-    // int t=0;
-    // while (t != num_all_nodes) {
-    //     //printf("distances[%d][%d] is %f \n", t,p,*(*(distances + t)+ p));
-    //     p++;
-    //     if(p == num_all_nodes) {
-    //         p=0;
-    //         t++;
-    //     }
-
-    // }
-
+    if (ctx->global_options & RAPID_OPTION)
+        rapid_fini();
+    qsearch_fini();
+    free(pending);
     return 0;
 }
@@ -0,0 +1,162 @@
+#define _GNU_SOURCE                                             /* for cpu_set_t and sched_setaffinity() */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "context.h"
+#include "debug.h"
+#include "qsearch.h"
+#include "placement.h"
+
+#define MAX_NUMA_NODES 64
+
+/* Where the nodes are described; another directory laid out the same way can be given to try out a topology. */
+#ifndef NODE_SYSFS
+#define NODE_SYSFS "/sys/devices/system/node"
+#endif
+
+/* The CPUs of each node that the process may run on, found once for the process. */
+static pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+static int node_count;
+static cpu_set_t node_cpus[MAX_NUMA_NODES];
+
+/*
+ * Read a list of numbers like "0-3,8,10-11" from a file of /sys into
+ * values.  Returns how many there are, at most max, or 0 if the file
+ * cannot be read.
+ */
+static int read_list(const char *path, int *values, int max) {
+    FILE *in = fopen(path, "r");
+    if (in == NULL)
+        return 0;
+    int count = 0;
+    int first;
+    int last;
+    while (fscanf(in, "%d", &first) == 1) {
+        last = first;
+        int c = fgetc(in);
+        if (c == '-' && fscanf(in, "%d", &last) == 1)
+            c = fgetc(in);
+        for (int value = first; value <= last && count < max; value++)
+            *(values + count++) = value;
+        if (c != ',')
+            break;
+    }
+    fclose(in);
+    return count;
+}
+
+static void find_topology(void) {
+    cpu_set_t allowed;
+    int online[MAX_NUMA_NODES];
+    int *cpus = malloc(CPU_SETSIZE * sizeof(int));
+    if (cpus == NULL || sched_getaffinity(0, sizeof(cpu_set_t), &allowed)) {
+        free(cpus);
+        return;
+    }
+    int count = read_list(NODE_SYSFS "/online", online, MAX_NUMA_NODES);
+    for (int n = 0; n < count; n++) {
+        char path[256];
+        snprintf(path, sizeof(path), NODE_SYSFS "/node%d/cpulist", *(online + n));
+        int num_cpus = read_list(path, cpus, CPU_SETSIZE);
+        cpu_set_t *set = node_cpus + node_count;
+        CPU_ZERO(set);
+        for (int c = 0; c < num_cpus; c++) {
+            if (*(cpus + c) < CPU_SETSIZE && CPU_ISSET(*(cpus + c), &allowed))
+                CPU_SET(*(cpus + c), set);
+        }
+        if (CPU_COUNT(set) > 0)                                 // a node with memory only is left out
+            node_count++;
+    }
+    free(cpus);
+    debug("%d NUMA nodes", node_count);
+}
+
+int placement_nodes(void) {
+    pthread_once(&topology_once, find_topology);
+    return node_count > 1 ? node_count : 1;
+}
+
+int placement_node(int t, int count) {
+    return (int)((long)t * placement_nodes() / count);
+}
+
+int placement_bind(int node, void **saved) {
+    if (placement_nodes() < 2)
+        return -1;
+    if (saved != NULL) {
+        *saved = malloc(sizeof(cpu_set_t));
+        if (*saved == NULL || sched_getaffinity(0, sizeof(cpu_set_t), *saved)) {
+            free(*saved);
+            *saved = NULL;
+            return -1;
+        }
+    }
+    return sched_setaffinity(0, sizeof(cpu_set_t), node_cpus + node);
+}
+
+void placement_restore(void *saved) {
+    if (saved == NULL)
+        return;
+    sched_setaffinity(0, sizeof(cpu_set_t), saved);
+    free(saved);
+}
+
+/* The part of the matrix a first-touch thread is given: the bytes of its band, and the node. */
+typedef struct touch_band {
+    char *start;
+    char *end;
+    int node;
+} TOUCH_BAND;
+
+static void touch_pages(TOUCH_BAND *band) {
+    long page = sysconf(_SC_PAGESIZE);
+    for (volatile char *p = band->start; p < band->end; p += page)
+        *p = 0;
+}
+
+static void *touch_worker(void *arg) {
+    TOUCH_BAND *band = arg;
+    placement_bind(band->node, NULL);
+    touch_pages(band);
+    return NULL;
+}
+
+int placement_first_touch(char *matrix, size_t precision, int rows, int threads) {
+    int count = placement_nodes();
+    if (count < 2 || threads < 2 || rows < threads)
+        return 1;
+    int *split = malloc((threads + 1) * sizeof(int));
+    TOUCH_BAND *bands = malloc(threads * sizeof(TOUCH_BAND));
+    pthread_t *ids = malloc(threads * sizeof(pthread_t));
+    int *started = calloc(threads, sizeof(int));
+    if (split == NULL || bands == NULL || ids == NULL || started == NULL) {
+        free(split);
+        free(bands);
+        free(ids);
+        free(started);
+        return 1;
+    }
+
+    qsearch_split(rows, threads, split);
+    for (int t = 0; t < threads; t++) {
+        (bands + t)->start = matrix + TRI_SIZE(*(split + t)) * precision;
+        (bands + t)->end = matrix + TRI_SIZE(*(split + t + 1)) * precision;
+        (bands + t)->node = placement_node(t, threads);
+        *(started + t) = pthread_create(ids + t, NULL, touch_worker, bands + t) == 0;
+    }
+    // a band whose thread could not be started is touched here, wherever that is
+    for (int t = 0; t < threads; t++) {
+        if (*(started + t))
+            pthread_join(*(ids + t), NULL);
+        else
+            touch_pages(bands + t);
+    }
+    free(split);
+    free(bands);
+    free(ids);
+    free(started);
+    return count < threads ? count : threads;
+}
@@ -0,0 +1,244 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "qkernel.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Each kernel is written once, as an always-inlined body taking the row of
+ * distances as an untyped pointer and a flag saying whether it holds floats.
+ * The flag is a constant in every caller, so each body is compiled into a
+ * double and a float version without any test in the loops.  Float
+ * distances are widened to double as they are loaded.
+ */
+#define KERNEL_BODY static inline __attribute__((always_inline))
+
+KERNEL_BODY double load_1(const void *dist, int k, int f32) {
+    return f32 ? *((const float *)dist + k) : *((const double *)dist + k);
+}
+
+KERNEL_BODY int q_row_min_scalar_body(const void *dist, const double *sums, int len, double scale,
+                                      double row_sum, double threshold, double *min_q, int f32) {
+    double best = threshold;
+    int best_k = -1;
+    for (int k = 0; k < len; k++) {
+        double q = scale * load_1(dist, k, f32) - *(sums + k) - row_sum;
+        if (q < best) {
+            best = q;
+            best_k = k;
+        }
+    }
+    *min_q = best;
+    return best_k;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/*
+ * The vector kernels make two passes over the row.  The first only computes
+ * the minimum, in two independent sets of lanes so that consecutive vectors
+ * do not wait on each other; a NaN never replaces the minimum, just as in
+ * the scalar comparison.  Most rows do not beat the threshold, and for
+ * those the work ends there.  Otherwise the second pass recomputes the Q
+ * values, which come out bit-identical, and finds the first one equal to
+ * the minimum.
+ */
+
+KERNEL_BODY __m128d load_2(const void *dist, int k, int f32) {
+    if (f32)
+        return _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i *)((const float *)dist + k))));
+    return _mm_loadu_pd((const double *)dist + k);
+}
+
+KERNEL_BODY int q_row_min_sse2_body(const void *dist, const double *sums, int len, double scale,
+                                    double row_sum, double threshold, double *min_q, int f32) {
+    __m128d vscale = _mm_set1_pd(scale);
+    __m128d vrow = _mm_set1_pd(row_sum);
+    __m128d vmin0 = _mm_set1_pd(threshold);
+    __m128d vmin1 = vmin0;
+    int k = 0;
+
+    for (; k + 4 <= len; k += 4) {
+        __m128d q0 = _mm_sub_pd(_mm_sub_pd(_mm_mul_pd(vscale, load_2(dist, k, f32)), _mm_loadu_pd(sums + k)),
+                                vrow);
+        __m128d q1 = _mm_sub_pd(_mm_sub_pd(_mm_mul_pd(vscale, load_2(dist, k + 2, f32)), _mm_loadu_pd(sums + k + 2)),
+                                vrow);
+        vmin0 = _mm_min_pd(q0, vmin0);
+        vmin1 = _mm_min_pd(q1, vmin1);
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_min_pd(vmin0, vmin1));
+    double best = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+    for (; k < len; k++) {
+        double q = scale * load_1(dist, k, f32) - *(sums + k) - row_sum;
+        if (q < best)
+            best = q;
+    }
+    if (!(best < threshold))
+        return -1;
+
+    __m128d vbest = _mm_set1_pd(best);
+    for (k = 0; k + 2 <= len; k += 2) {
+        __m128d q = _mm_sub_pd(_mm_sub_pd(_mm_mul_pd(vscale, load_2(dist, k, f32)), _mm_loadu_pd(sums + k)),
+                               vrow);
+        int mask = _mm_movemask_pd(_mm_cmpeq_pd(q, vbest));
+        if (mask) {
+            *min_q = best;
+            return k + __builtin_ctz(mask);
+        }
+    }
+    *min_q = best;
+    return len - 1;                                     // only the last element is left
+}
+
+__attribute__((target("avx2")))
+KERNEL_BODY __m256d load_4(const void *dist, int k, int f32) {
+    if (f32)
+        return _mm256_cvtps_pd(_mm_loadu_ps((const float *)dist + k));
+    return _mm256_loadu_pd((const double *)dist + k);
+}
+
+__attribute__((target("avx2")))
+KERNEL_BODY int q_row_min_avx2_body(const void *dist, const double *sums, int len, double scale,
+                                    double row_sum, double threshold, double *min_q, int f32) {
+    __m256d vscale = _mm256_set1_pd(scale);
+    __m256d vrow = _mm256_set1_pd(row_sum);
+    __m256d vmin0 = _mm256_set1_pd(threshold);
+    __m256d vmin1 = vmin0;
+    int k = 0;
+
+    for (; k + 8 <= len; k += 8) {
+        __m256d q0 = _mm256_sub_pd(_mm256_sub_pd(_mm256_mul_pd(vscale, load_4(dist, k, f32)), _mm256_loadu_pd(sums + k)),
+                                   vrow);
+        __m256d q1 = _mm256_sub_pd(_mm256_sub_pd(_mm256_mul_pd(vscale, load_4(dist, k + 4, f32)), _mm256_loadu_pd(sums + k + 4)),
+                                   vrow);
+        vmin0 = _mm256_min_pd(q0, vmin0);
+        vmin1 = _mm256_min_pd(q1, vmin1);
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_min_pd(vmin0, vmin1));
+    double best = lanes[0];
+    for (int l = 1; l < 4; l++) {
+        if (lanes[l] < best)
+            best = lanes[l];
+    }
+    for (; k < len; k++) {
+        double q = scale * load_1(dist, k, f32) - *(sums + k) - row_sum;
+        if (q < best)
+            best = q;
+    }
+    if (!(best < threshold))
+        return -1;
+
+    __m256d vbest = _mm256_set1_pd(best);
+    for (k = 0; k + 4 <= len; k += 4) {
+        __m256d q = _mm256_sub_pd(_mm256_sub_pd(_mm256_mul_pd(vscale, load_4(dist, k, f32)), _mm256_loadu_pd(sums + k)),
+                                  vrow);
+        int mask = _mm256_movemask_pd(_mm256_cmp_pd(q, vbest, _CMP_EQ_OQ));
+        if (mask) {
+            *min_q = best;
+            return k + __builtin_ctz(mask);
+        }
+    }
+    for (; k < len; k++) {
+        if (scale * load_1(dist, k, f32) - *(sums + k) - row_sum == best)
+            break;
+    }
+    *min_q = best;
+    return k;
+}
+
+#endif
+
+/* The double and float instances of the kernels. */
+
+static int q_row_min_scalar(const double *dist, const double *sums, int len,
+                            double scale, double row_sum, double threshold, double *min_q) {
+    return q_row_min_scalar_body(dist, sums, len, scale, row_sum, threshold, min_q, 0);
+}
+
+static int q_row_min_scalar_f32(const float *dist, const double *sums, int len,
+                                double scale, double row_sum, double threshold, double *min_q) {
+    return q_row_min_scalar_body(dist, sums, len, scale, row_sum, threshold, min_q, 1);
+}
+
+#ifdef HAVE_X86_KERNELS
+
+static int q_row_min_sse2(const double *dist, const double *sums, int len,
+                          double scale, double row_sum, double threshold, double *min_q) {
+    return q_row_min_sse2_body(dist, sums, len, scale, row_sum, threshold, min_q, 0);
+}
+
+static int q_row_min_sse2_f32(const float *dist, const double *sums, int len,
+                              double scale, double row_sum, double threshold, double *min_q) {
+    return q_row_min_sse2_body(dist, sums, len, scale, row_sum, threshold, min_q, 1);
+}
+
+__attribute__((target("avx2")))
+static int q_row_min_avx2(const double *dist, const double *sums, int len,
+                          double scale, double row_sum, double threshold, double *min_q) {
+    return q_row_min_avx2_body(dist, sums, len, scale, row_sum, threshold, min_q, 0);
+}
+
+__attribute__((target("avx2")))
+static int q_row_min_avx2_f32(const float *dist, const double *sums, int len,
+                              double scale, double row_sum, double threshold, double *min_q) {
+    return q_row_min_avx2_body(dist, sums, len, scale, row_sum, threshold, min_q, 1);
+}
+
+#endif
+
+static Q_ROW_KERNEL selected_kernel;
+static Q_ROW_KERNEL_F32 selected_kernel_f32;
+static const char *selected_name;
+static pthread_once_t selection = PTHREAD_ONCE_INIT;
+
+static void select_kernel(void) {
+    const char *wanted = getenv("PHILO_KERNEL");
+
+    selected_kernel = q_row_min_scalar;
+    selected_kernel_f32 = q_row_min_scalar_f32;
+    selected_name = "scalar";
+    if (wanted != NULL && strcmp(wanted, "scalar") == 0)
+        return;
+
+#ifdef HAVE_X86_KERNELS
+    selected_kernel = q_row_min_sse2;
+    selected_kernel_f32 = q_row_min_sse2_f32;
+    selected_name = "sse2";
+    if (wanted != NULL && strcmp(wanted, "sse2") == 0)
+        return;
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        selected_kernel = q_row_min_avx2;
+        selected_kernel_f32 = q_row_min_avx2_f32;
+        selected_name = "avx2";
+    }
+#endif
+    debug("Q row kernel: %s", selected_name);
+}
+
+Q_ROW_KERNEL q_row_kernel(void) {
+    pthread_once(&selection, select_kernel);
+    return selected_kernel;
+}
+
+Q_ROW_KERNEL_F32 q_row_kernel_f32(void) {
+    pthread_once(&selection, select_kernel);
+    return selected_kernel_f32;
+}
+
+const char *q_row_kernel_name(void) {
+    pthread_once(&selection, select_kernel);
+    return selected_name;
+}
@@ -0,0 +1,909 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "context.h"
+#include "debug.h"
+#include "qkernel.h"
+#include "qsearch.h"
+#include "placement.h"
+
+/*
+ * A pair whose Q value came within the tie tolerance of the best one, to
+ * be scored again with exact row sums (see settle_ties()).
+ */
+typedef struct tied_pair {
+    double q_val;
+    int pos_i;
+    int pos_j;
+} TIED_PAIR;
+
+/*
+ * Best pair found by a scan of some band of rows.  The Q value starts out
+ * at infinity and only a pair with a smaller value counts as found.
+ */
+typedef struct scan_result {
+    double q_val;
+    int pos_i;
+    int pos_j;
+    int found;
+    long scored;                    /* pairs scored, counted by the rapid search only */
+
+    /*
+     * The pairs offered whose Q values came within the tie tolerance of the
+     * best one, among them the best one itself (see keep_tie()), in room
+     * for max_ties of them, and whether more of them had to be let go.
+     */
+    TIED_PAIR *ties;
+    int num_ties;
+    int max_ties;
+    int overflow;
+} SCAN_RESULT;
+
+static void init_result(SCAN_RESULT *result) {
+    result->q_val = INFINITY;
+    result->pos_i = 0;
+    result->pos_j = 1;
+    result->found = 0;
+    result->scored = 0;
+    result->num_ties = 0;
+    result->overflow = 0;
+}
+
+/* Offer a pair to a result, keeping the smaller Q value and, on ties, the earlier pair. */
+static void offer_pair(SCAN_RESULT *result, double q_val, int first, int second) {
+    if (result->q_val > q_val || (result->found && result->q_val == q_val
+            && (first < result->pos_i || (first == result->pos_i && second < result->pos_j)))) {
+        result->q_val = q_val;
+        result->pos_i = first;
+        result->pos_j = second;
+        result->found = 1;
+    }
+}
+
+/* Let go of the pairs kept as ties whose Q values are above the limit. */
+static void prune_ties(SCAN_RESULT *result, double limit) {
+    int kept = 0;
+    for (int k = 0; k < result->num_ties; k++) {
+        if ((result->ties + k)->q_val <= limit) {
+            *(result->ties + kept) = *(result->ties + k);
+            kept++;
+        }
+    }
+    result->num_ties = kept;
+}
+
+/*
+ * Keep a pair offered to a result if its Q value is within the tolerance
+ * of the best one so far.  The best value only goes down, so every pair
+ * that ends up within the tolerance of the last one is kept, along with
+ * some that do not.  Those are let go when the room runs out, and if that
+ * frees less than half of it, the result is marked as having overflowed,
+ * and no more pairs are kept.  With no room at all (max_ties 0), none are.
+ */
+static void keep_tie(SCAN_RESULT *result, double q_val, int first, int second, double tolerance) {
+    if (result->overflow || !(q_val <= result->q_val + tolerance))
+        return;
+    if (result->num_ties == result->max_ties) {
+        prune_ties(result, result->q_val + tolerance);
+        if (result->num_ties >= result->max_ties / 2) {
+            result->overflow = 1;
+            return;
+        }
+    }
+    TIED_PAIR *tie = result->ties + result->num_ties;
+    tie->q_val = q_val;
+    tie->pos_i = first;
+    tie->pos_j = second;
+    result->num_ties++;
+}
+
+/*
+ * The search keeps its state in the context of the run (see context.h),
+ * allocated by qsearch_init() and released by qsearch_fini(), so that
+ * several runs can search at once.  The functions below reach it through
+ * a local pointer, search, taken from the current context.
+ */
+typedef struct search_band SEARCH_BAND;
+
+typedef struct qsearch_state {
+    /* Kernels used to evaluate rows of Q values, chosen once by qsearch_init(). */
+    Q_ROW_KERNEL row_kernel;
+    Q_ROW_KERNEL_F32 row_kernel_f32;
+
+    /* The thread pool (see run_bands()). */
+    int num_workers;
+    pthread_t *workers;
+    SEARCH_BAND *bands;
+    int *split;
+    void *caller_cpus;              /* to put back, if the calling thread was bound to a node */
+    pthread_mutex_t pool_lock;
+    pthread_barrier_t start_barrier;
+    pthread_barrier_t done_barrier;
+    int search_kind;
+    double search_r_max;
+
+    /* How close to the best Q value another one counts as a tie (see tie_tolerance()). */
+    double tie_tolerance;
+
+    /* Row sums added up afresh by settle_ties(), by position, NAN where not yet. */
+    double *exact_sums;
+
+    /* Room for the pairs kept as ties in the result of each band. */
+    int max_ties;
+
+    /*
+     * Sorted rows of the rapid search, indexed by node.  The row of a node
+     * holds its distances to the nodes that were active when it was created
+     * (all other leaves, for a leaf), so every pair of active nodes appears
+     * in the row of at least one of them.  Entries for nodes that have since
+     * been joined are skipped, and squeezed out once they make up most of
+     * what a scan looks at.
+     */
+    struct sorted_entry **sorted_rows;
+    int *sorted_len;
+
+    /* Number of entries allocated for each sorted row, for the counters of --stats. */
+    int *sorted_alloc;
+
+    /* Position of each node in active_node_map, or -1 if it is not active. */
+    int *node_pos;
+
+    /* Best pairs of the relaxed search (see relaxed_pairs()). */
+    struct relaxed_pair *relaxed;
+} QSEARCH_STATE;
+
+/*
+ * Score every pair (i, j) with lo <= j < hi and i < j.  The packed row j
+ * holds the distances from position j to all the positions before it,
+ * contiguously, so the kernel evaluates them against the row sums at those
+ * positions.  Since the pairs are visited by their second position, a row
+ * is also reported when its minimum only ties the best value so far, and
+ * offer_pair() then keeps whichever pair comes first.  So is a row whose
+ * minimum comes within the tie tolerance of it.  The kernel only reports
+ * the first minimum of a row, so once the best value of the band is known,
+ * the rows whose minima are within the tolerance of it are looked over
+ * again for the other pairs that are.
+ */
+static void exhaustive_scan(int lo, int hi, SCAN_RESULT *result) {
+    PHILO_CONTEXT *ctx = current_context;
+    QSEARCH_STATE *search = ctx->search;
+    double scale = ctx->num_active_nodes-2;
+
+    init_result(result);
+    for (int j = lo; j < hi; j++) {
+        if (j == 0)
+            continue;
+
+        double row_min;
+        double threshold = nextafter(result->q_val + search->tie_tolerance, INFINITY);
+        int i;
+        if (ctx->float_distances != NULL)
+            i = search->row_kernel_f32(ctx->float_distances + tri_index(j, 0), ctx->row_sums, j, scale,
+                                       *(ctx->row_sums + j), threshold, &row_min);
+        else
+            i = search->row_kernel(tri_row(ctx->distances, j), ctx->row_sums, j, scale, *(ctx->row_sums + j),
+                                   threshold, &row_min);
+        if (i >= 0) {                                      // calculating Q value
+            offer_pair(result, row_min, i, j);
+            keep_tie(result, row_min, i, j, search->tie_tolerance);
+        }
+    }
+
+    // the pairs kept are the minima of their rows, at most one per row
+    double limit = result->q_val + search->tie_tolerance;
+    prune_ties(result, limit);
+    int rows = result->num_ties;
+    for (int k = 0; k < rows && !result->overflow; k++) {
+        int first = (result->ties + k)->pos_i;
+        int j = (result->ties + k)->pos_j;
+        double r_j = *(ctx->row_sums + j);
+        for (int i = 0; i < j; i++) {
+            if (i != first)
+                keep_tie(result, scale * get_distance(i, j) - *(ctx->row_sums + i) - r_j, i, j,
+                         search->tie_tolerance);
+        }
+    }
+}
+
+static void rapid_scan(int lo, int hi, double r_max, SCAN_RESULT *result);
+static void relaxed_scan(int lo, int hi, double *best_q, int *best);
+
+/*
+ * Thread pool for the search.  The calling thread works on the first band
+ * of rows itself, and num_workers - 1 helper threads take the others.
+ * Each band is scanned into its own SCAN_RESULT, and the results are then
+ * reduced in band order.  Because the bands are contiguous ranges of rows
+ * and a band's result only replaces an earlier one when its Q value is
+ * strictly smaller, the pair chosen does not depend on the number of threads.
+ */
+#define SEARCH_EXHAUSTIVE 0
+#define SEARCH_RAPID      1
+#define SEARCH_RELAXED    2
+#define SEARCH_QUIT       3
+
+/* Below this many pairs, the search is not worth handing out to threads. */
+#define MIN_PARALLEL_PAIRS 20000
+
+struct search_band {
+    int lo;
+    int hi;
+    SCAN_RESULT result;
+    double *best_q;                 /* for the relaxed search, by position */
+    int *best;
+    int node;                       /* to bind the thread to, or -1 (see placement.h) */
+    PHILO_CONTEXT *context;         /* of the run, for the helper thread */
+};
+
+
+static void scan_band(SEARCH_BAND *band) {
+    QSEARCH_STATE *search = current_context->search;
+    if (search->search_kind == SEARCH_RAPID)
+        rapid_scan(band->lo, band->hi, search->search_r_max, &band->result);
+    else if (search->search_kind == SEARCH_RELAXED)
+        relaxed_scan(band->lo, band->hi, band->best_q, band->best);
+    else
+        exhaustive_scan(band->lo, band->hi, &band->result);
+}
+
+static void *search_worker(void *arg) {
+    SEARCH_BAND *band = arg;
+    current_context = band->context;
+    QSEARCH_STATE *search = current_context->search;
+    if (band->node >= 0)
+        placement_bind(band->node, NULL);
+
+    // wait until the pool is complete and the barriers are set up
+    pthread_mutex_lock(&search->pool_lock);
+    pthread_mutex_unlock(&search->pool_lock);
+
+    while (1) {
+        pthread_barrier_wait(&search->start_barrier);
+        if (search->search_kind == SEARCH_QUIT)
+            break;
+        scan_band(band);
+        pthread_barrier_wait(&search->done_barrier);
+    }
+    return NULL;
+}
+
+/**
+ * @brief  Set up the search for a run of build_taxonomy.
+ * @details  Allocates the state of the search in the current context,
+ * chooses the kernel for evaluating rows of Q values and starts the thread
+ * pool.
+ * If fewer threads than requested can be created, the pool just runs with
+ * the ones that could; the results do not depend on the number of threads.
+ * If the rows of the matrix were placed on the NUMA nodes of the bands
+ * (see placement.h), each thread, the calling one included, is bound to
+ * the node of its band until qsearch_fini().
+ *
+ * @param threads  The total number of threads to search with, including
+ * the calling thread.
+ * @return 0 if successful, -1 if memory could not be allocated.
+ */
+int qsearch_init(int threads) {
+    PHILO_CONTEXT *ctx = current_context;
+    if (threads < 1)
+        threads = 1;
+
+    QSEARCH_STATE *search = ctx->search = calloc(1, sizeof(QSEARCH_STATE));
+    if (search == NULL)
+        return -1;
+    pthread_mutex_init(&search->pool_lock, NULL);
+    search->num_workers = 1;
+    search->row_kernel = q_row_kernel();
+    search->row_kernel_f32 = q_row_kernel_f32();
+    search->bands = malloc(threads * sizeof(SEARCH_BAND));
+    search->workers = malloc(threads * sizeof(pthread_t));
+    search->split = malloc((threads + 1) * sizeof(int));
+    if (search->bands == NULL || search->workers == NULL || search->split == NULL) {
+        qsearch_fini();
+        return -1;
+    }
+    for (int t = 0; t < threads; t++) {
+        (search->bands + t)->best_q = NULL;
+        (search->bands + t)->best = NULL;
+        (search->bands + t)->result.ties = NULL;
+        (search->bands + t)->node = ctx->matrix_nodes > 1 ? placement_node(t, threads) : -1;
+        (search->bands + t)->context = current_context;
+    }
+    if (search->bands->node >= 0)
+        placement_bind(search->bands->node, &search->caller_cpus);
+
+    pthread_mutex_lock(&search->pool_lock);
+    for (search->num_workers = 1; search->num_workers < threads; search->num_workers++) {
+        if (pthread_create(search->workers + search->num_workers, NULL, search_worker,
+                           search->bands + search->num_workers))
+            break;
+    }
+    if (search->num_workers > 1) {
+        pthread_barrier_init(&search->start_barrier, NULL, search->num_workers);
+        pthread_barrier_init(&search->done_barrier, NULL, search->num_workers);
+    }
+    pthread_mutex_unlock(&search->pool_lock);
+
+    // room for the pairs within the tie tolerance of the best one, a few per active node in each band
+    int max_ties = search->max_ties = 4 * ctx->num_taxa + 64;
+    search->exact_sums = malloc(ctx->num_taxa * sizeof(double));
+    if (search->exact_sums == NULL) {
+        qsearch_fini();
+        return -1;
+    }
+    for (int p = 0; p < ctx->num_taxa; p++)
+        *(search->exact_sums + p) = NAN;
+    for (int t = 0; t < search->num_workers; t++) {
+        SCAN_RESULT *result = &(search->bands + t)->result;
+        if ((result->ties = malloc(max_ties * sizeof(TIED_PAIR))) == NULL) {
+            qsearch_fini();
+            return -1;
+        }
+        stats_hold(max_ties * sizeof(TIED_PAIR));
+    }
+    return 0;
+}
+
+/* Stop the thread pool and release the state of the search. */
+void qsearch_fini(void) {
+    PHILO_CONTEXT *ctx = current_context;
+    QSEARCH_STATE *search = ctx->search;
+    if (search == NULL)
+        return;
+    if (search->num_workers > 1) {
+        search->search_kind = SEARCH_QUIT;
+        pthread_barrier_wait(&search->start_barrier);
+        for (int t = 1; t < search->num_workers; t++)
+            pthread_join(search->workers[t], NULL);
+        pthread_barrier_destroy(&search->start_barrier);
+        pthread_barrier_destroy(&search->done_barrier);
+    }
+    for (int t = 0; search->bands != NULL && t < search->num_workers; t++) {
+        free((search->bands + t)->best_q);
+        free((search->bands + t)->best);
+        if ((search->bands + t)->result.ties != NULL)
+            stats_release(search->max_ties * sizeof(TIED_PAIR));
+        free((search->bands + t)->result.ties);
+    }
+    free(search->exact_sums);
+    placement_restore(search->caller_cpus);
+    free(search->relaxed);
+    free(search->workers);
+    free(search->bands);
+    free(search->split);
+    pthread_mutex_destroy(&search->pool_lock);
+    free(ctx->search);
+    ctx->search = NULL;
+}
+
+void qsearch_split(int n, int count, int *bounds) {
+    // packed row j pairs position j with the j positions before it
+    long pairs = (long)n * (n - 1) / 2;
+    long done = 0;
+    int row = 0;
+    for (int t = 0; t < count; t++) {
+        long target = pairs * (t + 1) / count;
+        *(bounds + t) = row;
+        while (row < n && (done < target || t == count - 1)) {
+            done += row;
+            row++;
+        }
+    }
+    *(bounds + count) = row;
+}
+
+/*
+ * Run a search over all active rows, in parallel if the thread pool is
+ * running and there is enough work, and count the pairs it scored: all of
+ * them, but for the rapid search.  Returns the number of bands scanned.
+ */
+static int run_bands(int kind, double r_max) {
+    PHILO_CONTEXT *ctx = current_context;
+    QSEARCH_STATE *search = ctx->search;
+    int n = ctx->num_active_nodes;
+    long pairs = (long)n * (n - 1) / 2;
+    int num_bands = 1;
+
+    search->search_kind = kind;
+    search->search_r_max = r_max;
+
+    if (search->num_workers <= 1 || pairs < MIN_PARALLEL_PAIRS) {
+        search->bands->lo = 0;
+        search->bands->hi = n;
+        scan_band(search->bands);
+    }
+    else {
+        qsearch_split(n, search->num_workers, search->split);
+        for (int t = 0; t < search->num_workers; t++) {
+            (search->bands + t)->lo = *(search->split + t);
+            (search->bands + t)->hi = *(search->split + t + 1);
+        }
+
+        pthread_barrier_wait(&search->start_barrier);
+        scan_band(search->bands);
+        pthread_barrier_wait(&search->done_barrier);
+        num_bands = search->num_workers;
+    }
+
+    if (kind == SEARCH_RAPID) {
+        pairs = 0;
+        for (int t = 0; t < num_bands; t++)
+            pairs += (search->bands + t)->result.scored;
+    }
+    ctx->stats.pairs_scored += pairs;
+    return num_bands;
+}
+
+/*
+ * The row sums that join_active() patches can be off from sums added up
+ * afresh in their last bits, which grows with the number of joins since
+ * they were.  Q values closer than that to the best one are taken as
+ * ties (see qsearch.h).  The error of a Q value is bounded by that of the
+ * two row sums it takes, and the error of a patched sum by the largest
+ * magnitude the sums have had since they were added up afresh, which can
+ * be well above the current ones late in a build; so the tolerance is a
+ * multiple of row_sums_scale, kept up to date here.
+ */
+#define TIE_TOLERANCE 1e-9
+
+static double tie_tolerance(void) {
+    PHILO_CONTEXT *ctx = current_context;
+    for (int p = 0; p < ctx->num_active_nodes; p++) {
+        double r = fabs(*(ctx->row_sums + p));
+        if (r > ctx->row_sums_scale)
+            ctx->row_sums_scale = r;
+    }
+    return TIE_TOLERANCE * ctx->row_sums_scale;
+}
+
+/*
+ * Break a near tie: score the pairs the bands kept within the tie
+ * tolerance of the best one again, with the row sums of their positions
+ * added up afresh, and make the best of them by those values, the earlier
+ * on ties, the best pair.  Each sum is added up once, so this takes
+ * O(n) for each position the pairs are at.
+ */
+static void settle_ties(SCAN_RESULT *best, int num_bands) {
+    PHILO_CONTEXT *ctx = current_context;
+    QSEARCH_STATE *search = ctx->search;
+    double limit = best->q_val + search->tie_tolerance;
+    double scale = ctx->num_active_nodes-2;
+    SCAN_RESULT settled;
+    init_result(&settled);
+
+    for (int t = 0; t < num_bands; t++) {
+        SCAN_RESULT *result = &(search->bands + t)->result;
+        for (int k = 0; k < result->num_ties; k++) {
+            TIED_PAIR *tie = result->ties + k;
+            if (!(tie->q_val <= limit))
+                continue;
+            double *sum_i = search->exact_sums + tie->pos_i;
+            double *sum_j = search->exact_sums + tie->pos_j;
+            if (isnan(*sum_i) || isnan(*sum_j))
+                exact_row_sums(tie->pos_i, tie->pos_j, sum_i, sum_j);
+            offer_pair(&settled, scale * get_distance(tie->pos_i, tie->pos_j) - *sum_i - *sum_j,
+                       tie->pos_i, tie->pos_j);
+        }
+    }
+    for (int t = 0; t < num_bands; t++) {
+        SCAN_RESULT *result = &(search->bands + t)->result;
+        for (int k = 0; k < result->num_ties; k++) {
+            *(search->exact_sums + (result->ties + k)->pos_i) = NAN;
+            *(search->exact_sums + (result->ties + k)->pos_j) = NAN;
+        }
+    }
+
+    if (settled.found) {
+        best->pos_i = settled.pos_i;
+        best->pos_j = settled.pos_j;
+    }
+}
+
+/*
+ * Run a search for the best pair, reduce the band results in band order,
+ * and, if settle is set, break a near tie with settle_ties().  Returns -1
+ * if some band had more pairs within the tie tolerance than it could
+ * keep, with the best pair by the patched row sums, otherwise 0.  Without
+ * settle, as once the row sums have all been added up afresh, no ties
+ * are kept, and the best pair is just the first with the smallest value.
+ */
+static int run_search(int kind, double r_max, int settle, int *pos_i, int *pos_j) {
+    QSEARCH_STATE *search = current_context->search;
+    search->tie_tolerance = settle ? tie_tolerance() : 0.0;
+    for (int t = 0; t < search->num_workers; t++)
+        (search->bands + t)->result.max_ties = settle ? search->max_ties : 0;
+    int num_bands = run_bands(kind, r_max);
+    SCAN_RESULT best = search->bands->result;
+
+    if (num_bands > 1) {
+        init_result(&best);
+        for (int t = 0; t < num_bands; t++) {
+            SCAN_RESULT *result = &(search->bands + t)->result;
+            if (result->found)
+                offer_pair(&best, result->q_val, result->pos_i, result->pos_j);
+        }
+    }
+    *pos_i = best.pos_i;
+    *pos_j = best.pos_j;
+    if (!settle)
+        return 0;
+
+    // only a band whose best pair is near enough can hold pairs that tie
+    double limit = best.q_val + search->tie_tolerance;
+    int tied = 0;
+    for (int t = 0; t < num_bands; t++) {
+        SCAN_RESULT *result = &(search->bands + t)->result;
+        if (!(result->q_val <= limit))
+            continue;
+        if (result->overflow)
+            return -1;
+        for (int k = 0; k < result->num_ties; k++) {
+            TIED_PAIR *tie = result->ties + k;
+            if (tie->q_val <= limit && (tie->pos_i != best.pos_i || tie->pos_j != best.pos_j))
+                tied = 1;
+        }
+    }
+    if (tied) {
+        settle_ties(&best, num_bands);
+        *pos_i = best.pos_i;
+        *pos_j = best.pos_j;
+    }
+    return 0;
+}
+
+/**
+ * @brief  Find the pair of active nodes with the minimum Q value.
+ * @details  Every pair of positions (i, j) with i < j in active_node_map
+ * is scored, and the first pair (in row-major order) having the smallest
+ * Q value is returned.
+ *
+ * @param pos_i  Set to the first position of the pair.
+ * @param pos_j  Set to the second position of the pair.
+ */
+void exhaustive_min_q(int *pos_i, int *pos_j) {
+    if (run_search(SEARCH_EXHAUSTIVE, 0.0, 1, pos_i, pos_j)) {
+        // too many near ties to keep: add up all the row sums afresh, and search with them
+        init_row_sums();
+        run_search(SEARCH_EXHAUSTIVE, 0.0, 0, pos_i, pos_j);
+    }
+}
+
+/*
+ * An entry of a sorted row: the distance to another node, and that node.
+ */
+typedef struct sorted_entry {
+    double dist;
+    int node;
+} SORTED_ENTRY;
+
+static int compare_entries(const void *a, const void *b) {
+    double da = ((const SORTED_ENTRY *)a)->dist;
+    double db = ((const SORTED_ENTRY *)b)->dist;
+    return (da > db) - (da < db);
+}
+
+/*
+ * Build the sorted row of an active node, whose position must already be
+ * recorded in node_pos, from its distances to the other active nodes.
+ */
+static int build_sorted_row(int node) {
+    PHILO_CONTEXT *ctx = current_context;
+    QSEARCH_STATE *search = ctx->search;
+    SORTED_ENTRY *row = malloc(ctx->num_active_nodes * sizeof(SORTED_ENTRY));
+    if (row == NULL)
+        return -1;
+
+    int len = 0;
+    int p = 0;
+    int pos = *(search->node_pos + node);
+    while (*(ctx->active_node_map + p) != -2) {
+        int k = *(ctx->active_node_map + p);
+        if (k != node) {
+            (row + len)->dist = get_distance(pos, p);
+            (row + len)->node = k;
+            len++;
+        }
+        p++;
+    }
+    qsort(row, len, sizeof(SORTED_ENTRY), compare_entries);
+
+    *(search->sorted_rows + node) = row;
+    *(search->sorted_len + node) = len;
+    *(search->sorted_alloc + node) = ctx->num_active_nodes;
+    stats_hold(ctx->num_active_nodes * sizeof(SORTED_ENTRY));
+    return 0;
+}
+
+static void free_sorted_row(int node) {
+    QSEARCH_STATE *search = current_context->search;
+    free(*(search->sorted_rows + node));
+    stats_release(*(search->sorted_alloc + node) * sizeof(SORTED_ENTRY));
+    *(search->sorted_rows + node) = NULL;
+    *(search->sorted_len + node) = 0;
+    *(search->sorted_alloc + node) = 0;
+}
+
+/* Record the position of every active node. */
+static void update_positions(void) {
+    PHILO_CONTEXT *ctx = current_context;
+    QSEARCH_STATE *search = ctx->search;
+    int p = 0;
+    while (*(ctx->active_node_map + p) != -2) {
+        *(search->node_pos + *(ctx->active_node_map + p)) = p;
+        p++;
+    }
+}
+
+int rapid_init(void) {
+    PHILO_CONTEXT *ctx = current_context;
+    QSEARCH_STATE *search = ctx->search;
+    search->sorted_rows = calloc(ctx->node_capacity, sizeof(SORTED_ENTRY *));
+    search->sorted_len = calloc(ctx->node_capacity, sizeof(int));
+    search->sorted_alloc = calloc(ctx->node_capacity, sizeof(int));
+    search->node_pos = malloc(ctx->node_capacity * sizeof(int));
+    if (search->sorted_rows == NULL || search->sorted_len == NULL || search->sorted_alloc == NULL
+        || search->node_pos == NULL) {
+        rapid_fini();
+        return -1;
+    }
+
+    for (int k = 0; k < ctx->node_capacity; k++)
+        *(search->node_pos + k) = -1;
+    update_positions();
+
+    int p = 0;
+    while (*(ctx->active_node_map + p) != -2) {
+        if (build_sorted_row(*(ctx->active_node_map + p))) {
+            rapid_fini();
+            return -1;
+        }
+        p++;
+    }
+    return 0;
+}
+
+/* The largest row sum of the active positions, which bounds the Q values of the rapid search. */
+static double max_row_sum(void) {
+    PHILO_CONTEXT *ctx = current_context;
+    double r_max = 0.0;
+    int p = 0;
+    while (*(ctx->active_node_map + p) != -2) {
+        double r = *(ctx->row_sums + p);
+        if (p == 0 || r > r_max)
+            r_max = r;
+        p++;
+    }
+    return r_max;
+}
+
+/*
+ * Scan the sorted rows at positions lo <= p < hi.  The Q value of a pair
+ * is computed exactly as the exhaustive search does, with the row sum at
+ * the smaller position subtracted first, and the lower bound used to end
+ * the scan of a row is no larger than the Q value computed either way
+ * around.  The scan of a row stops only when the bound exceeds the best
+ * value by more than the tie tolerance, so pairs tying with it are still
+ * seen, and ties are then resolved by position, and so are those close
+ * enough to be kept for settle_ties().
+ */
+static void rapid_scan(int lo, int hi, double r_max, SCAN_RESULT *result) {
+    PHILO_CONTEXT *ctx = current_context;
+    QSEARCH_STATE *search = ctx->search;
+    // the tables of the context, loaded once rather than for every entry
+    const int *positions = search->node_pos;
+    const double *sums = ctx->row_sums;
+    double scale = ctx->num_active_nodes-2;
+
+    init_result(result);
+
+    for (int p = lo; p < hi; p++) {
+        int x = *(ctx->active_node_map + p);
+        SORTED_ENTRY *row = *(search->sorted_rows + x);
+        int len = *(search->sorted_len + x);
+        double r_x = *(sums + p);
+        int live = 0;
+        int dead = 0;
+
+        for (int e = 0; e < len; e++) {
+            int y = (row + e)->node;
+            int py = *(positions + y);
+            if (py < 0) {
+                dead++;
+                continue;
+            }
+            live++;
+
+            double scaled = scale * (row + e)->dist;
+            double bound = scaled - r_x - r_max;
+            double bound_swapped = scaled - r_max - r_x;
+            if (bound_swapped < bound)
+                bound = bound_swapped;
+            if (bound > result->q_val + search->tie_tolerance)
+                break;
+
+            int first = p < py ? p : py;
+            int second = p < py ? py : p;
+            double temp = scaled - *(sums + first) - *(sums + second);
+            offer_pair(result, temp, first, second);
+            keep_tie(result, temp, first, second, search->tie_tolerance);
+            result->scored++;
+        }
+
+        if (dead > live) {                                  // squeeze out entries for joined nodes
+            int kept = 0;
+            for (int e = 0; e < len; e++) {
+                if (*(positions + (row + e)->node) >= 0) {
+                    *(row + kept) = *(row + e);
+                    kept++;
+                }
+            }
+            *(search->sorted_len + x) = kept;
+        }
+    }
+}
+
+/**
+ * @brief  Find the pair of active nodes with the minimum Q value, using
+ * the sorted rows to avoid scoring most of the pairs.
+ * @details  This yields exactly the pair the exhaustive search would pick.
+ * When the search runs on several threads, each band of rows is bounded
+ * by the best value found in that band, which is never below the overall
+ * best, so no pair that could win is skipped.
+ *
+ * @param pos_i  Set to the first position of the pair.
+ * @param pos_j  Set to the second position of the pair.
+ */
+void rapid_min_q(int *pos_i, int *pos_j) {
+    if (run_search(SEARCH_RAPID, max_row_sum(), 1, pos_i, pos_j)) {
+        // too many near ties to keep, as in exhaustive_min_q()
+        init_row_sums();
+        run_search(SEARCH_RAPID, max_row_sum(), 0, pos_i, pos_j);
+    }
+}
+
+int rapid_join(int ind_i, int ind_j, int new_node) {
+    QSEARCH_STATE *search = current_context->search;
+    free_sorted_row(ind_i);
+    free_sorted_row(ind_j);
+
+    *(search->node_pos + ind_i) = -1;
+    *(search->node_pos + ind_j) = -1;
+    *(search->node_pos + new_node) = -1;
+    update_positions();
+
+    if (*(search->node_pos + new_node) < 0)
+        return 0;
+    return build_sorted_row(new_node);
+}
+
+void rapid_fini(void) {
+    PHILO_CONTEXT *ctx = current_context;
+    QSEARCH_STATE *search = ctx->search;
+    if (search == NULL)
+        return;
+    if (search->sorted_rows != NULL && search->sorted_len != NULL && search->sorted_alloc != NULL) {
+        for (int k = 0; k < ctx->node_capacity; k++)
+            free_sorted_row(k);
+    }
+    free(search->sorted_rows);
+    free(search->sorted_len);
+    free(search->sorted_alloc);
+    free(search->node_pos);
+    search->sorted_rows = NULL;
+    search->sorted_len = NULL;
+    search->sorted_alloc = NULL;
+    search->node_pos = NULL;
+}
+
+/*
+ * A pair of positions that are each other's best partner, and its Q value.
+ */
+typedef struct relaxed_pair {
+    double q_val;
+    int pos_i;
+    int pos_j;
+} RELAXED_PAIR;
+
+/*
+ * Score every pair (i, j) with lo <= j < hi and i < j, with the Q value
+ * computed as the exhaustive search does, and keep for each position p the
+ * smallest Q value of the pairs it is in and the other position of that
+ * pair.  Rows are visited in increasing order and the pairs of a row by
+ * their first position, so a pair only replaces one with the same value
+ * that comes later in row-major order when it has a smaller value, and
+ * ties go to the pair that comes first, as in the full search.
+ */
+static void relaxed_scan(int lo, int hi, double *best_q, int *best) {
+    PHILO_CONTEXT *ctx = current_context;
+    const double *sums = ctx->row_sums;
+    double scale = ctx->num_active_nodes-2;
+
+    for (int p = 0; p < ctx->num_active_nodes; p++) {
+        *(best_q + p) = INFINITY;
+        *(best + p) = -1;
+    }
+    for (int j = lo; j < hi; j++) {
+        const float *frow = ctx->float_distances != NULL ? ctx->float_distances + tri_index(j, 0) : NULL;
+        const double *row = frow == NULL ? tri_row(ctx->distances, j) : NULL;
+        double r_j = *(sums + j);
+        for (int i = 0; i < j; i++) {
+            double q = scale * (frow != NULL ? *(frow + i) : *(row + i)) - *(sums + i) - r_j;
+            if (q < *(best_q + j)) {
+                *(best_q + j) = q;
+                *(best + j) = i;
+            }
+            if (q < *(best_q + i)) {
+                *(best_q + i) = q;
+                *(best + i) = j;
+            }
+        }
+    }
+}
+
+static int compare_pairs(const void *a, const void *b) {
+    const RELAXED_PAIR *pa = a;
+    const RELAXED_PAIR *pb = b;
+    if (pa->q_val != pb->q_val)
+        return pa->q_val < pb->q_val ? -1 : 1;
+    return pa->pos_i - pb->pos_i;
+}
+
+/**
+ * @brief  Find the pairs of active nodes that are each other's best partner.
+ * @details  Every pair is scored once, and each position gets the partner
+ * of its pair with the smallest Q value.  Positions that are each other's
+ * partner make a pair to be joined.  No two pairs share a node, and the
+ * pair exhaustive_min_q() would return is always one of them (unless no
+ * Q value is less than infinity, when there are none).  The pairs are
+ * stored in increasing order of Q value, as the two nodes of each, first
+ * the one at the smaller position.
+ *
+ * @param nodes_out  Room for num_active_nodes nodes.
+ * @return The number of pairs, or -1 if memory could not be allocated.
+ */
+int relaxed_pairs(int *nodes_out) {
+    PHILO_CONTEXT *ctx = current_context;
+    QSEARCH_STATE *search = ctx->search;
+    for (int t = 0; t < search->num_workers; t++) {
+        SEARCH_BAND *band = search->bands + t;
+        if (band->best_q == NULL)
+            band->best_q = malloc(ctx->num_taxa * sizeof(double));
+        if (band->best == NULL)
+            band->best = malloc(ctx->num_taxa * sizeof(int));
+        if (band->best_q == NULL || band->best == NULL)
+            return -1;
+    }
+    if (search->relaxed == NULL && (search->relaxed = malloc((ctx->num_taxa / 2 + 1) * sizeof(RELAXED_PAIR))) == NULL)
+        return -1;
+
+    // bands are reduced in band order, so a later band only wins with a smaller value
+    int num_bands = run_bands(SEARCH_RELAXED, 0.0);
+    double *best_q = search->bands->best_q;
+    int *best = search->bands->best;
+    for (int t = 1; t < num_bands; t++) {
+        SEARCH_BAND *band = search->bands + t;
+        for (int p = 0; p < ctx->num_active_nodes; p++) {
+            if (*(band->best_q + p) < *(best_q + p)) {
+                *(best_q + p) = *(band->best_q + p);
+                *(best + p) = *(band->best + p);
+            }
+        }
+    }
+
+    int count = 0;
+    for (int p = 0; p < ctx->num_active_nodes; p++) {
+        int partner = *(best + p);
+        if (partner > p && *(best + partner) == p) {
+            (search->relaxed + count)->q_val = *(best_q + p);
+            (search->relaxed + count)->pos_i = p;
+            (search->relaxed + count)->pos_j = partner;
+            count++;
+        }
+    }
+    qsort(search->relaxed, count, sizeof(RELAXED_PAIR), compare_pairs);
+
+    for (int k = 0; k < count; k++) {
+        *(nodes_out + 2 * k) = *(ctx->active_node_map + (search->relaxed + k)->pos_i);
+        *(nodes_out + 2 * k + 1) = *(ctx->active_node_map + (search->relaxed + k)->pos_j);
+    }
+    return count;
+}
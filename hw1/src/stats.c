@@ -0,0 +1,63 @@
+#include <time.h>
+
+#include "context.h"
+#include "debug.h"
+#include "stats.h"
+
+
+static double seconds_between(struct timespec *from, struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+void stats_start(PHASE_CLOCK *clock) {
+    PHILO_CONTEXT *ctx = current_context;
+    if (!(ctx->global_options & PHILO_STATS))
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &clock->wall);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &clock->cpu);
+}
+
+void stats_stop(PHASE_CLOCK *clock, PHASE_TIME *phase) {
+    PHILO_CONTEXT *ctx = current_context;
+    if (!(ctx->global_options & PHILO_STATS))
+        return;
+    PHASE_CLOCK now;
+    clock_gettime(CLOCK_MONOTONIC, &now.wall);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now.cpu);
+    phase->wall += seconds_between(&clock->wall, &now.wall);
+    phase->cpu += seconds_between(&clock->cpu, &now.cpu);
+}
+
+void stats_hold(size_t bytes) {
+    PHILO_CONTEXT *ctx = current_context;
+    ctx->stats.matrix_bytes += bytes;
+    if (ctx->stats.matrix_bytes > ctx->stats.peak_matrix_bytes)
+        ctx->stats.peak_matrix_bytes = ctx->stats.matrix_bytes;
+}
+
+void stats_release(size_t bytes) {
+    PHILO_CONTEXT *ctx = current_context;
+    ctx->stats.matrix_bytes -= bytes < ctx->stats.matrix_bytes ? bytes : ctx->stats.matrix_bytes;
+}
+
+static void report_phase(FILE *out, const char *name, PHASE_TIME *phase) {
+    fprintf(out, "\"%s\":{\"wall\":%.6f,\"cpu\":%.6f}", name, phase->wall, phase->cpu);
+}
+
+static const char *alloc_names[] = ALLOC_NAMES;
+
+void stats_report(FILE *out) {
+    PHILO_CONTEXT *ctx = current_context;
+    fprintf(out, "{\"taxa\":%d,\"threads\":%d,\"phases\":{", ctx->num_taxa, ctx->num_threads);
+    report_phase(out, "read", &ctx->stats.read);
+    fputc(',', out);
+    report_phase(out, "search", &ctx->stats.search);
+    fputc(',', out);
+    report_phase(out, "update", &ctx->stats.update);
+    fputc(',', out);
+    report_phase(out, "output", &ctx->stats.output);
+    fprintf(out, "},\"pairs_scored\":%ld,\"joins\":%ld,\"passes\":%d,\"matrix_alloc\":\"%s\",\"numa_nodes\":%d,"
+            "\"peak_matrix_bytes\":%zu,\"bytes_written\":%ld}\n",
+            ctx->stats.pairs_scored, ctx->stats.joins, ctx->num_passes, *(alloc_names + ctx->matrix_alloc),
+            ctx->matrix_nodes > 1 ? ctx->matrix_nodes : 1, ctx->stats.peak_matrix_bytes, ctx->stats.bytes_written);
+}
@@ -1,95 +1,280 @@
 #include <stdlib.h>
 
 #include "global.h"
+#include "context.h"
 #include "debug.h"
+#include "options.h"
 
-/**
- * @brief Validates command line arguments passed to the program.
- * @details This function will validate all the arguments passed to the
- * program, returning 0 if validation succeeds and -1 if validation fails.
- * Upon successful return, the various options that were specified will be
- * encoded in the global variable 'global_options', where it will be
- * accessible elsewhere in the program.  For details of the required
- * encoding, see the assignment handout.
- *
- * @param argc The number of arguments passed to the program from the CLI.
- * @param argv The argument strings passed to the program from the CLI.
- * @return 0 if validation succeeds and -1 if validation fails.
- * @modifies global variable "global_options" to contain an encoded representation
- * of the selected program options.
+int thread_count;
+char *matrix_path;
+char *checkpoint_path;
+int checkpoint_seconds;
+char *batch_manifest;
+char *insert_tree;
+int bootstrap_replicates;
+
+/* Check whether a command-line argument is exactly the given option string. */
+static int is_option(char *arg, char *option)
+{
+    while (*arg != '\0' && *arg == *option) {
+        arg++;
+        option++;
+    }
+    return *arg == *option;
+}
+
+/*
+ * Convert a command-line argument to a positive count no larger than max.
+ * Returns -1 if the argument is not a decimal number in that range.
  */
-int validargs(int argc, char **argv)
+static int parse_count(char *arg, int max)
+{
+    int value = 0;
+    if (*arg == '\0')
+        return -1;
+    while (*arg != '\0') {
+        if (*arg < '0' || *arg > '9')
+            return -1;
+        value = value * 10 + (*arg - '0');
+        if (value > max)
+            return -1;
+        arg++;
+    }
+    return value > 0 ? value : -1;
+}
+
+/*
+ * Parse the command line into global_options, outlier_name and the
+ * variables of options.h.  Returns 0 if it is valid, -1 otherwise.
+ */
+static int parse_args(int argc, char **argv)
 {
     // failure
     if (argc < 1) {
         return -1;
     }
 
-    else if (argc == 1)
-        return 0;
-
-    // success
-    else {
-        if (*(*(argv + 1)) == 45) {  // -
+    global_options = 0;
+    outlier_name = NULL;
+    matrix_path = NULL;
+    checkpoint_path = NULL;
+    checkpoint_seconds = CHECKPOINT_INTERVAL;
+    batch_manifest = NULL;
+    insert_tree = NULL;
+    bootstrap_replicates = 0;
+    thread_count = 1;
 
-            // -h
-            if (*(*(argv + 1)+1) == 104 && *(*(argv + 1)+2) == 0) {
-                global_options = HELP_OPTION;
-                return 0;
-            }
+    if (argc == 1)
+        return 0;
 
-            // -m
-            else if (*(*(argv + 1)+1) == 109 && *(*(argv + 1)+2) == 0) {
+    // -h must come first, and then everything after it is ignored
+    if (is_option(*(argv + 1), "-h")) {
+        global_options = HELP_OPTION;
+        return 0;
+    }
 
-                // something after -m
-                if (argc > 2) {
-                    return -1;
-                }
+    int interval_given = 0;
+    for (int i = 1; i < argc; i++) {
+        char *arg = *(argv + i);
 
-                // nothing after -m
-                else {
-                    global_options = MATRIX_OPTION;
-                    return 0;
-                }
-            }
+        // -m, -n or -c, at most one of them
+        if (is_option(arg, "-m") || is_option(arg, "-n") || is_option(arg, "-c")) {
+            if (global_options & (MATRIX_OPTION | NEWICK_OPTION | CONVERT_OPTION))
+                return -1;
+            global_options |= is_option(arg, "-m") ? MATRIX_OPTION
+                : is_option(arg, "-n") ? NEWICK_OPTION : CONVERT_OPTION;
+        }
 
-            // -n
-            else if (*(*(argv + 1)+1) == 110 && *(*(argv + 1)+2) == 0) {
+        // -o <name>, only after -n
+        else if (is_option(arg, "-o")) {
+            if (!(global_options & NEWICK_OPTION) || outlier_name != NULL || i + 1 == argc)
+                return -1;
+            i++;
+            outlier_name = *(argv + i);
+        }
 
-                // -n 'none'
-                if (argc == 2) {
-                    global_options = NEWICK_OPTION;
-                    return 0;
-                }
+        // -r
+        else if (is_option(arg, "-r")) {
+            global_options |= RAPID_OPTION;
+        }
 
-                // -n -o
-                else if (*(*(argv + 2)) == 45 && *(*(argv + 2)+1) == 111 && *(*(argv + 2)+2) == 0){
+        // -x
+        else if (is_option(arg, "-x")) {
+            global_options |= RELAXED_OPTION;
+        }
 
-                    // -n -o 'none'
-                    if (argc == 3) {
-                        return -1;
-                    }
+        // -j <threads>
+        else if (is_option(arg, "-j")) {
+            if (i + 1 == argc)
+                return -1;
+            i++;
+            thread_count = parse_count(*(argv + i), MAX_THREADS);
+            if (thread_count < 1)
+                return -1;
+        }
 
-                    // -n -o something
-                    else if (argc == 4) {
-                        global_options = NEWICK_OPTION;
-                        outlier_name = *(argv + 3);
-                        return 0;
-                    }
+        // --binary
+        else if (is_option(arg, "--binary")) {
+            global_options |= BINARY_OPTION;
+        }
 
-                    else
-                        return -1;
-                }
+        // --float32
+        else if (is_option(arg, "--float32")) {
+            global_options |= FLOAT32_OPTION;
+        }
 
-                // -n -z
-                else {
+        // -b <manifest> or -s, at most one of them
+        else if (is_option(arg, "-b") || is_option(arg, "-s")) {
+            if (global_options & (BATCH_OPTION | STREAM_OPTION))
+                return -1;
+            if (is_option(arg, "-b")) {
+                if (i + 1 == argc)
                     return -1;
-                }
+                i++;
+                batch_manifest = *(argv + i);
+                global_options |= BATCH_OPTION;
             }
-
             else
+                global_options |= STREAM_OPTION;
+        }
+
+        // --bootstrap <replicates>
+        else if (is_option(arg, "--bootstrap")) {
+            if ((global_options & BOOTSTRAP_OPTION) || i + 1 == argc)
+                return -1;
+            i++;
+            bootstrap_replicates = parse_count(*(argv + i), MAX_REPLICATES);
+            if (bootstrap_replicates < 1)
+                return -1;
+            global_options |= BOOTSTRAP_OPTION;
+        }
+
+        // -v or --stats
+        else if (is_option(arg, "-v") || is_option(arg, "--stats")) {
+            global_options |= STATS_OPTION;
+        }
+
+        // --matrix-file <file>
+        else if (is_option(arg, "--matrix-file")) {
+            if (matrix_path != NULL || i + 1 == argc)
+                return -1;
+            i++;
+            matrix_path = *(argv + i);
+        }
+
+        // --insert <edges>
+        else if (is_option(arg, "--insert")) {
+            if ((global_options & INSERT_OPTION) || i + 1 == argc)
+                return -1;
+            i++;
+            insert_tree = *(argv + i);
+            global_options |= INSERT_OPTION;
+        }
+
+        // --rebuild-check
+        else if (is_option(arg, "--rebuild-check")) {
+            global_options |= REBUILD_CHECK_OPTION;
+        }
+
+        // --checkpoint <file>
+        else if (is_option(arg, "--checkpoint")) {
+            if (checkpoint_path != NULL || i + 1 == argc)
+                return -1;
+            i++;
+            checkpoint_path = *(argv + i);
+        }
+
+        // --checkpoint-interval <seconds>, which may be 0
+        else if (is_option(arg, "--checkpoint-interval")) {
+            if (interval_given || i + 1 == argc)
                 return -1;
+            i++;
+            checkpoint_seconds = is_option(*(argv + i), "0") ? 0
+                : parse_count(*(argv + i), MAX_CHECKPOINT_INTERVAL);
+            if (checkpoint_seconds < 0)
+                return -1;
+            interval_given = 1;
+        }
+
+        // --resume
+        else if (is_option(arg, "--resume")) {
+            global_options |= RESUME_OPTION;
         }
+
+        // --huge-pages
+        else if (is_option(arg, "--huge-pages")) {
+            global_options |= HUGE_PAGES_OPTION;
+        }
+
+        else
+            return -1;
     }
+
+    // a batch produces trees, not a converted input
+    if ((global_options & (BATCH_OPTION | STREAM_OPTION)) && (global_options & CONVERT_OPTION))
+        return -1;
+    // -r and -x choose the pairs to join in different ways
+    if ((global_options & RAPID_OPTION) && (global_options & RELAXED_OPTION))
+        return -1;
+    // only the matrix of -m has a binary form to choose
+    if ((global_options & BINARY_OPTION) && !(global_options & MATRIX_OPTION))
+        return -1;
+    // the support values label a Newick tree, of a single matrix
+    if ((global_options & BOOTSTRAP_OPTION)
+        && (!(global_options & NEWICK_OPTION) || (global_options & (BATCH_OPTION | STREAM_OPTION))))
+        return -1;
+    // the matrix of -m, the sorted rows of -r and the replicates of a bootstrap
+    // are as large as the distance matrix and stay in memory; so do the matrices of a batch
+    if (matrix_path != NULL
+        && (global_options & (MATRIX_OPTION | RAPID_OPTION | BOOTSTRAP_OPTION | BATCH_OPTION | STREAM_OPTION)))
+        return -1;
+    // the matrix is either in the file or in huge pages
+    if (matrix_path != NULL && (global_options & HUGE_PAGES_OPTION))
+        return -1;
+    // taxa are inserted into the tree of a single matrix, which has no matrix of node distances;
+    // only an insertion is checked against a rebuild
+    if ((global_options & INSERT_OPTION)
+        && (global_options & (MATRIX_OPTION | CONVERT_OPTION | BATCH_OPTION | STREAM_OPTION | BOOTSTRAP_OPTION)))
+        return -1;
+    if ((global_options & REBUILD_CHECK_OPTION) && !(global_options & INSERT_OPTION))
+        return -1;
+    // a checkpoint is of the build of a single tree, and what it is resumed from
+    if (checkpoint_path != NULL
+        && (global_options & (CONVERT_OPTION | BATCH_OPTION | STREAM_OPTION | BOOTSTRAP_OPTION | INSERT_OPTION)))
+        return -1;
+    if ((interval_given || (global_options & RESUME_OPTION)) && checkpoint_path == NULL)
+        return -1;
+    // the statistics are those of a single run
+    if ((global_options & STATS_OPTION) && (global_options & (BATCH_OPTION | STREAM_OPTION | BOOTSTRAP_OPTION)))
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief Validates command line arguments passed to the program.
+ * @details This function will validate all the arguments passed to the
+ * program, returning 0 if validation succeeds and -1 if validation fails.
+ * Upon successful return, the various options that were specified will be
+ * encoded in the global variable 'global_options', where it will be
+ * accessible elsewhere in the program.  For details of the required
+ * encoding, see the assignment handout.  The other options are stored in
+ * the variables of options.h, and all of them are also made those of the
+ * default context of the calling thread (see context.h), in which the
+ * functions of global.h then run as the command line asks.
+ *
+ * @param argc The number of arguments passed to the program from the CLI.
+ * @param argv The argument strings passed to the program from the CLI.
+ * @return 0 if validation succeeds and -1 if validation fails.
+ * @modifies global variable "global_options" to contain an encoded representation
+ * of the selected program options.
+ */
+int validargs(int argc, char **argv)
+{
+    if (parse_args(argc, argv))
+        return -1;
+    philo_set_options(current_context, global_options, outlier_name, thread_count);
+    if (philo_set_matrix_file(current_context, matrix_path)
+        || philo_set_checkpoint(current_context, checkpoint_path, checkpoint_seconds))
+        return -1;
     return 0;
 }
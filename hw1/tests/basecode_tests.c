@@ -1,8 +1,13 @@
+#include <stdlib.h>
+#include <string.h>
 #include <sys/wait.h>
+#include <unistd.h>
 #include <criterion/criterion.h>
 #include <criterion/logging.h>
 
 #include "global.h"
+#include "context.h"
+#include "binmatrix.h"
 
 #define progname "bin/philo"
 
@@ -71,6 +76,56 @@ Test(basecode_suite, validargs_error_test, .timeout = 5) {
 		 ret, exp_ret);
 }
 
+Test(basecode_suite, validargs_rapid_test, .timeout = 5) {
+    char *argv[] = {progname, "-n", "-r", NULL};
+    int argc = (sizeof(argv) / sizeof(char *)) - 1;
+    int ret = validargs(argc, argv);
+    int exp_ret = 0;
+    int opt = global_options;
+    int exp_opt = NEWICK_OPTION | RAPID_OPTION;
+    cr_assert_eq(ret, exp_ret, "Invalid return for validargs.  Got: %d | Expected: %d",
+		 ret, exp_ret);
+    cr_assert_eq(opt, exp_opt, "Invalid options settings.  Got: 0x%x | Expected: 0x%x",
+		 opt, exp_opt);
+}
+
+Test(basecode_suite, validargs_threads_test, .timeout = 5) {
+    char *argv[] = {progname, "-j", "4", "-m", NULL};
+    int argc = (sizeof(argv) / sizeof(char *)) - 1;
+    int ret = validargs(argc, argv);
+    int exp_ret = 0;
+    int opt = global_options;
+    int exp_opt = MATRIX_OPTION;
+    cr_assert_eq(ret, exp_ret, "Invalid return for validargs.  Got: %d | Expected: %d",
+		 ret, exp_ret);
+    cr_assert_eq(opt, exp_opt, "Invalid options settings.  Got: 0x%x | Expected: 0x%x",
+		 opt, exp_opt);
+    cr_assert_eq(thread_count, 4, "Thread count not properly set.  Got: %d | Expected: %d",
+		 thread_count, 4);
+}
+
+Test(basecode_suite, validargs_float32_test, .timeout = 5) {
+    char *argv[] = {progname, "--float32", "-r", NULL};
+    int argc = (sizeof(argv) / sizeof(char *)) - 1;
+    int ret = validargs(argc, argv);
+    int exp_ret = 0;
+    int opt = global_options;
+    int exp_opt = FLOAT32_OPTION | RAPID_OPTION;
+    cr_assert_eq(ret, exp_ret, "Invalid return for validargs.  Got: %d | Expected: %d",
+		 ret, exp_ret);
+    cr_assert_eq(opt, exp_opt, "Invalid options settings.  Got: 0x%x | Expected: 0x%x",
+		 opt, exp_opt);
+}
+
+Test(basecode_suite, validargs_relaxed_rapid_test, .timeout = 5) {
+    char *argv[] = {progname, "-x", "-n", "-r", NULL};
+    int argc = (sizeof(argv) / sizeof(char *)) - 1;
+    int ret = validargs(argc, argv);
+    int exp_ret = -1;
+    cr_assert_eq(ret, exp_ret, "Invalid return for validargs.  Got: %d | Expected: %d",
+		 ret, exp_ret);
+}
+
 Test(basecode_suite, help_system_test, .timeout = 5) {
     char *cmd = "bin/philo -h > /dev/null 2>&1";
 
@@ -97,3 +152,409 @@ Test(basecode_suite, philo_basic_test, .timeout = 5) {
     cr_assert_eq(return_code, EXIT_SUCCESS,
                  "Program output did not match reference output.");
 }
+
+Test(basecode_suite, stark_tree_test, .timeout = 5) {
+    // a sample full of taxa at distance 0, whose Q values tie over and over; -r and -j break the ties alike
+    char *cmd = "bin/philo -n < rsrc/stark_familytree_dna.csv > test_output/stark_tree_test.out"
+        " && bin/philo -n -r < rsrc/stark_familytree_dna.csv > test_output/stark_tree_test.rapid"
+        " && bin/philo -n -j 3 < rsrc/stark_familytree_dna.csv > test_output/stark_tree_test.threads";
+    char *cmp = "cmp test_output/stark_tree_test.out rsrc/stark_familytree_dna.nwk"
+        " && cmp test_output/stark_tree_test.rapid rsrc/stark_familytree_dna.nwk"
+        " && cmp test_output/stark_tree_test.threads rsrc/stark_familytree_dna.nwk";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Program exited with 0x%x instead of EXIT_SUCCESS",
+		 return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "The tree of the Stark sample is not the expected one.");
+}
+
+Test(basecode_suite, many_taxa_test, .timeout = 10) {
+    // a noisy matrix of 200 taxa from bench/genmatrix (-s 7 -e 0.1 200), well past the old limit of 100
+    char *cmd = "bin/philo -n < rsrc/random_200.csv > test_output/many_taxa_test.out"
+        " && bin/philo -n -r < rsrc/random_200.csv > test_output/many_taxa_test.rapid"
+        " && bin/philo -n -j 3 < rsrc/random_200.csv > test_output/many_taxa_test.threads"
+        " && bin/philo -n -r -j 3 < rsrc/random_200.csv > test_output/many_taxa_test.both";
+    char *cmp = "cmp test_output/many_taxa_test.out rsrc/random_200.nwk"
+        " && cmp test_output/many_taxa_test.rapid rsrc/random_200.nwk"
+        " && cmp test_output/many_taxa_test.threads rsrc/random_200.nwk"
+        " && cmp test_output/many_taxa_test.both rsrc/random_200.nwk";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Program exited with 0x%x instead of EXIT_SUCCESS",
+		 return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "The tree of the 200-taxon sample is not the expected one.");
+}
+
+Test(basecode_suite, parallel_read_test, .timeout = 10) {
+    // a 600-taxon matrix of 2.8 MB, enough for the rows to be read in two chunks of at least 1 MiB;
+    // the copy has one entry below the diagonal changed, which the serial reader reports
+    char *gen = "awk 'BEGIN { n = 600; for (j = 0; j < n; j++) printf \",t%d\", j; printf \"\\n\";"
+        " for (i = 0; i < n; i++) { printf \"t%d\", i; for (j = 0; j < n; j++) {"
+        " a = i < j ? i : j; b = i < j ? j : i;"
+        " printf \",%.4f\", i == j ? 0 : 10 + (a * 7919 + b * 104729) % 99991 / 1000.0 } printf \"\\n\" } }'"
+        " > test_output/parallel_read_test.csv"
+        " && awk -F, -v OFS=, 'NR == 452 { $22 = \"1.5000\" } { print }' test_output/parallel_read_test.csv"
+        " > test_output/parallel_read_test.asym";
+    char *cmd = "bin/philo -j 4 < test_output/parallel_read_test.csv > test_output/parallel_read_test.out"
+        " && bin/philo -j 1 < test_output/parallel_read_test.csv > test_output/parallel_read_test.exp";
+    char *cmp = "cmp test_output/parallel_read_test.out test_output/parallel_read_test.exp";
+    char *asym = "bin/philo -j 4 < test_output/parallel_read_test.asym > /dev/null 2> test_output/parallel_read_test.err";
+    char *msg = "bin/philo -j 1 < test_output/parallel_read_test.asym 2>&1 > /dev/null"
+        " | cmp - test_output/parallel_read_test.err"
+        " && grep -q 'line 452, field 22: distances are not symmetric' test_output/parallel_read_test.err";
+
+    int return_code = WEXITSTATUS(system(gen));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Generating the matrix exited with 0x%x instead of EXIT_SUCCESS",
+		 return_code);
+    return_code = WEXITSTATUS(system(cmd));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Program exited with 0x%x instead of EXIT_SUCCESS",
+		 return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "The rows read in parallel did not give the tree of the rows read serially.");
+    return_code = WEXITSTATUS(system(asym));
+    cr_assert_neq(return_code, EXIT_SUCCESS,
+                  "An asymmetric matrix was not rejected.");
+    return_code = WEXITSTATUS(system(msg));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "The asymmetric matrix was not reported as the serial reader reports it.");
+}
+
+Test(basecode_suite, relaxed_joining_test, .timeout = 5) {
+    // the Saitou-Nei sample is additive, so relaxed joining finds the exact tree too, in 3 passes;
+    // rsrc/saitou_nei_relaxed.nwk is that tree as -x writes it, with its nodes made in another order
+    char *cmd = "bin/philo -n -x < rsrc/saitou_nei.csv > test_output/relaxed_joining_test.out"
+        " 2> test_output/relaxed_joining_test.err"
+        " && bin/philo -n -x -j 3 < rsrc/saitou_nei.csv > test_output/relaxed_joining_test.threads 2> /dev/null";
+    char *cmp = "cmp test_output/relaxed_joining_test.out rsrc/saitou_nei_relaxed.nwk"
+        " && cmp test_output/relaxed_joining_test.threads rsrc/saitou_nei_relaxed.nwk";
+    char *msg = "echo 'relaxed joining: 3 passes over the matrix' | cmp - test_output/relaxed_joining_test.err";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Program exited with 0x%x instead of EXIT_SUCCESS",
+		 return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Relaxed joining did not give the tree of the additive sample.");
+    return_code = WEXITSTATUS(system(msg));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Relaxed joining did not report its number of passes.");
+}
+
+Test(basecode_suite, q_kernel_test, .timeout = 10) {
+    // every version of the Q row kernel must find the same pairs as the scalar one, in double and
+    // in single precision; a version the processor lacks falls back to one it has, which must agree too
+    char *cmd = "for k in scalar sse2 avx2; do"
+        " PHILO_KERNEL=$k bin/philo < rsrc/random_200.csv > test_output/q_kernel_test.$k"
+        " && PHILO_KERNEL=$k bin/philo --float32 < rsrc/random_200.csv > test_output/q_kernel_test.$k.f32"
+        " && PHILO_KERNEL=$k bin/philo < rsrc/stark_familytree_dna.csv > test_output/q_kernel_test.$k.stark"
+        " || exit 1; done";
+    char *cmp = "for k in sse2 avx2; do"
+        " cmp test_output/q_kernel_test.scalar test_output/q_kernel_test.$k"
+        " && cmp test_output/q_kernel_test.scalar.f32 test_output/q_kernel_test.$k.f32"
+        " && cmp test_output/q_kernel_test.scalar.stark test_output/q_kernel_test.$k.stark"
+        " || exit 1; done";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Program exited with 0x%x instead of EXIT_SUCCESS",
+		 return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "A vector version of the Q row kernel did not give the output of the scalar one.");
+}
+
+Test(basecode_suite, philo_binary_input_test, .timeout = 5) {
+    char *conv = "bin/philo -c < rsrc/wikipedia.csv > test_output/philo_binary_input_test.bin";
+    char *cmd = "bin/philo < test_output/philo_binary_input_test.bin > test_output/philo_binary_input_test.out";
+    char *ref = "bin/philo < rsrc/wikipedia.csv > test_output/philo_binary_input_test.exp";
+    char *cmp = "cmp test_output/philo_binary_input_test.out test_output/philo_binary_input_test.exp";
+
+    int return_code = WEXITSTATUS(system(conv));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Conversion exited with 0x%x instead of EXIT_SUCCESS",
+		 return_code);
+    return_code = WEXITSTATUS(system(cmd));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Program exited with 0x%x instead of EXIT_SUCCESS",
+		 return_code);
+    return_code = WEXITSTATUS(system(ref));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Program exited with 0x%x instead of EXIT_SUCCESS",
+		 return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Output from binary input did not match output from CSV input.");
+}
+
+Test(basecode_suite, matrix_binary_output_test, .timeout = 5) {
+    char *text;
+    size_t length;
+    BIN_MATRIX matrix;
+    PHILO_CONTEXT *context = philo_create();
+    cr_assert_not_null(context, "Could not create a context.");
+    philo_set_options(context, PHILO_MATRIX | PHILO_BINARY, NULL, 1);
+
+    FILE *in = fopen("rsrc/wikipedia.csv", "r");
+    FILE *out = open_memstream(&text, &length);
+    int ret = philo_run(context, in, out);
+    fclose(in);
+    fclose(out);
+    philo_destroy(context);
+    cr_assert_eq(ret, 0, "The run failed.");
+
+    cr_assert_null(bin_parse(text, length, INPUT_MAX, &matrix), "The output is not a binary matrix.");
+    cr_assert_eq(matrix.count, 8, "Expected the 5 taxa and 3 internal nodes, got %d nodes.", matrix.count);
+    cr_assert_eq(matrix.precision, sizeof(double), "Expected a matrix of doubles.");
+    const double *entries = matrix.matrix;
+    cr_assert(*(entries + tri_index(1, 0)) == 5.0 && *(entries + tri_index(5, 0)) == 2.0,
+              "The binary matrix does not hold the distances of -m.");
+    free(text);
+}
+
+Test(basecode_suite, stats_report_test, .timeout = 5) {
+    char *text;
+    size_t length;
+    char *report;
+    size_t report_length;
+    PHILO_CONTEXT *context = philo_create();
+    cr_assert_not_null(context, "Could not create a context.");
+    philo_set_options(context, PHILO_NEWICK | PHILO_STATS, NULL, 1);
+
+    FILE *in = fopen("rsrc/wikipedia.csv", "r");
+    FILE *out = open_memstream(&text, &length);
+    FILE *messages = open_memstream(&report, &report_length);
+    philo_set_messages(context, messages);
+    int ret = philo_run(context, in, out);
+    fclose(in);
+    fclose(out);
+    fclose(messages);
+    philo_destroy(context);
+    cr_assert_eq(ret, 0, "The run failed.");
+
+    char expected[64];
+    snprintf(expected, sizeof(expected), "\"bytes_written\":%zu}", length);
+    cr_assert(*report == '{' && strstr(report, "\"joins\":3,") != NULL && strstr(report, expected) != NULL,
+              "Unexpected report: %s", report);
+    free(text);
+    free(report);
+}
+
+Test(basecode_suite, matrix_file_test, .timeout = 5) {
+    char *path = "test_output/matrix_file_test.matrix";
+    char *cmd = "bin/philo -n --matrix-file test_output/matrix_file_test.matrix < rsrc/wikipedia.csv"
+        " > test_output/matrix_file_test.out";
+    char *ref = "bin/philo -n < rsrc/wikipedia.csv > test_output/matrix_file_test.exp";
+    char *cmp = "cmp test_output/matrix_file_test.out test_output/matrix_file_test.exp";
+
+    remove(path);
+    int return_code = WEXITSTATUS(system(cmd));
+    cr_assert_eq(return_code, EXIT_SUCCESS, "Program exited with 0x%x instead of EXIT_SUCCESS", return_code);
+    cr_assert(access(path, F_OK) != 0, "The matrix file was left behind.");
+    return_code = WEXITSTATUS(system(ref));
+    cr_assert_eq(return_code, EXIT_SUCCESS, "Program exited with 0x%x instead of EXIT_SUCCESS", return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    cr_assert_eq(return_code, EXIT_SUCCESS, "The tree differs from the one built in memory.");
+}
+
+Test(basecode_suite, philo_stream_batch_test, .timeout = 5) {
+    char *cmd = "cat rsrc/wikipedia.csv rsrc/wikipedia.csv | bin/philo -s -j 2"
+        " > test_output/philo_stream_batch_test.out";
+    char *ref = "(for k in 1 2; do echo \"# matrix $k\"; bin/philo < rsrc/wikipedia.csv; done)"
+        " > test_output/philo_stream_batch_test.exp";
+    char *cmp = "cmp test_output/philo_stream_batch_test.out test_output/philo_stream_batch_test.exp";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Program exited with 0x%x instead of EXIT_SUCCESS",
+		 return_code);
+    return_code = WEXITSTATUS(system(ref));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Program exited with 0x%x instead of EXIT_SUCCESS",
+		 return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Output of the batch did not match the output of single runs.");
+}
+
+Test(basecode_suite, batch_few_taxa_test, .timeout = 5) {
+    // matrices of 1 and 2 taxa have no Newick tree: each is reported, and the batch goes on
+    char *cmd = "printf ',a\\na,0\\n' > test_output/batch_few_taxa_test.one"
+        " && printf ',a,b\\na,0,3\\nb,3,0\\n' > test_output/batch_few_taxa_test.two"
+        " && printf 'test_output/batch_few_taxa_test.one\\ntest_output/batch_few_taxa_test.two\\nrsrc/wikipedia.csv\\n'"
+        " > test_output/batch_few_taxa_test.list"
+        " && bin/philo -n -b test_output/batch_few_taxa_test.list"
+        " > test_output/batch_few_taxa_test.out 2> test_output/batch_few_taxa_test.err";
+    char *cmp = "test $(grep -c ': too few taxa for a Newick tree$' test_output/batch_few_taxa_test.err) -eq 2"
+        " && (sed 's/^/# /' test_output/batch_few_taxa_test.list; bin/philo -n < rsrc/wikipedia.csv)"
+        " | cmp - test_output/batch_few_taxa_test.out";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    cr_assert_neq(return_code, EXIT_SUCCESS,
+                  "The batch succeeded although two of its matrices have too few taxa.");
+    return_code = WEXITSTATUS(system(cmp));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "The matrices with too few taxa were not reported, or the other one was not built.");
+}
+
+Test(basecode_suite, bootstrap_support_test, .timeout = 20) {
+    // the same support values with any number of threads, on the tree of -n
+    char *cmd = "bin/philo -n -j 3 --bootstrap 50 < rsrc/stark_familytree_dna.csv"
+        " > test_output/bootstrap_support_test.out";
+    char *ref = "bin/philo -n --bootstrap 50 < rsrc/stark_familytree_dna.csv"
+        " > test_output/bootstrap_support_test.exp";
+    char *cmp = "cmp test_output/bootstrap_support_test.out test_output/bootstrap_support_test.exp"
+        " && bin/philo -n < rsrc/stark_familytree_dna.csv | sed -E 's/\\)#[0-9]+:/):/g'"
+        " > test_output/bootstrap_support_test.tree"
+        " && sed -E 's/\\)[0-9]+:/):/g' test_output/bootstrap_support_test.out"
+        " | cmp - test_output/bootstrap_support_test.tree";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Program exited with 0x%x instead of EXIT_SUCCESS",
+		 return_code);
+    return_code = WEXITSTATUS(system(ref));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Program exited with 0x%x instead of EXIT_SUCCESS",
+		 return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Support values changed with the threads, or the tree is not that of -n.");
+}
+
+Test(basecode_suite, library_context_reuse_test, .timeout = 5) {
+    char *first;
+    char *second;
+    size_t first_length;
+    size_t second_length;
+    PHILO_CONTEXT *context = philo_create();
+    cr_assert_not_null(context, "Could not create a context.");
+    philo_set_options(context, PHILO_NEWICK, NULL, 1);
+
+    // the same run twice in one context, with another run in between
+    for (int run = 0; run < 3; run++) {
+        FILE *in = fopen(run == 1 ? "rsrc/harrison1.csv" : "rsrc/wikipedia.csv", "r");
+        cr_assert_not_null(in, "Could not open the input.");
+        FILE *out = run == 0 ? open_memstream(&first, &first_length)
+            : run == 2 ? open_memstream(&second, &second_length) : fopen("/dev/null", "w");
+        int ret = philo_run(context, in, out);
+        fclose(in);
+        fclose(out);
+        cr_assert_eq(ret, 0, "Run %d failed.", run);
+    }
+    philo_destroy(context);
+
+    cr_assert(first_length > 0 && first_length == second_length
+              && memcmp(first, second, first_length) == 0,
+              "A reused context gave another tree.");
+    free(first);
+    free(second);
+}
+
+Test(basecode_suite, library_few_taxa_test, .timeout = 5) {
+    // a valid matrix of 2 taxa has no Newick tree: the run fails, without taking the caller down
+    char *text;
+    char *report;
+    size_t length;
+    size_t report_length;
+    char matrix[] = ",a,b\na,0,3\nb,3,0\n";
+    PHILO_CONTEXT *context = philo_create();
+    cr_assert_not_null(context, "Could not create a context.");
+    philo_set_options(context, PHILO_NEWICK, NULL, 1);
+
+    FILE *in = fmemopen(matrix, strlen(matrix), "r");
+    FILE *out = open_memstream(&text, &length);
+    FILE *messages = open_memstream(&report, &report_length);
+    philo_set_messages(context, messages);
+    int ret = philo_run(context, in, out);
+    fclose(in);
+    fclose(out);
+    fclose(messages);
+    philo_destroy(context);
+
+    cr_assert_eq(ret, -1, "The run of a 2-taxon matrix returned %d instead of -1.", ret);
+    cr_assert(strstr(report, "too few taxa for a Newick tree") != NULL, "Unexpected messages: %s", report);
+    free(text);
+    free(report);
+}
+
+Test(basecode_suite, library_header_test, .timeout = 5) {
+    // philo.h defines no macros but its own PHILO_ ones, and the library leaves out the options of the program
+    char *cmd = "echo '#include <stdio.h>' | gcc -std=c99 -dM -E -x c - | sort > test_output/library_header_test.exp"
+        " && echo '#include \"philo.h\"' | gcc -std=c99 -dM -E -I include -x c - | sort"
+        " | comm -13 test_output/library_header_test.exp - > test_output/library_header_test.out";
+    char *cmp = "! grep -v '^#define PHILO_' test_output/library_header_test.out"
+        " && ! nm lib/libphilo.a | grep -w -e thread_count -e matrix_path -e checkpoint_path";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Could not preprocess philo.h, exited with 0x%x",
+		 return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "philo.h defines macros other than the PHILO_ ones, or the library defines options of the program.");
+}
+
+Test(basecode_suite, insert_taxa_test, .timeout = 5) {
+    // the tree of the first four taxa, and then the fifth inserted into it
+    char *cmd = "grep -v '^#' rsrc/wikipedia.csv | head -n 5 | cut -d, -f 1-5 > test_output/insert_taxa_test.csv"
+        " && bin/philo < test_output/insert_taxa_test.csv > test_output/insert_taxa_test.tree"
+        " && bin/philo --insert test_output/insert_taxa_test.tree --rebuild-check < rsrc/wikipedia.csv"
+        " > test_output/insert_taxa_test.out 2> test_output/insert_taxa_test.err";
+    char *cmp = "grep -q '^rebuild check: 0 of the 2 splits differ' test_output/insert_taxa_test.err"
+        " && test $(wc -l < test_output/insert_taxa_test.out) -eq 7";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Program exited with 0x%x instead of EXIT_SUCCESS",
+		 return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "The tree with the inserted taxon is not the one built from scratch.");
+}
+
+Test(basecode_suite, taxon_names_test, .timeout = 5) {
+    // a name given twice on the first line is an error, and -o finds the outlier by its name
+    char *dup = "grep -v '^#' rsrc/wikipedia.csv | sed '1s/,e$/,d/' | bin/philo > /dev/null 2>&1";
+    char *cmd = "bin/philo -n -o d < rsrc/wikipedia.csv > test_output/taxon_names_test.out";
+    char *cmp = "grep -q 'e:' test_output/taxon_names_test.out && ! grep -q 'd:' test_output/taxon_names_test.out";
+
+    int return_code = WEXITSTATUS(system(dup));
+    cr_assert_neq(return_code, EXIT_SUCCESS,
+                  "A duplicate taxon name was not rejected.");
+    return_code = WEXITSTATUS(system(cmd));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Program exited with 0x%x instead of EXIT_SUCCESS",
+		 return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "The outlier named on the command line was not the one left out of the tree.");
+}
+
+Test(basecode_suite, checkpoint_resume_test, .timeout = 5) {
+    // a checkpoint after every join; the last one is resumed from, without the input
+    char *cmd = "rm -f test_output/checkpoint_resume_test.ckpt"
+        " && bin/philo --checkpoint test_output/checkpoint_resume_test.ckpt --checkpoint-interval 0"
+        " < rsrc/stark_familytree_dna.csv > test_output/checkpoint_resume_test.exp"
+        " && bin/philo --checkpoint test_output/checkpoint_resume_test.ckpt --resume < /dev/null"
+        " > test_output/checkpoint_resume_test.out";
+    char *cmp = "bin/philo < rsrc/stark_familytree_dna.csv | cmp - test_output/checkpoint_resume_test.exp"
+        " && cmp test_output/checkpoint_resume_test.out test_output/checkpoint_resume_test.exp";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Program exited with 0x%x instead of EXIT_SUCCESS",
+		 return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "The resumed build did not give the output of the build it was checkpointed from.");
+}